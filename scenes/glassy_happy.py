@@ -69,6 +69,7 @@ si.SetProperty2('ren1', 'resolution', 640, 480)
 #si.SetProperty2('ren1', 'resolution', 160, 120)
 si.SetProperty1('ren1', 'max_refract_depth', 10)
 si.SetProperty1('ren1', 'cast_shadow', 0)
+si.SetProperty1('ren1', 'roulette_threshold', .05)
 
 #Rendering
 si.RenderScene('ren1')
@@ -29,7 +29,8 @@ public:
 static const char MyPluginName[] = "ConstantShader";
 
 static const ShaderFunctionTable MyFunctionTable = {
-  MyEvaluate
+  MyEvaluate,
+  NULL
 };
 
 static int set_diffuse(void *self, const PropertyValue *value);
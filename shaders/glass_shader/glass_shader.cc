@@ -38,7 +38,8 @@ static void MyEvaluate(const void *self, const TraceContext *cxt,
 static const char MyPluginName[] = "GlassShader";
 
 static const ShaderFunctionTable MyFunctionTable = {
-  MyEvaluate
+  MyEvaluate,
+  NULL
 };
 
 static int set_diffuse(void *self, const PropertyValue *value);
@@ -117,6 +118,7 @@ static void MyEvaluate(const void *self, const TraceContext *cxt,
 
   // reflect
   refl_cxt = SlReflectContext(cxt, in->shaded_object);
+  SlScaleThroughput(&refl_cxt, Kr);
   SlReflect(&in->I, &in->N, &R);
   Normalize(&R);
   // TODO fix hard-coded trace distance
@@ -127,6 +129,7 @@ static void MyEvaluate(const void *self, const TraceContext *cxt,
 
   // refract
   refr_cxt = SlRefractContext(cxt, in->shaded_object);
+  SlScaleThroughput(&refr_cxt, Kt);
   SlRefract(&in->I, &in->N, 1/glass->ior, &T);
   Normalize(&T);
   SlTrace(&refr_cxt, &in->P, &T, .0001, 1000, &C_refr, &t_hit);
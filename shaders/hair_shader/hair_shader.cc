@@ -34,7 +34,8 @@ static void MyEvaluate(const void *self, const TraceContext *cxt,
 
 static const char MyPluginName[] = "HairShader";
 static const ShaderFunctionTable MyFunctionTable = {
-  MyEvaluate
+  MyEvaluate,
+  NULL
 };
 
 static int set_diffuse(void *self, const PropertyValue *value);
@@ -102,10 +103,10 @@ static void MyEvaluate(const void *self, const TraceContext *cxt,
   int i = 0;
 
   LightSample *samples = NULL;
-  const int nsamples = SlGetLightSampleCount(in);
+  const int nsamples = SlGetLightSampleCount(cxt, in);
 
   // allocate samples
-  samples = SlNewLightSamples(in);
+  samples = SlNewLightSamples(cxt, in);
 
   out->Cs = Color();
 
@@ -128,7 +129,7 @@ static void MyEvaluate(const void *self, const TraceContext *cxt,
     out->Cs.b += (in->Cd.b * hair->diffuse.b * diff + spec) * Lout.Cl.b;
   }
 
-  SlFreeLightSamples(samples);
+  SlFreeLightSamples(cxt, samples);
 
   out->Os = 1;
 }
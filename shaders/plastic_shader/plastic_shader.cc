@@ -42,7 +42,8 @@ static void MyEvaluate(const void *self, const TraceContext *cxt,
 
 static const char MyPluginName[] = "PlasticShader";
 static const ShaderFunctionTable MyFunctionTable = {
-  MyEvaluate
+  MyEvaluate,
+  NULL
 };
 
 static int set_diffuse(void *self, const PropertyValue *value);
@@ -119,7 +120,7 @@ static void MyEvaluate(const void *self, const TraceContext *cxt,
   int i = 0;
 
   LightSample *samples = NULL;
-  const int nsamples = SlGetLightSampleCount(in);
+  const int nsamples = SlGetLightSampleCount(cxt, in);
 
   SlFaceforward(&in->I, &in->N, &Nf);
 
@@ -134,7 +135,7 @@ static void MyEvaluate(const void *self, const TraceContext *cxt,
   }
 
   // allocate samples
-  samples = SlNewLightSamples(in);
+  samples = SlNewLightSamples(cxt, in);
 
   for (i = 0; i < nsamples; i++) {
     LightOutput Lout;
@@ -154,7 +155,7 @@ static void MyEvaluate(const void *self, const TraceContext *cxt,
   }
 
   // free samples
-  SlFreeLightSamples(samples);
+  SlFreeLightSamples(cxt, samples);
 
   // diffuse map
   if (plastic->diffuse_map != NULL) {
@@ -173,13 +174,15 @@ static void MyEvaluate(const void *self, const TraceContext *cxt,
     double t_hit = FLT_MAX;
     double Kr = 0;
 
-    const TraceContext refl_cxt = SlReflectContext(cxt, in->shaded_object);
+    TraceContext refl_cxt = SlReflectContext(cxt, in->shaded_object);
+    Kr = SlFresnel(&in->I, &Nf, 1/plastic->ior);
+    SlScaleThroughput(&refl_cxt, Kr * Max(plastic->reflect.r,
+        Max(plastic->reflect.g, plastic->reflect.b)));
 
     SlReflect(&in->I, &Nf, &R);
     Normalize(&R);
     SlTrace(&refl_cxt, &in->P, &R, .001, 1000, &C_refl, &t_hit);
 
-    Kr = SlFresnel(&in->I, &Nf, 1/plastic->ior);
     out->Cs.r += Kr * C_refl.r * plastic->reflect.r;
     out->Cs.g += Kr * C_refl.g * plastic->reflect.g;
     out->Cs.b += Kr * C_refl.b * plastic->reflect.b;
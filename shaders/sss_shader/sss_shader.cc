@@ -42,8 +42,6 @@ public:
   int enable_single_scattering;
   int enable_multiple_scattering;
 
-  XorShift xr;
-
   float scattering_coeff[3];
   float absorption_coeff[3];
   float extinction_coeff[3];
@@ -69,16 +67,17 @@ static void MyEvaluate(const void *self, const TraceContext *cxt,
 
 static const char MyPluginName[] = "SSSShader";
 static const ShaderFunctionTable MyFunctionTable = {
-  MyEvaluate
+  MyEvaluate,
+  NULL
 };
 
 static void update_sss_properties(SSSShader *sss);
 static void single_scattering(const SSSShader *sss,
     const TraceContext *cxt, const SurfaceInput *in,
-    const LightSample *light_sample, Color *C_scatter);
+    const LightSample *light_sample, XorShift *rng, Color *C_scatter);
 static void diffusion_scattering(const SSSShader *sss,
     const TraceContext *cxt, const SurfaceInput *in,
-    const LightSample *light_sample, Color *C_scatter);
+    const LightSample *light_sample, XorShift *rng, Color *C_scatter);
 
 static int set_diffuse(void *self, const PropertyValue *value);
 static int set_specular(void *self, const PropertyValue *value);
@@ -145,8 +144,6 @@ static void *MyNew(void)
 {
   SSSShader *sss = new SSSShader();
 
-  XorInit(&sss->xr);
-
   PropSetAllDefaultValues(sss, MyProperties);
 
   return sss;
@@ -170,10 +167,18 @@ static void MyEvaluate(const void *self, const TraceContext *cxt,
   int i;
 
   LightSample *samples = NULL;
-  const int nsamples = SlGetLightSampleCount(in);
+  const int nsamples = SlGetLightSampleCount(cxt, in);
+
+  // a fixed stream for traces made outside of render workers
+  XorShift fallback_rng;
+  XorShift *rng = cxt->rng;
+  if (rng == NULL) {
+    XorInit(&fallback_rng);
+    rng = &fallback_rng;
+  }
 
   // allocate samples
-  samples = SlNewLightSamples(in);
+  samples = SlNewLightSamples(cxt, in);
 
   for (i = 0; i < nsamples; i++) {
     LightOutput Lout;
@@ -190,7 +195,7 @@ static void MyEvaluate(const void *self, const TraceContext *cxt,
     spec.b += Ks * sss->specular.b;
 
     if (sss->enable_single_scattering) {
-      single_scattering(sss, cxt, in, &samples[i], &single_scatter);
+      single_scattering(sss, cxt, in, &samples[i], rng, &single_scatter);
       single_scatter.r *= sss->single_scattering_intensity;
       single_scatter.g *= sss->single_scattering_intensity;
       single_scatter.b *= sss->single_scattering_intensity;
@@ -199,7 +204,7 @@ static void MyEvaluate(const void *self, const TraceContext *cxt,
       diff.b += single_scatter.b;
     }
     if (sss->enable_multiple_scattering) {
-      diffusion_scattering(sss, cxt, in, &samples[i], &diffusion_scatter);
+      diffusion_scattering(sss, cxt, in, &samples[i], rng, &diffusion_scatter);
       diffusion_scatter.r *= sss->multiple_scattering_intensity;
       diffusion_scatter.g *= sss->multiple_scattering_intensity;
       diffusion_scatter.b *= sss->multiple_scattering_intensity;
@@ -209,7 +214,7 @@ static void MyEvaluate(const void *self, const TraceContext *cxt,
     }
   }
 
-  SlFreeLightSamples(samples);
+  SlFreeLightSamples(cxt, samples);
 
   // diffuse map
   if (sss->diffuse_map != NULL) {
@@ -228,14 +233,16 @@ static void MyEvaluate(const void *self, const TraceContext *cxt,
     double t_hit = FLT_MAX;
     double Kr = 0;
 
-    const TraceContext refl_cxt = SlReflectContext(cxt, in->shaded_object);
+    TraceContext refl_cxt = SlReflectContext(cxt, in->shaded_object);
+    Kr = SlFresnel(&in->I, &in->N, 1/sss->ior);
+    SlScaleThroughput(&refl_cxt, Kr * Max(sss->reflect.r,
+        Max(sss->reflect.g, sss->reflect.b)));
 
     SlReflect(&in->I, &in->N, &R);
     Normalize(&R);
     // TODO fix hard-coded trace distance
     SlTrace(&refl_cxt, &in->P, &R, .001, 1000, &C_refl, &t_hit);
 
-    Kr = SlFresnel(&in->I, &in->N, 1/sss->ior);
     out->Cs.r += Kr * C_refl.r * sss->reflect.r;
     out->Cs.g += Kr * C_refl.g * sss->reflect.g;
     out->Cs.b += Kr * C_refl.b * sss->reflect.b;
@@ -277,7 +284,7 @@ static void update_sss_properties(SSSShader *sss)
 
 static void single_scattering(const SSSShader *sss,
     const TraceContext *cxt, const SurfaceInput *in,
-    const LightSample *light_sample, Color *C_scatter)
+    const LightSample *light_sample, XorShift *rng, Color *C_scatter)
 {
   const Vector *P = &in->P;
   Vector Ln;
@@ -314,8 +321,7 @@ static void single_scattering(const SSSShader *sss,
   Normalize(&To);
 
   for (i = 0; i < nsamples; i++) {
-    XorShift *mutable_xr = (XorShift *) &sss->xr;
-    const float sp_dist = -log(XorNextFloat01(mutable_xr));
+    const float sp_dist = -log(XorNextFloat01(rng));
 
     for (j = 0; j < 3; j++) {
       Vector P_sample;
@@ -402,7 +408,7 @@ static void single_scattering(const SSSShader *sss,
 
 static void diffusion_scattering(const SSSShader *sss,
     const TraceContext *cxt, const SurfaceInput *in,
-    const LightSample *light_sample, Color *C_scatter)
+    const LightSample *light_sample, XorShift *rng, Color *C_scatter)
 {
   const Vector *P = &in->P;
   const Vector *N = &in->N;
@@ -452,8 +458,7 @@ static void diffusion_scattering(const SSSShader *sss,
   base2 = Cross(*N, base1);
 
   for (i = 0; i < nsamples; i++) {
-    XorShift *mutable_xr = (XorShift *) &sss->xr;
-    const double dist_rand = -log(XorNextFloat01(mutable_xr));
+    const double dist_rand = -log(XorNextFloat01(rng));
 
     for (j = 0; j < 3; j++) {
       const TraceContext self_cxt = SlSelfHitContext(cxt, in->shaded_object);
@@ -481,7 +486,7 @@ static void diffusion_scattering(const SSSShader *sss,
 
       const double dist = dist_rand / sigma_tr[j];
 
-      XorHollowDiskRand(mutable_xr, &disk);
+      XorHollowDiskRand(rng, &disk);
       disk.x *= dist;
       disk.y *= dist;
       P_sample.x = P->x + 1/sigma_tr[j] * (disk.x * base1.x + disk.y * base2.x);
@@ -28,7 +28,8 @@ static void MyEvaluate(const void *self, const TraceContext *cxt,
 
 static const char MyPluginName[] = "VolumeShader";
 static const ShaderFunctionTable MyFunctionTable = {
-  MyEvaluate
+  MyEvaluate,
+  NULL
 };
 
 static int set_diffuse(void *self, const PropertyValue *value);
@@ -83,12 +84,12 @@ static void MyEvaluate(const void *self, const TraceContext *cxt,
   Color diff;
 
   LightSample *samples = NULL;
-  const int nsamples = SlGetLightSampleCount(in);
+  const int nsamples = SlGetLightSampleCount(cxt, in);
 
   int i = 0;
 
   // allocate samples
-  samples = SlNewLightSamples(in);
+  samples = SlNewLightSamples(cxt, in);
 
   for (i = 0; i < nsamples; i++) {
     LightOutput Lout;
@@ -101,7 +102,7 @@ static void MyEvaluate(const void *self, const TraceContext *cxt,
     diff.b += Lout.Cl.b;
   }
 
-  SlFreeLightSamples(samples);
+  SlFreeLightSamples(cxt, samples);
 
   // Cs
   out->Cs.r = diff.r * volume->diffuse.r;
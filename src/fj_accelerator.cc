@@ -6,6 +6,8 @@ See LICENSE and README
 #include "fj_accelerator.h"
 #include "fj_primitive_set.h"
 #include "fj_multi_thread.h"
+#include "fj_intersection.h"
+#include "fj_ray_packet.h"
 #include "fj_ray.h"
 
 #include <iostream>
@@ -114,6 +116,33 @@ bool Accelerator::Intersect(const Ray &ray, Real time, Intersection *isect) cons
   return intersect(ray, time, isect);
 }
 
+int Accelerator::IntersectPacket(const RayPacket &packet,
+    Intersection *isects) const
+{
+  if (!RayPacketMayHitBox(packet, bounds_)) {
+    return 0;
+  }
+
+  return intersect_packet(packet, isects);
+}
+
+int Accelerator::intersect_packet(const RayPacket &packet,
+    Intersection *isects) const
+{
+  int hit_count = 0;
+
+  for (int i = 0; i < packet.count; i++) {
+    Intersection isect;
+
+    if (Intersect(packet.ray[i], packet.time[i], &isect) &&
+        isect.t_hit < packet.ray[i].tmax) {
+      isects[i] = isect;
+      hit_count++;
+    }
+  }
+  return hit_count;
+}
+
 static void build_accelerator_callback(void *data)
 {
   Accelerator *acc = reinterpret_cast<Accelerator *>(data);
@@ -13,6 +13,7 @@ namespace fj {
 
 class Intersection;
 class PrimitiveSet;
+class RayPacket;
 class Ray;
 
 class Accelerator {
@@ -30,11 +31,18 @@ public:
   int Build();
   bool Intersect(const Ray &ray, Real time, Intersection *isect) const;
 
+  // isects[i] is only overwritten when ray i hits closer than its tmax.
+  // returns hit count
+  int IntersectPacket(const RayPacket &packet, Intersection *isects) const;
+
 private:
   virtual int build() = 0;
   virtual bool intersect(const Ray &ray, Real time, Intersection *isect) const = 0;
   virtual const char *get_name() const = 0;
 
+  // traces rays one by one unless overridden
+  virtual int intersect_packet(const RayPacket &packet, Intersection *isects) const;
+
   Box bounds_;
   bool has_built_;
 
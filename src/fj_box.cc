@@ -122,6 +122,31 @@ Real BoxDiagonal(const Box &box)
   return .5 * Length(size);
 }
 
+static unsigned int spread_bits(unsigned int x)
+{
+  x &= 0x3ff;
+  x = (x | (x << 16)) & 0x030000ff;
+  x = (x | (x <<  8)) & 0x0300f00f;
+  x = (x | (x <<  4)) & 0x030c30c3;
+  x = (x | (x <<  2)) & 0x09249249;
+  return x;
+}
+
+unsigned int BoxMortonCode(const Box &box, const Vector &point)
+{
+  const Vector size = BoxSize(box);
+  unsigned int xyz[3] = {0, 0, 0};
+
+  for (int i = 0; i < 3; i++) {
+    if (size[i] > 0) {
+      const Real u = (point[i] - box.min[i]) / size[i];
+      xyz[i] = static_cast<unsigned int>(Clamp(u * 1023, 0., 1023.));
+    }
+  }
+
+  return (spread_bits(xyz[0]) << 2) | (spread_bits(xyz[1]) << 1) | spread_bits(xyz[2]);
+}
+
 void BoxPrint(const Box &box)
 {
   printf("(%g, %g, %g) (%g, %g, %g)\n",
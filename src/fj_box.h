@@ -37,6 +37,10 @@ FJ_API Vector BoxSize(const Box &box);
 FJ_API Vector BoxCentroid(const Box &box);
 FJ_API Real BoxDiagonal(const Box &box);
 
+// 30 bit code of a point along a morton curve in the box.
+// points outside the box are clamped to it
+FJ_API unsigned int BoxMortonCode(const Box &box, const Vector &point);
+
 FJ_API void BoxPrint(const Box &box);
 
 } // namespace xxx
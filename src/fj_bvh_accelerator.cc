@@ -5,6 +5,7 @@
 #include "fj_intersection.h"
 #include "fj_primitive_set.h"
 #include "fj_accelerator.h"
+#include "fj_ray_packet.h"
 #include "fj_numeric.h"
 #include "fj_box.h"
 #include "fj_ray.h"
@@ -12,7 +13,6 @@
 #include <algorithm>
 #include <utility>
 #include <vector>
-#include <stack>
 #include <cassert>
 
 namespace fj {
@@ -55,12 +55,66 @@ public:
   int prim_id;
 };
 
+// median split keeps the depth at log2 of primitive count so that
+// traversal never needs more than this on the stack
+enum { BVH_STACKSIZE = 64 };
+
+// node stack for traversal. lives on the call stack to avoid heap
+// allocation for every ray.
+class BVHNodeStack {
+public:
+  BVHNodeStack() : depth_(0) {}
+  ~BVHNodeStack() {}
+
+  bool empty() const { return depth_ == 0; }
+  const BVHNode *top() const { return node_[depth_ - 1]; }
+  void pop() { depth_--; }
+  void push(const BVHNode *node)
+  {
+    assert(depth_ < BVH_STACKSIZE);
+    node_[depth_++] = node;
+  }
+
+private:
+  int depth_;
+  const BVHNode *node_[BVH_STACKSIZE];
+};
+
+// node stack for packet traversal. each node remembers the first ray
+// in the packet that can still hit it
+class BVHPacketStack {
+public:
+  BVHPacketStack() : depth_(0) {}
+  ~BVHPacketStack() {}
+
+  bool empty() const { return depth_ == 0; }
+  const BVHNode *top_node() const { return node_[depth_ - 1]; }
+  int top_first() const { return first_[depth_ - 1]; }
+  void pop() { depth_--; }
+  void push(const BVHNode *node, int first)
+  {
+    assert(depth_ < BVH_STACKSIZE);
+    node_[depth_] = node;
+    first_[depth_] = first;
+    depth_++;
+  }
+
+private:
+  int depth_;
+  const BVHNode *node_[BVH_STACKSIZE];
+  int first_[BVH_STACKSIZE];
+};
+
 static bool intersect_bvh_recursive(const PrimitiveSet *primset,
     const BVHNode *node, const Ray &ray, Real time,
     Intersection *isect);
 static bool intersect_bvh_loop(const PrimitiveSet *primset,
     const BVHNode *root, const Ray &ray, Real time,
     Intersection *isect);
+static int intersect_bvh_packet(const PrimitiveSet *primset,
+    const BVHNode *root, const RayPacket &packet,
+    Intersection *isects);
+static int find_first_hit(const Box &box, const RayPacket &packet, int first);
 
 static BVHNode *new_bvhnode();
 static void free_bvhnode_recursive(BVHNode *node);
@@ -120,6 +174,14 @@ bool BVHAccelerator::intersect(const Ray &ray, Real time, Intersection *isect) c
     return intersect_bvh_recursive(primset, root, ray, time, isect);
 }
 
+int BVHAccelerator::intersect_packet(const RayPacket &packet,
+    Intersection *isects) const
+{
+  const PrimitiveSet *primset = GetPrimitiveSet();
+
+  return intersect_bvh_packet(primset, root, packet, isects);
+}
+
 const char *BVHAccelerator::get_name() const
 {
   return ACCELERATOR_NAME;
@@ -166,12 +228,15 @@ static bool intersect_bvh_recursive(const PrimitiveSet *primset,
 }
 
 static bool intersect_bvh_loop(const PrimitiveSet *primset,
-    const BVHNode *root, const Ray &ray, Real time,
+    const BVHNode *root, const Ray &original_ray, Real time,
     Intersection *isect)
 {
   bool hit = false;
   const BVHNode *node = root;
-  std::stack<BVHNode*> stack;
+  BVHNodeStack stack;
+
+  // ray.tmax is shortened to the closest hit so far
+  Ray ray = original_ray;
 
   // TODO NODE COULD BE NULL IF PRIMITIVE IS EMPTY. MIGHT BE BETTER CHANGE
   if (node == NULL)
@@ -187,6 +252,7 @@ static bool intersect_bvh_loop(const PrimitiveSet *primset,
       if (hittmp && isect_tmp->t_hit < isect_min->t_hit) {
         std::swap(isect_min, isect_tmp);
         hit = hittmp;
+        ray.tmax = isect_min->t_hit;
       }
 
       if (stack.empty())
@@ -244,6 +310,80 @@ loop_exit:
   return hit;
 }
 
+static int intersect_bvh_packet(const PrimitiveSet *primset,
+    const BVHNode *root, const RayPacket &original_packet,
+    Intersection *isects)
+{
+  BVHPacketStack stack;
+  const BVHNode *node = root;
+  int first = 0;
+  int hit_count = 0;
+
+  // TODO NODE COULD BE NULL IF PRIMITIVE IS EMPTY. MIGHT BE BETTER CHANGE
+  if (node == NULL)
+    return 0;
+
+  // tmax of each ray is shortened to its closest hit so far
+  RayPacket packet = original_packet;
+
+  for (;;) {
+    first = find_first_hit(node->bounds, packet, first);
+
+    if (first < packet.count) {
+      if (!node->is_leaf()) {
+        stack.push(node->right, first);
+        node = node->left;
+        continue;
+      }
+
+      if (primset->RayIntersectPacket(node->prim_id, packet, first, isects)) {
+        for (int i = first; i < packet.count; i++) {
+          if (isects[i].t_hit < packet.ray[i].tmax) {
+            packet.ray[i].tmax = isects[i].t_hit;
+          }
+        }
+      }
+    }
+
+    if (stack.empty())
+      break;
+    node = stack.top_node();
+    first = stack.top_first();
+    stack.pop();
+  }
+
+  for (int i = 0; i < packet.count; i++) {
+    if (packet.ray[i].tmax < original_packet.ray[i].tmax) {
+      hit_count++;
+    }
+  }
+  return hit_count;
+}
+
+// returns the index of the first ray from first that hits the box,
+// or packet count if none of them does
+static int find_first_hit(const Box &box, const RayPacket &packet, int first)
+{
+  Real boxhit_tmin, boxhit_tmax;
+
+  // the ray that hit the parent is likely to hit this box too.
+  // testing it alone before the frustum saves most of box tests
+  for (int i = first; i < packet.count; i++) {
+    const Ray &ray = packet.ray[i];
+
+    if (BoxRayIntersect(box,
+        ray.orig, ray.dir, ray.tmin, ray.tmax,
+        &boxhit_tmin, &boxhit_tmax)) {
+      return i;
+    }
+
+    if (i == first && !RayPacketMayHitBox(packet, box)) {
+      break;
+    }
+  }
+  return packet.count;
+}
+
 // Compares an axis component of primitive centroid for std::sort.
 template<int Axis>
 class CentroidLess {
@@ -19,6 +19,7 @@ public:
   virtual int build();
   virtual bool intersect(const Ray &ray, Real time, Intersection *isect) const;
   virtual const char *get_name() const;
+  virtual int intersect_packet(const RayPacket &packet, Intersection *isects) const;
 
   BVHNode *root;
 };
@@ -97,6 +97,13 @@ void Camera::GetRay(const Vector2 &screen_uv, Real time, Ray *ray) const
   ray->tmax = zfar_;
 }
 
+// width of a pixel at unit distance from the eye
+Real Camera::GetPixelFootprint(int yres) const
+{
+  assert(yres > 0);
+  return uv_size_[1] / yres;
+}
+
 void Camera::compute_uv_size()
 {
   uv_size_[1] = 2 * tan(Radian(fov_ / 2.));
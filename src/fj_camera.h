@@ -28,6 +28,7 @@ public:
   void SetRotateOrder(int order);
 
   void GetRay(const Vector2 &screen_uv, Real time, Ray *ray) const;
+  Real GetPixelFootprint(int yres) const;
 
 private:
   void compute_uv_size();
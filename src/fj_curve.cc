@@ -2,6 +2,7 @@
 // See LICENSE and README
 
 #include "fj_curve.h"
+#include "fj_multi_thread.h"
 #include "fj_intersection.h"
 #include "fj_primitive_set.h"
 #include "fj_transform.h"
@@ -71,6 +72,22 @@ public:
   Vector velocity[4];
 };
 
+// the deepest subdivision of a segment. converge_bezier3_loop() keeps
+// one pending half per level on a fixed size stack
+static const int MAX_SPLIT_DEPTH = 5;
+
+class BezierSegment {
+public:
+  BezierSegment() : bezier(), v0(0), vn(1), zmin(0), depth(0) {}
+  ~BezierSegment() {}
+
+public:
+  Bezier3 bezier;
+  Real v0, vn;
+  Real zmin;
+  int depth;
+};
+
 /* bezier curve interfaces */
 static Real get_bezier3_max_radius(const Bezier3 &bezier);
 static Real get_bezier3_width(const Bezier3 &bezier, Real t);
@@ -80,9 +97,16 @@ static Vector eval_bezier3(const ControlPoint *cp, Real t);
 static Vector derivative_bezier3(const ControlPoint *cp, Real t);
 static void split_bezier3(const Bezier3 &bezier,
     Bezier3 *left, Bezier3 *right);
-static int converge_bezier3(const Bezier3 &bezier,
+static int converge_bezier3_recursive(const Bezier3 &bezier,
+    Real v0, Real vn, int depth,
+    Real *v_hit, Real *P_hit);
+static int converge_bezier3_loop(const Bezier3 &bezier,
     Real v0, Real vn, int depth,
     Real *v_hit, Real *P_hit);
+static bool overlap_bezier3_ray(const Bezier3 &bezier, Real zmax, Real *zmin);
+static int intersect_bezier3_segment(const Bezier3 &bezier,
+    Real v0, Real vn,
+    Real *v_hit, Real *P_hit);
 static void time_sample_bezier3(Bezier3 *bezier, Real time);
 
 /* helper functions */
@@ -99,7 +123,33 @@ static inline Real dot_xy(const Vector &a, const Vector &b)
   return a.x * b.x + a.y * b.y;
 }
 
-Curve::Curve() : nverts_(0), ncurves_(0)
+class CurveBoundsLoop {
+public:
+  CurveBoundsLoop() : curve(NULL), curve_count(0) {}
+  ~CurveBoundsLoop() {}
+
+public:
+  const Curve *curve;
+  int curve_count;
+  std::vector<Box> chunk_bounds;
+  std::vector<Real> chunk_max_radius;
+};
+
+class CurveSplitDepthLoop {
+public:
+  CurveSplitDepthLoop() : curve(NULL), curve_count(0), split_depth(NULL) {}
+  ~CurveSplitDepthLoop() {}
+
+public:
+  const Curve *curve;
+  int curve_count;
+  int *split_depth;
+};
+
+static ThreadStatus compute_bounds_chunk(void *data, const ThreadContext *context);
+static ThreadStatus compute_split_depth_chunk(void *data, const ThreadContext *context);
+
+Curve::Curve() : nverts_(0), ncurves_(0), recursive_convergence_(false)
 {
 }
 
@@ -134,46 +184,50 @@ const Box &Curve::GetBounds() const
 
 void Curve::ComputeBounds()
 {
-  Real max_radius = 0;
-
-  BoxReverseInfinite(&bounds_);
+  const int NCURVES = GetCurveCount();
+  const int NCHUNKS = MtGetChunkCount(NCURVES);
 
-  for (int i = 0; i < GetCurveCount(); i++) {
-    Box bezier_bounds;
+  CurveBoundsLoop loop;
+  loop.curve = this;
+  loop.curve_count = NCURVES;
+  loop.chunk_bounds.resize(NCHUNKS);
+  loop.chunk_max_radius.resize(NCHUNKS, 0);
 
-    GetPrimitiveBounds(i, &bezier_bounds);
-    BoxAddBox(&bounds_, bezier_bounds);
+  MtRunThreadLoop(&loop, compute_bounds_chunk, MtGetMaxThreadCount(), 0, NCHUNKS);
 
-    Bezier3 bezier;
-    get_bezier3(this, i, &bezier);
+  // merge in chunk order so the result does not depend on threads
+  Real max_radius = 0;
+  BoxReverseInfinite(&bounds_);
 
-    const Real bezier_max_radius = get_bezier3_max_radius(bezier);
-    max_radius = Max(max_radius, bezier_max_radius);
+  for (int i = 0; i < NCHUNKS; i++) {
+    BoxAddBox(&bounds_, loop.chunk_bounds[i]);
+    max_radius = Max(max_radius, loop.chunk_max_radius[i]);
   }
 
   BoxExpand(&bounds_, max_radius);
-
-  /* TODO find a better place to put this */
-  cache_split_depth();
 }
 
-void Curve::cache_split_depth()
+void Curve::ComputeSplitDepth()
 {
-  assert(split_depth_.empty());
-
   const int NCURVES = GetCurveCount();
+  const int NCHUNKS = MtGetChunkCount(NCURVES);
 
   split_depth_.resize(NCURVES);
-  for (int i = 0; i < NCURVES; i++) {
-    Bezier3 bezier;
-    // TODO REMOVE 'this' POINTER
-    get_bezier3(this, i, &bezier);
+  if (NCURVES == 0) {
+    return;
+  }
 
-    int depth = compute_split_depth_limit(bezier.cp, 2*get_bezier3_max_radius(bezier) / 20.);
-    depth = Clamp(depth, 1, 5);
+  CurveSplitDepthLoop loop;
+  loop.curve = this;
+  loop.curve_count = NCURVES;
+  loop.split_depth = &split_depth_[0];
 
-    split_depth_[i] = depth;
-  }
+  MtRunThreadLoop(&loop, compute_split_depth_chunk, MtGetMaxThreadCount(), 0, NCHUNKS);
+}
+
+void Curve::SetRecursiveConvergence(bool enable)
+{
+  recursive_convergence_ = enable;
 }
 
 bool Curve::ray_intersect(Index prim_id, Real time,
@@ -197,10 +251,17 @@ bool Curve::ray_intersect(Index prim_id, Real time,
     MatTransformPoint(world_to_ray, &bezier.cp[i].P);
   }
 
-  Real ttmp = FLT_MAX;
+  // no need to look for hits farther than ray.tmax
+  Real ttmp = ray.tmax * ray_scale;
   Real v_hit = FLT_MAX;
 
-  const bool hit = converge_bezier3(bezier, 0, 1, depth, &v_hit, &ttmp);
+  bool hit = false;
+  if (!recursive_convergence_) {
+    hit = converge_bezier3_loop(bezier, 0, 1, depth, &v_hit, &ttmp);
+  } else {
+    ttmp = FLT_MAX;
+    hit = converge_bezier3_recursive(bezier, 0, 1, depth, &v_hit, &ttmp);
+  }
   if (hit) {
     // P
     isect->t_hit = ttmp / ray_scale;
@@ -279,70 +340,18 @@ static void compute_world_to_ray_matrix(const Ray &ray, Matrix *dst)
 /* Based on this algorithm:
    Koji Nakamaru and Yoshio Ono, RAY TRACING FOR CURVES PRIMITIVE, WSCG 2002.
    */
-static int converge_bezier3(const Bezier3 &bezier,
+static int converge_bezier3_recursive(const Bezier3 &bezier,
     Real v0, Real vn, int depth,
     Real *v_hit, Real *P_hit)
 {
-  const ControlPoint *cp = bezier.cp;
-  const Real radius = get_bezier3_max_radius(bezier);
-  Box bounds;
-
-  get_bezier3_bounds(bezier, &bounds);
+  Real zmin = 0;
 
-  if (bounds.min.x >= radius || bounds.max.x <= -radius ||
-    bounds.min.y >= radius || bounds.max.y <= -radius ||
-    bounds.min.z >= *P_hit || bounds.max.z <= 1e-6) {
+  if (!overlap_bezier3_ray(bezier, *P_hit, &zmin)) {
     return 0;
   }
 
   if (depth == 0) {
-    const Vector dir = cp[3].P - cp[0].P;
-    Vector dP0 = cp[1].P - cp[0].P;
-
-    if (dot_xy(dir, dP0) < 0) {
-      dP0 *= -1;
-    }
-    if (-1 * dot_xy(dP0, cp[0].P) < 0) {
-      return 0;
-    }
-
-    Vector dPn = cp[3].P - cp[2].P;
-
-    if (dot_xy(dir, dPn) < 0) {
-      dPn *= -1;
-    }
-    if (dot_xy(dPn, cp[3].P) < 0) {
-      return 0;
-    }
-
-    // compute w on the line segment
-    Real w = dir.x * dir.x + dir.y * dir.y;
-    if (Abs(w) < 1e-6) {
-      return 0;
-    }
-    w = -(cp[0].P.x * dir.x + cp[0].P.y * dir.y) / w;
-    w = Clamp(w, 0, 1);
-
-    // compute v on the curve segment
-    const Real v = v0 * (1-w) + vn * w;
-
-    const Real radius_w = .5 * get_bezier3_width(bezier, w);
-    // compare x-y distance
-    const Vector vP = eval_bezier3(cp, w);
-    if (vP.x * vP.x + vP.y * vP.y >= radius_w * radius_w) {
-      return 0;
-    }
-
-    // compare z distance
-    if (vP.z <= 1e-6 || *P_hit < vP.z) {
-      return 0;
-    }
-
-    // we found a new intersection
-    *P_hit = vP.z;
-    *v_hit = v;
-
-    return 1;
+    return intersect_bezier3_segment(bezier, v0, vn, v_hit, P_hit);
   }
 
   const Real vm = (v0 + vn) * .5;
@@ -355,8 +364,8 @@ static int converge_bezier3(const Bezier3 &bezier,
   Real v_right = FLT_MAX;
   Real t_left  = FLT_MAX;
   Real t_right = FLT_MAX;
-  const bool hit_left  = converge_bezier3(bezier_left,  v0, vm, depth-1, &v_left,  &t_left);
-  const bool hit_right = converge_bezier3(bezier_right, vm, vn, depth-1, &v_right, &t_right);
+  const bool hit_left  = converge_bezier3_recursive(bezier_left,  v0, vm, depth-1, &v_left,  &t_left);
+  const bool hit_right = converge_bezier3_recursive(bezier_right, vm, vn, depth-1, &v_right, &t_right);
 
   if (hit_left || hit_right) {
     if (t_left < t_right) {
@@ -371,6 +380,149 @@ static int converge_bezier3(const Bezier3 &bezier,
   return hit_left || hit_right;
 }
 
+/* The same subdivision as converge_bezier3_recursive() without recursion
+   nor heap allocation. Both halves of a split are tested against the ray
+   at once, the nearer one is visited first and the other one is kept on
+   the stack. *P_hit is shared by all segments so that any segment behind
+   the closest hit found so far is culled before it is split. */
+static int converge_bezier3_loop(const Bezier3 &bezier,
+    Real v0, Real vn, int depth,
+    Real *v_hit, Real *P_hit)
+{
+  BezierSegment stack[MAX_SPLIT_DEPTH + 1];
+  BezierSegment halves[2];
+  BezierSegment seg;
+  int stack_size = 0;
+  int hit = 0;
+
+  assert(depth <= MAX_SPLIT_DEPTH);
+
+  seg.bezier = bezier;
+  seg.v0 = v0;
+  seg.vn = vn;
+  seg.depth = depth;
+
+  if (!overlap_bezier3_ray(seg.bezier, *P_hit, &seg.zmin)) {
+    return 0;
+  }
+
+  for (;;) {
+    if (seg.depth == 0) {
+      hit |= intersect_bezier3_segment(seg.bezier, seg.v0, seg.vn, v_hit, P_hit);
+    } else {
+      const Real vm = (seg.v0 + seg.vn) * .5;
+
+      split_bezier3(seg.bezier, &halves[0].bezier, &halves[1].bezier);
+      halves[0].v0 = seg.v0;
+      halves[0].vn = vm;
+      halves[1].v0 = vm;
+      halves[1].vn = seg.vn;
+      halves[0].depth = seg.depth - 1;
+      halves[1].depth = seg.depth - 1;
+
+      const bool hit_left  = overlap_bezier3_ray(halves[0].bezier, *P_hit, &halves[0].zmin);
+      const bool hit_right = overlap_bezier3_ray(halves[1].bezier, *P_hit, &halves[1].zmin);
+
+      if (hit_left && hit_right) {
+        const int near = halves[1].zmin < halves[0].zmin ? 1 : 0;
+        stack[stack_size++] = halves[1 - near];
+        seg = halves[near];
+        continue;
+      }
+      else if (hit_left) {
+        seg = halves[0];
+        continue;
+      }
+      else if (hit_right) {
+        seg = halves[1];
+        continue;
+      }
+    }
+
+    // pop the next segment that can still have a closer hit
+    for (;;) {
+      if (stack_size == 0) {
+        return hit;
+      }
+      seg = stack[--stack_size];
+      if (seg.zmin < *P_hit) {
+        break;
+      }
+    }
+  }
+}
+
+static bool overlap_bezier3_ray(const Bezier3 &bezier, Real zmax, Real *zmin)
+{
+  const Real radius = get_bezier3_max_radius(bezier);
+  Box bounds;
+
+  get_bezier3_bounds(bezier, &bounds);
+  *zmin = bounds.min.z;
+
+  if (bounds.min.x >= radius || bounds.max.x <= -radius ||
+    bounds.min.y >= radius || bounds.max.y <= -radius ||
+    bounds.min.z >= zmax || bounds.max.z <= 1e-6) {
+    return false;
+  }
+
+  return true;
+}
+
+static int intersect_bezier3_segment(const Bezier3 &bezier,
+    Real v0, Real vn,
+    Real *v_hit, Real *P_hit)
+{
+  const ControlPoint *cp = bezier.cp;
+  const Vector dir = cp[3].P - cp[0].P;
+  Vector dP0 = cp[1].P - cp[0].P;
+
+  if (dot_xy(dir, dP0) < 0) {
+    dP0 *= -1;
+  }
+  if (-1 * dot_xy(dP0, cp[0].P) < 0) {
+    return 0;
+  }
+
+  Vector dPn = cp[3].P - cp[2].P;
+
+  if (dot_xy(dir, dPn) < 0) {
+    dPn *= -1;
+  }
+  if (dot_xy(dPn, cp[3].P) < 0) {
+    return 0;
+  }
+
+  // compute w on the line segment
+  Real w = dir.x * dir.x + dir.y * dir.y;
+  if (Abs(w) < 1e-6) {
+    return 0;
+  }
+  w = -(cp[0].P.x * dir.x + cp[0].P.y * dir.y) / w;
+  w = Clamp(w, 0, 1);
+
+  // compute v on the curve segment
+  const Real v = v0 * (1-w) + vn * w;
+
+  const Real radius_w = .5 * get_bezier3_width(bezier, w);
+  // compare x-y distance
+  const Vector vP = eval_bezier3(cp, w);
+  if (vP.x * vP.x + vP.y * vP.y >= radius_w * radius_w) {
+    return 0;
+  }
+
+  // compare z distance
+  if (vP.z <= 1e-6 || *P_hit < vP.z) {
+    return 0;
+  }
+
+  // we found a new intersection
+  *P_hit = vP.z;
+  *v_hit = v;
+
+  return 1;
+}
+
 static void time_sample_bezier3(Bezier3 *bezier, Real time)
 {
   for (int i = 0; i < 4; i++) {
@@ -424,6 +576,57 @@ static void split_bezier3(const Bezier3 &bezier,
   right->width[1] = bezier.width[1];
 }
 
+static ThreadStatus compute_bounds_chunk(void *data, const ThreadContext *context)
+{
+  CurveBoundsLoop *loop = static_cast<CurveBoundsLoop *>(data);
+  const int chunk_id = context->iteration_id;
+  int begin = 0;
+  int end = 0;
+
+  Box chunk_bounds;
+  Real chunk_max_radius = 0;
+  BoxReverseInfinite(&chunk_bounds);
+
+  MtGetChunkRange(chunk_id, loop->curve_count, &begin, &end);
+  for (int i = begin; i < end; i++) {
+    Box bezier_bounds;
+
+    loop->curve->GetPrimitiveBounds(i, &bezier_bounds);
+    BoxAddBox(&chunk_bounds, bezier_bounds);
+
+    Bezier3 bezier;
+    get_bezier3(loop->curve, i, &bezier);
+
+    const Real bezier_max_radius = get_bezier3_max_radius(bezier);
+    chunk_max_radius = Max(chunk_max_radius, bezier_max_radius);
+  }
+
+  loop->chunk_bounds[chunk_id] = chunk_bounds;
+  loop->chunk_max_radius[chunk_id] = chunk_max_radius;
+
+  return THREAD_LOOP_CONTINUE;
+}
+
+static ThreadStatus compute_split_depth_chunk(void *data, const ThreadContext *context)
+{
+  CurveSplitDepthLoop *loop = static_cast<CurveSplitDepthLoop *>(data);
+  int begin = 0;
+  int end = 0;
+
+  MtGetChunkRange(context->iteration_id, loop->curve_count, &begin, &end);
+  for (int i = begin; i < end; i++) {
+    Bezier3 bezier;
+    get_bezier3(loop->curve, i, &bezier);
+
+    int depth = compute_split_depth_limit(bezier.cp, 2*get_bezier3_max_radius(bezier) / 20.);
+    depth = Clamp(depth, 1, MAX_SPLIT_DEPTH);
+
+    loop->split_depth[i] = depth;
+  }
+
+  return THREAD_LOOP_CONTINUE;
+}
+
 static int compute_split_depth_limit(const ControlPoint *cp, Real epsilon)
 {
   const int N = 4;
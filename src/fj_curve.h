@@ -55,6 +55,11 @@ public:
   bool HasCurveIndices() const;
 
   void ComputeBounds();
+  void ComputeSplitDepth();
+
+  // subdivides segments by recursion instead of the loop. the results
+  // are the same. for checking the loop against the original kernel
+  void SetRecursiveConvergence(bool enable);
 
 private:
   virtual bool ray_intersect(Index prim_id, Real time,
@@ -76,8 +81,7 @@ private:
   Box bounds_;
 
   std::vector<int> split_depth_;
-
-  void cache_split_depth();
+  bool recursive_convergence_;
 };
 
 } // namespace xxx
@@ -3,9 +3,11 @@
 
 #include "fj_curve_io.h"
 #include "fj_curve.h"
+#include "fj_timer.h"
 
 #include <cstring>
 #include <cstdlib>
+#include <cstdio>
 
 #define CRV_FILE_VERSION 1
 #define CRV_FILE_MAGIC "CURV"
@@ -315,9 +317,21 @@ int CrvLoadFile(Curve *curve, const char *filename)
     }
   }
 
-  curve->ComputeBounds();
   CrvCloseInputFile(in);
 
+  printf("# Preprocessing Curve\n");
+  printf("#   Curve Count: %d\n", curve->GetCurveCount());
+  Timer timer;
+
+  timer.Start();
+  curve->ComputeBounds();
+  printf("#   Bounds:      %.3fs\n", timer.GetElapsedSeconds());
+
+  timer.Start();
+  curve->ComputeSplitDepth();
+  printf("#   Split Depth: %.3fs\n", timer.GetElapsedSeconds());
+  printf("\n");
+
   return 0;
 }
 
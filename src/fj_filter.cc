@@ -2,19 +2,36 @@
 // See LICENSE and README
 
 #include "fj_filter.h"
+#include "fj_numeric.h"
 #include <cassert>
 #include <cmath>
 
 namespace fj {
 
-static Real eval_gaussian(Real xwidth, Real ywidth, Real x, Real y);
-static Real eval_box(Real xwidth, Real ywidth, Real x, Real y);
+// entries over the radius of the filter
+static const int TABLE_SIZE = 256;
+
+static Real eval_gaussian(Real width, Real x);
+static Real eval_box(Real width, Real x);
+static Real eval_mitchell(Real width, Real x);
+static Real eval_blackman_harris(Real width, Real x);
+
+static Real table_range(Real width);
+static void build_table(Real (*evaluate)(Real width, Real x), Real width,
+    std::vector<float> *table, Real *scale);
+static Real lookup_table(const std::vector<float> &table, Real scale, Real x);
 
 Filter::Filter() :
     xwidth_(1),
     ywidth_(1),
-    evaluate_(eval_box)
+    evaluate_(eval_box),
+    xtable_(),
+    ytable_(),
+    xscale_(0),
+    yscale_(0)
 {
+  build_table(evaluate_, xwidth_, &xtable_, &xscale_);
+  build_table(evaluate_, ywidth_, &ytable_, &yscale_);
 }
 
 Filter::~Filter()
@@ -33,33 +50,118 @@ void Filter::SetFilterType(int filtertype, Real xwidth, Real ywidth)
   case FLT_BOX:
     evaluate_ = eval_box;
     break;
+  case FLT_MITCHELL:
+    evaluate_ = eval_mitchell;
+    break;
+  case FLT_BLACKMAN_HARRIS:
+    evaluate_ = eval_blackman_harris;
+    break;
   default:
     assert(!"invalid filter type");
     break;
   }
   xwidth_ = xwidth;
   ywidth_ = ywidth;
+
+  build_table(evaluate_, xwidth_, &xtable_, &xscale_);
+  build_table(evaluate_, ywidth_, &ytable_, &yscale_);
 }
 
 Real Filter::Evaluate(Real x, Real y) const
 {
-  return evaluate_(xwidth_, ywidth_, x, y);
+  return EvaluateX(x) * EvaluateY(y);
+}
+
+Real Filter::EvaluateX(Real x) const
+{
+  return lookup_table(xtable_, xscale_, x);
+}
+
+Real Filter::EvaluateY(Real y) const
+{
+  return lookup_table(ytable_, yscale_, y);
+}
+
+// samples in the filter margins of pixels reach up to a pixel farther
+// than the radius. gaussian and box are not zero there
+static Real table_range(Real width)
+{
+  return .5 * width + 1;
 }
 
-static Real eval_gaussian(Real xwidth, Real ywidth, Real x, Real y)
+static void build_table(Real (*evaluate)(Real width, Real x), Real width,
+    std::vector<float> *table, Real *scale)
+{
+  const Real range = table_range(width);
+
+  table->resize(TABLE_SIZE + 1);
+  for (int i = 0; i <= TABLE_SIZE; i++) {
+    (*table)[i] = evaluate(width, range * i / TABLE_SIZE);
+  }
+  *scale = TABLE_SIZE / range;
+}
+
+static Real lookup_table(const std::vector<float> &table, Real scale, Real x)
+{
+  const Real pos = Abs(x) * scale;
+  const int i = (int) pos;
+
+  if (i >= TABLE_SIZE) {
+    return 0;
+  }
+  return Lerp(table[i], table[i + 1], pos - i);
+}
+
+static Real eval_gaussian(Real width, Real x)
 {
   // The RenderMan Interface
   // Version 3.2.1
   // November, 2005
-  const Real xx = 2 * x / xwidth;
-  const Real yy = 2 * y / ywidth;
+  const Real xx = 2 * x / width;
 
-  return exp(-2 * ( xx * xx + yy * yy ));
+  return exp(-2 * xx * xx);
 }
 
-static Real eval_box(Real xwidth, Real ywidth, Real x, Real y)
+static Real eval_box(Real width, Real x)
 {
   return 1;
 }
 
+static Real eval_mitchell(Real width, Real x)
+{
+  // Reconstruction Filters in Computer Graphics
+  // Don P. Mitchell, Arun N. Netravali
+  // SIGGRAPH 1988
+  const Real B = 1./3;
+  const Real C = 1./3;
+  const Real xx = Abs(4 * x / width);
+
+  if (xx > 2) {
+    return 0;
+  }
+  if (xx > 1) {
+    return ((-B - 6*C) * xx*xx*xx + (6*B + 30*C) * xx*xx +
+        (-12*B - 48*C) * xx + (8*B + 24*C)) / 6;
+  }
+  return ((12 - 9*B - 6*C) * xx*xx*xx + (-18 + 12*B + 6*C) * xx*xx +
+      (6 - 2*B)) / 6;
+}
+
+static Real eval_blackman_harris(Real width, Real x)
+{
+  // On the Use of Windows for Harmonic Analysis
+  // with the Discrete Fourier Transform
+  // Fredric J. Harris, 1978
+  const Real A0 = 0.35875;
+  const Real A1 = 0.48829;
+  const Real A2 = 0.14128;
+  const Real A3 = 0.01168;
+  const Real t = x / width + .5;
+
+  if (t < 0 || t > 1) {
+    return 0;
+  }
+  return A0 - A1 * cos(2 * PI * t) + A2 * cos(4 * PI * t) - A3 * cos(6 * PI * t);
+}
+
 } // namespace xxx
@@ -5,14 +5,19 @@
 #define FJ_FILTER_H
 
 #include "fj_types.h"
+#include <vector>
 
 namespace fj {
 
 enum {
   FLT_BOX = 0,
-  FLT_GAUSSIAN
+  FLT_GAUSSIAN,
+  FLT_MITCHELL,
+  FLT_BLACKMAN_HARRIS
 };
 
+// all filters are separable. SetFilterType evaluates them into 1D tables
+// so that Evaluate is two table lookups
 class Filter {
 public:
   Filter();
@@ -20,10 +25,14 @@ public:
 
   void SetFilterType(int filtertype, Real xwidth, Real ywidth);
   Real Evaluate(Real x, Real y) const;
+  Real EvaluateX(Real x) const;
+  Real EvaluateY(Real y) const;
 
 private:
   Real xwidth_, ywidth_;
-  Real (*evaluate_)(Real xwidth, Real ywidth, Real x, Real y);
+  Real (*evaluate_)(Real width, Real x);
+  std::vector<float> xtable_, ytable_;
+  Real xscale_, yscale_;
 };
 
 } // namespace xxx
@@ -241,9 +241,12 @@ bool GridAccelerator::intersect(const Ray &ray, Real time, Intersection *isect)
 
     const int id = NCELLS[0] * NCELLS[1] * cell_id[2] + NCELLS[0] * cell_id[1] + cell_id[0];
 
+    // shortened as closer hits are found so primitives can cull early
+    Ray cell_ray = ray;
+
     // loop over face list that associated in current cell
     for (Cell *cell = cells_[id]; cell != NULL; cell = cell->next) {
-      const bool hittmp = prim_ray_intersect(primset, cell->prim_id, time, ray, isect_tmp);
+      const bool hittmp = prim_ray_intersect(primset, cell->prim_id, time, cell_ray, isect_tmp);
       if (!hittmp)
         continue;
 
@@ -265,6 +268,7 @@ bool GridAccelerator::intersect(const Ray &ray, Real time, Intersection *isect)
       if (isect_tmp->t_hit < isect_min->t_hit) {
         std::swap(isect_min, isect_tmp);
         hit = hittmp;
+        cell_ray.tmax = isect_min->t_hit;
       }
     }
     if (hit) {
@@ -2,15 +2,21 @@
 // See LICENSE and README
 
 #include "fj_importance_sampling.h"
+#include "fj_multi_thread.h"
 #include "fj_numeric.h"
 #include "fj_texture.h"
 #include "fj_random.h"
 #include "fj_vector.h"
+#include "fj_io.h"
 
+#include <algorithm>
 #include <vector>
 #include <cstdlib>
 #include <cfloat>
 
+#define DOME_CACHE_FILE_VERSION 1
+#define DOME_CACHE_FILE_MAGIC "DOME"
+
 namespace fj {
 
 class SamplePoint {
@@ -22,10 +28,12 @@ public:
   int x, y;
   int label;
 };
-static int compare_sample_point(const void *ptr0, const void *ptr1);
 
+static void compute_luminance(Texture *texture,
+    int sample_xres, int sample_yres, int thread_count,
+    double *illum_values, Color *colors);
 static void make_histgram(Texture *texture,
-    int sample_xres, int sample_yres, double *histgram);
+    int sample_xres, int sample_yres, int thread_count, double *histgram);
 static int lookup_histgram(const double *histgram, int pixel_count, double key_value);
 static void index_to_uv(int xres, int yres, int index, TexCoord *uv);
 static void uv_to_dir(float u, float v, Vector *dir);
@@ -33,15 +41,15 @@ static void xy_to_uv(int xres, int yres, int x, int y, TexCoord *uv);
 
 // functions for structured importance sampling
 static void setup_structured_importance_sampling(Texture *texture,
-    int sample_xres, int sample_yres,
+    int sample_xres, int sample_yres, int thread_count,
     double *illum_values, double *whole_illum, double *mean_illum);
 static double standard_deviation(const double *illum_values, int nvalues, double mean_value);
 static void divide_into_layers(const double *illum_values, int nvalues,
     const double *thresholds, int nthreshholds,
-    char *strata_id);
+    char *strata_id, int thread_count);
 static void solve_connected_components(
     int sample_xres, int sample_yres, const char *strata_id,
-    int *connected_label);
+    int *connected_label, int thread_count);
 static void remap_connected_label(int npixels,
     int *connected_label, int *sorted_max_label);
 static void compute_connected_sample_count(const double *illum_values, int nvalues,
@@ -51,11 +59,11 @@ static void compute_connected_sample_count(const double *illum_values, int nvalu
 static void generate_dome_samples(int sample_xres, int sample_yres,
     const int *connected_sample_count,
     const int *connected_label, int label_count,
-    DomeSample *dome_samples, int sample_count);
+    DomeSample *dome_samples, int sample_count, int thread_count);
 
 int ImportanceSampling(Texture *texture, int seed,
     int sample_xres, int sample_yres,
-    DomeSample *dome_samples, int sample_count)
+    DomeSample *dome_samples, int sample_count, int thread_count)
 {
   const int NPIXELS = sample_xres * sample_yres;
   std::vector<double> histgram(NPIXELS);
@@ -69,7 +77,7 @@ int ImportanceSampling(Texture *texture, int seed,
     picked[i] = 0;
   }
 
-  make_histgram(texture, sample_xres, sample_yres, &histgram[0]);
+  make_histgram(texture, sample_xres, sample_yres, thread_count, &histgram[0]);
   sum = histgram[NPIXELS-1];
 
   XorInit(&xr);
@@ -102,7 +110,7 @@ int ImportanceSampling(Texture *texture, int seed,
 
 int StratifiedImportanceSampling(Texture *texture, int seed,
     int sample_xres, int sample_yres,
-    DomeSample *dome_samples, int sample_count)
+    DomeSample *dome_samples, int sample_count, int thread_count)
 {
   const int NPIXELS = sample_xres * sample_yres;
   std::vector<double> histgram(NPIXELS);
@@ -116,7 +124,7 @@ int StratifiedImportanceSampling(Texture *texture, int seed,
     picked[i] = 0;
   }
 
-  make_histgram(texture, sample_xres, sample_yres, &histgram[0]);
+  make_histgram(texture, sample_xres, sample_yres, thread_count, &histgram[0]);
   sum = histgram[NPIXELS-1];
 
   XorInit(&xr);
@@ -153,7 +161,7 @@ int StratifiedImportanceSampling(Texture *texture, int seed,
 
 int StructuredImportanceSampling(Texture *texture, int seed,
     int sample_xres, int sample_yres,
-    DomeSample *dome_samples, int sample_count)
+    DomeSample *dome_samples, int sample_count, int thread_count)
 {
   const int NPIXELS = sample_xres * sample_yres;
   const double delta_omega0 = .01;
@@ -170,7 +178,7 @@ int StructuredImportanceSampling(Texture *texture, int seed,
   // prepare
   std::vector<double> L(NPIXELS);
   setup_structured_importance_sampling(texture,
-      sample_xres, sample_yres,
+      sample_xres, sample_yres, thread_count,
       &L[0], &L_whole, &L_mean);
   L_sigma = standard_deviation(&L[0], NPIXELS, L_mean);
 
@@ -186,16 +194,13 @@ int StructuredImportanceSampling(Texture *texture, int seed,
   std::vector<char> strata_id(NPIXELS);
   divide_into_layers(&L[0], NPIXELS,
       thresholds, depth,
-      &strata_id[0]);
+      &strata_id[0], thread_count);
 
   // connections
   std::vector<int> connected_label(NPIXELS);
-  solve_connected_components(
+  sorted_label_count = LabelConnectedStrata(
       sample_xres, sample_yres, &strata_id[0],
-      &connected_label[0]);
-
-  // re-map labels like 0, 1, ...
-  remap_connected_label(NPIXELS, &connected_label[0], &sorted_label_count);
+      &connected_label[0], thread_count);
 
   // sample count for each connection
   std::vector<int> connected_sample_count(sorted_label_count);
@@ -207,7 +212,7 @@ int StructuredImportanceSampling(Texture *texture, int seed,
   generate_dome_samples(sample_xres, sample_yres,
       &connected_sample_count[0],
       &connected_label[0], sorted_label_count,
-      dome_samples, sample_count);
+      dome_samples, sample_count, thread_count);
 
   for (int i = 0; i < sample_count; i++) {
     DomeSample *sample = &dome_samples[i];
@@ -221,35 +226,314 @@ int StructuredImportanceSampling(Texture *texture, int seed,
   return 0;
 }
 
-static void make_histgram(Texture *texture,
-    int sample_xres, int sample_yres, double *histgram)
+EnvironmentAliasTable::EnvironmentAliasTable() :
+    xres_(0),
+    yres_(0),
+    prob_(),
+    alias_(),
+    pixel_pdf_(),
+    colors_()
+{
+}
+
+EnvironmentAliasTable::~EnvironmentAliasTable()
+{
+}
+
+// Vose's alias method
+void EnvironmentAliasTable::Build(Texture *texture,
+    int sample_xres, int sample_yres, int thread_count)
 {
   const int NPIXELS = sample_xres * sample_yres;
+  std::vector<double> weight(NPIXELS);
   double sum = 0;
-  int i;
 
-  for (i = 0; i < NPIXELS; i++) {
-    Color4 tex_rgba;
+  Clear();
+  if (NPIXELS <= 0) {
+    return;
+  }
+
+  colors_.resize(NPIXELS);
+  compute_luminance(texture, sample_xres, sample_yres, thread_count,
+      &weight[0], &colors_[0]);
+
+  for (int i = 0; i < NPIXELS; i++) {
+    sum += weight[i];
+  }
+  if (sum <= 0) {
+    Clear();
+    return;
+  }
+
+  // keeps dark pixels pickable so no part of the map is left out
+  const double floor_weight = .01 * sum / NPIXELS;
+  sum = 0;
+  for (int i = 0; i < NPIXELS; i++) {
+    const int y = i / sample_xres;
+    const double theta = PI * (.5 + y) / sample_yres;
+    weight[i] = (weight[i] + floor_weight) * sin(theta);
+    sum += weight[i];
+  }
+
+  xres_ = sample_xres;
+  yres_ = sample_yres;
+  prob_.resize(NPIXELS);
+  alias_.resize(NPIXELS);
+  pixel_pdf_.resize(NPIXELS);
+
+  std::vector<int> small;
+  std::vector<int> large;
+  std::vector<double> scaled(NPIXELS);
+
+  for (int i = 0; i < NPIXELS; i++) {
+    pixel_pdf_[i] = weight[i] / sum;
+    scaled[i] = weight[i] / sum * NPIXELS;
+    alias_[i] = i;
+    if (scaled[i] < 1) {
+      small.push_back(i);
+    } else {
+      large.push_back(i);
+    }
+  }
+
+  while (!small.empty() && !large.empty()) {
+    const int s = small.back();
+    const int l = large.back();
+    small.pop_back();
+
+    prob_[s] = scaled[s];
+    alias_[s] = l;
+    scaled[l] = (scaled[l] + scaled[s]) - 1;
+
+    if (scaled[l] < 1) {
+      large.pop_back();
+      small.push_back(l);
+    }
+  }
+  // the rest are 1 up to round off
+  for (size_t i = 0; i < small.size(); i++) {
+    prob_[small[i]] = 1;
+  }
+  for (size_t i = 0; i < large.size(); i++) {
+    prob_[large[i]] = 1;
+  }
+}
+
+void EnvironmentAliasTable::Clear()
+{
+  xres_ = 0;
+  yres_ = 0;
+  prob_.clear();
+  alias_.clear();
+  pixel_pdf_.clear();
+  colors_.clear();
+}
+
+bool EnvironmentAliasTable::IsEmpty() const
+{
+  return prob_.empty();
+}
+
+Real EnvironmentAliasTable::Sample(Real u0, Real u1, Real u2, DomeSample *sample) const
+{
+  const int NPIXELS = prob_.size();
+  const Real column = u0 * NPIXELS;
+  int index = Min(column, NPIXELS - 1);
+
+  if (column - index >= prob_[index]) {
+    index = alias_[index];
+  }
+
+  const int x = index % xres_;
+  const int y = index / xres_;
+  sample->uv.u = (x + u1) / xres_;
+  sample->uv.v = 1. - ((y + u2) / yres_);
+  uv_to_dir(sample->uv.u, sample->uv.v, &sample->dir);
+  sample->color = colors_[index];
+
+  // d(omega) = 2 PI^2 sin(theta) du dv
+  const Real theta = PI * (y + u2) / yres_;
+  const Real sin_theta = Max(sin(theta), 1e-6);
+
+  return pixel_pdf_[index] * NPIXELS / (2 * PI * PI * sin_theta);
+}
+
+int LabelConnectedStrata(int sample_xres, int sample_yres,
+    const char *strata_id, int *connected_label, int thread_count)
+{
+  int label_count = 0;
+
+  solve_connected_components(
+      sample_xres, sample_yres, strata_id,
+      connected_label, thread_count);
+
+  // re-map labels like 0, 1, ...
+  remap_connected_label(sample_xres * sample_yres, connected_label, &label_count);
+
+  return label_count;
+}
+
+int ReadDomeSampleCache(const char *filename, const DomeSampleCacheKey &key,
+    DomeSample *dome_samples, int sample_count)
+{
+  InputFile *in = IOOpenInputFile(filename, DOME_CACHE_FILE_MAGIC);
+  if (in == NULL) {
+    return -1;
+  }
+  if (IOGetInputFileFormatVersion(in) != DOME_CACHE_FILE_VERSION) {
+    IOCloseInputFile(in);
+    return -1;
+  }
+
+  int header[4] = {-1, -1, -1, -1};
+  double texture_stat[2] = {-1, -1};
+  IOSetInputInt(in, "key", header, 4);
+  IOSetInputDouble(in, "texture_stat", texture_stat, 2);
+  IOEndInputHeader(in);
+
+  if (IOReadInputHeader(in) ||
+      header[0] != key.method ||
+      header[1] != key.sample_count ||
+      header[2] != key.sample_xres ||
+      header[3] != key.sample_yres ||
+      texture_stat[0] != key.texture_size ||
+      texture_stat[1] != key.texture_time ||
+      sample_count != key.sample_count) {
+    IOCloseInputFile(in);
+    return -1;
+  }
+
+  std::vector<Vector> color(sample_count);
+  std::vector<Vector> uv(sample_count);
+  std::vector<Vector> dir(sample_count);
+  IOSetInputVector3(in, "color", &color[0], sample_count);
+  IOSetInputVector3(in, "uv", &uv[0], sample_count);
+  IOSetInputVector3(in, "dir", &dir[0], sample_count);
+  const int err = IOReadInputData(in);
+  IOCloseInputFile(in);
+  if (err) {
+    return -1;
+  }
+
+  for (int i = 0; i < sample_count; i++) {
+    DomeSample *sample = &dome_samples[i];
+    sample->color = Color(color[i].x, color[i].y, color[i].z);
+    sample->uv = TexCoord(uv[i].x, uv[i].y);
+    sample->dir = dir[i];
+  }
+
+  return 0;
+}
+
+int WriteDomeSampleCache(const char *filename, const DomeSampleCacheKey &key,
+    const DomeSample *dome_samples, int sample_count)
+{
+  OutputFile *out = IOOpenOutputFile(filename,
+      DOME_CACHE_FILE_MAGIC, DOME_CACHE_FILE_VERSION);
+  if (out == NULL) {
+    return -1;
+  }
+
+  const int header[4] = {key.method, key.sample_count, key.sample_xres, key.sample_yres};
+  const double texture_stat[2] = {key.texture_size, key.texture_time};
+
+  std::vector<Vector> color(sample_count);
+  std::vector<Vector> uv(sample_count);
+  std::vector<Vector> dir(sample_count);
+  for (int i = 0; i < sample_count; i++) {
+    const DomeSample &sample = dome_samples[i];
+    color[i] = Vector(sample.color.r, sample.color.g, sample.color.b);
+    uv[i] = Vector(sample.uv.u, sample.uv.v, 0);
+    dir[i] = sample.dir;
+  }
+
+  IOSetOutputInt(out, "key", header, 4);
+  IOSetOutputDouble(out, "texture_stat", texture_stat, 2);
+  IOEndOutputHeader(out);
+  IOSetOutputVector3(out, "color", &color[0], sample_count);
+  IOSetOutputVector3(out, "uv", &uv[0], sample_count);
+  IOSetOutputVector3(out, "dir", &dir[0], sample_count);
+
+  int err = IOWriteOutputHeader(out);
+  if (!err) {
+    err = IOWriteOutputData(out);
+  }
+  IOCloseOutputFile(out);
+
+  return err ? -1 : 0;
+}
+
+class LuminanceJob {
+public:
+  LuminanceJob() : texture(NULL), xres(0), yres(0), L(NULL), colors(NULL) {}
+  ~LuminanceJob() {}
+
+public:
+  Texture *texture;
+  int xres, yres;
+  double *L;
+  Color *colors;
+};
+
+static ThreadStatus compute_luminance_row(void *data, const ThreadContext *cxt)
+{
+  LuminanceJob *job = (LuminanceJob *) data;
+  const int y = cxt->iteration_id;
+
+  for (int x = 0; x < job->xres; x++) {
+    const int i = y * job->xres + x;
     TexCoord uv;
 
-    index_to_uv(sample_xres, sample_yres, i, &uv);
-    tex_rgba = texture->Lookup(uv.u, uv.v);
+    index_to_uv(job->xres, job->yres, i, &uv);
+    const Color4 tex_rgba = job->texture->Lookup(uv.u, uv.v);
+    job->L[i] = Luminance4(tex_rgba);
+    if (job->colors != NULL) {
+      job->colors[i] = Color(tex_rgba.r, tex_rgba.g, tex_rgba.b);
+    }
+  }
+
+  return THREAD_LOOP_CONTINUE;
+}
+
+// texture lookups are by far the heaviest part. each thread looks up
+// rows through its own texture cache
+static void compute_luminance(Texture *texture,
+    int sample_xres, int sample_yres, int thread_count,
+    double *illum_values, Color *colors)
+{
+  LuminanceJob job;
+  job.texture = texture;
+  job.xres = sample_xres;
+  job.yres = sample_yres;
+  job.L = illum_values;
+  job.colors = colors;
+
+  MtRunThreadLoop(&job, compute_luminance_row, thread_count, 0, sample_yres);
+}
+
+static void make_histgram(Texture *texture,
+    int sample_xres, int sample_yres, int thread_count, double *histgram)
+{
+  const int NPIXELS = sample_xres * sample_yres;
+  double sum = 0;
+  int i;
+
+  compute_luminance(texture, sample_xres, sample_yres, thread_count, histgram, NULL);
 
-    sum += Luminance4(tex_rgba);
+  for (i = 0; i < NPIXELS; i++) {
+    sum += histgram[i];
     histgram[i] = sum;
   }
 }
 
 static int lookup_histgram(const double *histgram, int pixel_count, double key_value)
 {
-  int i;
+  const double *found = std::upper_bound(histgram, histgram + pixel_count, key_value);
 
-  for (i = 0; i < pixel_count; i++) {
-    if (key_value < histgram[i]) {
-      return i;
-    }
+  if (found == histgram + pixel_count) {
+    return -1;
   }
-  return -1;
+  return found - histgram;
 }
 
 static void index_to_uv(int xres, int yres, int index, TexCoord *uv)
@@ -279,7 +563,7 @@ static void uv_to_dir(float u, float v, Vector *dir)
 }
 
 static void setup_structured_importance_sampling(Texture *texture,
-    int sample_xres, int sample_yres,
+    int sample_xres, int sample_yres, int thread_count,
     double *illum_values, double *whole_illum, double *mean_illum)
 {
   const int NPIXELS = sample_xres * sample_yres;
@@ -288,14 +572,9 @@ static void setup_structured_importance_sampling(Texture *texture,
   double L_mean = 0;
   int i;
 
-  for (i = 0; i < NPIXELS; i++) {
-    Color4 tex_rgba;
-    TexCoord uv;
+  compute_luminance(texture, sample_xres, sample_yres, thread_count, L, NULL);
 
-    index_to_uv(sample_xres, sample_yres, i, &uv);
-    tex_rgba = texture->Lookup(uv.u, uv.v);
-
-    L[i] = Luminance4(tex_rgba);
+  for (i = 0; i < NPIXELS; i++) {
     L_whole += L[i];
   }
   L_mean = L_whole / NPIXELS;
@@ -318,69 +597,180 @@ static double standard_deviation(const double *illum_values, int nvalues, double
   return sqrt(sum);
 }
 
-static void divide_into_layers(const double *illum_values, int nvalues,
-    const double *thresholds, int nthreshholds,
-    char *strata_id)
+// pixels are split into this many ranges per thread for layering and
+// connected components
+static const int RANGES_PER_THREAD = 4;
+
+class PixelRanges {
+public:
+  PixelRanges(int count, int range_count) :
+      count_(count), range_count_(std::max(1, std::min(count, range_count))) {}
+  ~PixelRanges() {}
+
+  int GetRangeCount() const { return range_count_; }
+  int GetBegin(int range) const { return (int) ((double) count_ * range / range_count_); }
+  int GetEnd(int range) const { return GetBegin(range + 1); }
+
+private:
+  int count_;
+  int range_count_;
+};
+
+class LayerJob {
+public:
+  LayerJob(int nvalues, int range_count) :
+      L(NULL), thresholds(NULL), nthreshholds(0), strata_id(NULL),
+      ranges(nvalues, range_count) {}
+  ~LayerJob() {}
+
+public:
+  const double *L;
+  const double *thresholds;
+  int nthreshholds;
+  char *strata_id;
+  PixelRanges ranges;
+};
+
+static ThreadStatus divide_range_into_layers(void *data, const ThreadContext *cxt)
 {
-  int i;
+  LayerJob *job = (LayerJob *) data;
+  const int begin = job->ranges.GetBegin(cxt->iteration_id);
+  const int end = job->ranges.GetEnd(cxt->iteration_id);
 
-  for (i = 0; i < nvalues; i++) {
-    const double L = illum_values[i];
+  for (int i = begin; i < end; i++) {
+    const double L = job->L[i];
     int layer;
 
-    for (layer = nthreshholds - 1; layer >= 0; layer--) {
-      if (L > thresholds[layer]) {
-        strata_id[i] = layer;
+    for (layer = job->nthreshholds - 1; layer >= 0; layer--) {
+      if (L > job->thresholds[layer]) {
+        job->strata_id[i] = layer;
         break;
       }
     }
   }
+
+  return THREAD_LOOP_CONTINUE;
 }
 
-// Based on Fast Connect Components on Images
-static void solve_connected_components(
-    int sample_xres, int sample_yres, const char *strata_id,
-    int *connected_label)
+static void divide_into_layers(const double *illum_values, int nvalues,
+    const double *thresholds, int nthreshholds,
+    char *strata_id, int thread_count)
 {
-  int next_label = 0;
-  int x, y;
+  LayerJob job(nvalues, thread_count * RANGES_PER_THREAD);
+  job.L = illum_values;
+  job.thresholds = thresholds;
+  job.nthreshholds = nthreshholds;
+  job.strata_id = strata_id;
+
+  MtRunThreadLoop(&job, divide_range_into_layers, thread_count,
+      0, job.ranges.GetRangeCount());
+}
 
-  for (y = 0; y < sample_yres; y++) {
-    for (x = 0; x < sample_xres; x++) {
-      const int top = (y-1) * sample_xres + x;
+// every parent is smaller than its child so the root is the first
+// pixel of the component in scan order
+static int find_root(int *parent, int i)
+{
+  while (parent[i] != i) {
+    parent[i] = parent[parent[i]];
+    i = parent[i];
+  }
+  return i;
+}
+
+static void unite(int *parent, int a, int b)
+{
+  a = find_root(parent, a);
+  b = find_root(parent, b);
+
+  if (a < b) {
+    parent[b] = a;
+  } else if (b < a) {
+    parent[a] = b;
+  }
+}
+
+static void connect_neighbors(int sample_xres, int ybegin, int yend,
+    const char *strata_id, int *parent)
+{
+  for (int y = ybegin; y < yend; y++) {
+    for (int x = 0; x < sample_xres; x++) {
       const int curr = y * sample_xres + x;
+      const int top = curr - sample_xres;
       const int left = curr - 1;
 
-      const int top_id  = y == 0 ? -1 : strata_id[top];
-      const int left_id = x == 0 ? -1 : strata_id[left];
-      const int curr_id = strata_id[curr];
-
-      if (curr_id == left_id && curr_id == top_id) {
-        if (connected_label[left] != connected_label[top]) {
-          // merge
-          const int left_label = connected_label[left];
-          const int top_label = connected_label[top];
-          int k;
-          for (k = 0; k < curr; k++) {
-            if (connected_label[k] == left_label) {
-              connected_label[k] = top_label;
-            }
-          }
-        }
-        connected_label[curr] = connected_label[top];
+      if (x > 0 && strata_id[curr] == strata_id[left]) {
+        unite(parent, curr, left);
       }
-      else if (curr_id == top_id) {
-        connected_label[curr] = connected_label[top];
+      if (y > ybegin && strata_id[curr] == strata_id[top]) {
+        unite(parent, curr, top);
       }
-      else if (curr_id == left_id) {
-        connected_label[curr] = connected_label[left];
-      }
-      else {
-        connected_label[curr] = next_label;
-        next_label++;
+    }
+  }
+}
+
+class ConnectionJob {
+public:
+  ConnectionJob(int sample_yres, int range_count) :
+      sample_xres(0), strata_id(NULL), parent(NULL),
+      rows(sample_yres, range_count) {}
+  ~ConnectionJob() {}
+
+public:
+  int sample_xres;
+  const char *strata_id;
+  int *parent;
+  PixelRanges rows;
+};
+
+// unions in a band of rows only touch the pixels in the band
+static ThreadStatus connect_rows(void *data, const ThreadContext *cxt)
+{
+  ConnectionJob *job = (ConnectionJob *) data;
+
+  connect_neighbors(job->sample_xres,
+      job->rows.GetBegin(cxt->iteration_id),
+      job->rows.GetEnd(cxt->iteration_id),
+      job->strata_id, job->parent);
+
+  return THREAD_LOOP_CONTINUE;
+}
+
+// labels bands of rows in parallel with union-find, then stitches
+// the bands together. labels are the first pixel of each component
+static void solve_connected_components(
+    int sample_xres, int sample_yres, const char *strata_id,
+    int *connected_label, int thread_count)
+{
+  const int NPIXELS = sample_xres * sample_yres;
+  int *parent = connected_label;
+
+  for (int i = 0; i < NPIXELS; i++) {
+    parent[i] = i;
+  }
+
+  ConnectionJob job(sample_yres, thread_count * RANGES_PER_THREAD);
+  job.sample_xres = sample_xres;
+  job.strata_id = strata_id;
+  job.parent = parent;
+
+  MtRunThreadLoop(&job, connect_rows, thread_count,
+      0, job.rows.GetRangeCount());
+
+  for (int i = 1; i < job.rows.GetRangeCount(); i++) {
+    const int y = job.rows.GetBegin(i);
+    for (int x = 0; x < sample_xres; x++) {
+      const int curr = y * sample_xres + x;
+      const int top = curr - sample_xres;
+      if (strata_id[curr] == strata_id[top]) {
+        unite(parent, curr, top);
       }
     }
   }
+
+  // parents come before children in scan order
+  for (int i = 0; i < NPIXELS; i++) {
+    connected_label[i] = connected_label[parent[i]];
+  }
 }
 
 static void remap_connected_label(int npixels,
@@ -463,118 +853,144 @@ static void compute_connected_sample_count(const double *illum_values, int nvalu
   }
 }
 
+class FarthestPointJob {
+public:
+  FarthestPointJob() :
+      sample_xres(0), sample_yres(0),
+      samples(NULL), nsamples(NULL), offsets(NULL),
+      first_points(NULL), connected_sample_count(NULL), sample_offsets(NULL),
+      dome_samples(NULL) {}
+  ~FarthestPointJob() {}
+
+public:
+  int sample_xres, sample_yres;
+  const SamplePoint *samples;
+  const int *nsamples;
+  const int *offsets;
+  const int *first_points;
+  const int *connected_sample_count;
+  const int *sample_offsets;
+  DomeSample *dome_samples;
+};
+
+static void set_dome_sample(int sample_xres, int sample_yres,
+    const SamplePoint &point, DomeSample *sample)
+{
+  xy_to_uv(sample_xres, sample_yres, point.x, point.y, &sample->uv);
+  uv_to_dir(sample->uv.u, sample->uv.v, &sample->dir);
+}
+
+static double squared_distance(const SamplePoint &a, const SamplePoint &b)
+{
+  const double xx = a.x - b.x;
+  const double yy = a.y - b.y;
+  return xx * xx + yy * yy;
+}
+
+// picks the point farthest from the points picked so far. the distance
+// to the nearest picked point is updated as points are picked instead
+// of being searched again
+static ThreadStatus pick_farthest_points(void *data, const ThreadContext *cxt)
+{
+  FarthestPointJob *job = (FarthestPointJob *) data;
+  const int label = cxt->iteration_id;
+  const int ngen = job->connected_sample_count[label];
+
+  if (ngen == 0) {
+    return THREAD_LOOP_CONTINUE;
+  }
+
+  const SamplePoint *Y = job->samples + job->offsets[label];
+  const int nY = job->nsamples[label];
+  DomeSample *X = job->dome_samples + job->sample_offsets[label];
+  const SamplePoint &first = Y[job->first_points[label]];
+
+  std::vector<double> d_min(nY);
+  for (int p = 0; p < nY; p++) {
+    d_min[p] = squared_distance(first, Y[p]);
+  }
+  set_dome_sample(job->sample_xres, job->sample_yres, first, &X[0]);
+
+  for (int j = 1; j < ngen; j++) {
+    double d_max = -FLT_MAX;
+    int p_max = 0;
+
+    for (int p = 0; p < nY; p++) {
+      if (d_max < d_min[p]) {
+        d_max = d_min[p];
+        p_max = p;
+      }
+    }
+    for (int p = 0; p < nY; p++) {
+      d_min[p] = Min(d_min[p], squared_distance(Y[p_max], Y[p]));
+    }
+    set_dome_sample(job->sample_xres, job->sample_yres, Y[p_max], &X[j]);
+  }
+
+  return THREAD_LOOP_CONTINUE;
+}
+
 // Hochbaum-Shmoys algorithm
 static void generate_dome_samples(int sample_xres, int sample_yres,
     const int *connected_sample_count,
     const int *connected_label, int label_count,
-    DomeSample *dome_samples, int sample_count)
+    DomeSample *dome_samples, int sample_count, int thread_count)
 {
   const int NPIXELS = sample_xres * sample_yres;
   std::vector<SamplePoint> samples(NPIXELS);
-  std::vector<int>         nsamples(label_count);
+  std::vector<int>         nsamples(label_count, 0);
   std::vector<int>         offsets(label_count);
-  int next_dome_sample = 0;
+  std::vector<int>         first_points(label_count);
+  std::vector<int>         sample_offsets(label_count);
   int i;
 
+  // group pixels by label in scan order
   for (i = 0; i < NPIXELS; i++) {
-    samples[i].x = (int) (i % sample_xres);
-    samples[i].y = (int) (i / sample_xres);
-    samples[i].label = connected_label[i];
+    nsamples[connected_label[i]]++;
   }
-  // TODO use std::sort
-  qsort(&samples[0], NPIXELS,
-      sizeof(SamplePoint),
-      compare_sample_point);
-
   {
     int curr = 0;
     for (i = 0; i < label_count; i++) {
-      const int begin = curr;
-      offsets[i] = begin;
-      while (curr < NPIXELS && samples[curr].label == i) {
-        curr++;
-      }
-      nsamples[i] = curr - begin;
+      offsets[i] = curr;
+      curr += nsamples[i];
+    }
+  }
+  {
+    std::vector<int> next(offsets);
+    for (i = 0; i < NPIXELS; i++) {
+      SamplePoint &point = samples[next[connected_label[i]]++];
+      point.x = (int) (i % sample_xres);
+      point.y = (int) (i / sample_xres);
+      point.label = connected_label[i];
     }
   }
 
+  // random numbers are drawn in label order so the result does not
+  // depend on the thread count
   {
-    std::vector<SamplePoint> X(sample_count);
     XorShift xr;
     XorInit(&xr);
 
+    int next_dome_sample = 0;
     for (i = 0; i < label_count; i++) {
-      const int ngen = connected_sample_count[i];
-      const SamplePoint *Y = &samples[0] + offsets[i];
-      const int nY = nsamples[i];
-      const int x0 = (int) (nY * XorNextFloat01(&xr));
-      int nX = 0;
-      int j;
-
-      X[0] = Y[x0];
-      nX++;
-
-      if (ngen == 0) {
-        continue;
-      }
-      {
-        DomeSample sample;
-        xy_to_uv(sample_xres, sample_yres, Y[x0].x, Y[x0].y, &sample.uv);
-        uv_to_dir(sample.uv.u, sample.uv.v, &sample.dir);
-        dome_samples[next_dome_sample] = sample;
-        next_dome_sample++;
-      }
-
-      for (j = 1; j < ngen; j++) {
-        double d_max = -FLT_MAX;
-        int p_max = 0;
-        int p;
-
-        for (p = 0; p < nY; p++) {
-          const SamplePoint *Yp = &Y[p];
-          double d_min = FLT_MAX;
-          int q;
-          for (q = 0; q < nX; q++) {
-            const SamplePoint *Xq = &X[q];
-            const double xx = Xq->x - Yp->x;
-            const double yy = Xq->y - Yp->y;
-            const double d = xx * xx + yy * yy;
-            d_min = Min(d_min, d);
-          }
-          if (d_max < d_min) {
-            d_max = d_min;
-            p_max = p;
-          }
-        }
-
-        X[nX] = Y[p_max];
-        nX++;
-
-        {
-          DomeSample sample;
-          xy_to_uv(sample_xres, sample_yres, Y[p_max].x, Y[p_max].y, &sample.uv);
-          uv_to_dir(sample.uv.u, sample.uv.v, &sample.dir);
-          dome_samples[next_dome_sample] = sample;
-          next_dome_sample++;
-        }
-      }
+      first_points[i] = (int) (nsamples[i] * XorNextFloat01(&xr));
+      sample_offsets[i] = next_dome_sample;
+      next_dome_sample += connected_sample_count[i];
     }
   }
-}
 
-static int compare_sample_point(const void *ptr0, const void *ptr1)
-{
-  const SamplePoint *sample0 = (const SamplePoint *) ptr0;
-  const SamplePoint *sample1 = (const SamplePoint *) ptr1;
-  const double x = sample0->label;
-  const double y = sample1->label;
-
-  if (x > y)
-    return 1;
-  else if (x < y)
-    return -1;
-  else
-    return 0;
+  FarthestPointJob job;
+  job.sample_xres = sample_xres;
+  job.sample_yres = sample_yres;
+  job.samples = &samples[0];
+  job.nsamples = &nsamples[0];
+  job.offsets = &offsets[0];
+  job.first_points = &first_points[0];
+  job.connected_sample_count = connected_sample_count;
+  job.sample_offsets = &sample_offsets[0];
+  job.dome_samples = dome_samples;
+
+  MtRunThreadLoop(&job, pick_farthest_points, thread_count, 0, label_count);
 }
 
 } // namespace xxx
@@ -7,6 +7,8 @@
 #include "fj_tex_coord.h"
 #include "fj_vector.h"
 #include "fj_color.h"
+#include "fj_types.h"
+#include <vector>
 
 namespace fj {
 
@@ -23,17 +25,81 @@ public:
   Vector dir;
 };
 
+enum DomeSamplingMethod {
+  DOME_SAMPLING_RANDOM = 0,
+  DOME_SAMPLING_STRATIFIED,
+  DOME_SAMPLING_STRUCTURED
+};
+
+// what a dome sample table was made from. a cached table is reused only
+// when all of these match
+class DomeSampleCacheKey {
+public:
+  DomeSampleCacheKey() :
+      method(DOME_SAMPLING_STRATIFIED),
+      sample_count(0),
+      sample_xres(0),
+      sample_yres(0),
+      texture_size(0),
+      texture_time(0) {}
+  ~DomeSampleCacheKey() {}
+
+public:
+  int method;
+  int sample_count;
+  int sample_xres;
+  int sample_yres;
+  double texture_size;
+  double texture_time;
+};
+
+// an alias table over the pixels of an environment map weighted by
+// luminance and solid angle. picks a direction in constant time and
+// keeps the pixel colors so that picking never touches the texture
+class EnvironmentAliasTable {
+public:
+  EnvironmentAliasTable();
+  ~EnvironmentAliasTable();
+
+  void Build(Texture *texture, int sample_xres, int sample_yres, int thread_count);
+  void Clear();
+  bool IsEmpty() const;
+
+  // u0 picks a pixel and u1, u2 a point in it. sets uv, dir and color
+  // then returns the pdf per solid angle
+  Real Sample(Real u0, Real u1, Real u2, DomeSample *sample) const;
+
+private:
+  int xres_;
+  int yres_;
+  std::vector<float> prob_;
+  std::vector<int> alias_;
+  std::vector<float> pixel_pdf_;
+  std::vector<Color> colors_;
+};
+
 extern int ImportanceSampling(Texture *texture, int seed,
     int sample_xres, int sample_yres,
-    DomeSample *dome_samples, int sample_count);
+    DomeSample *dome_samples, int sample_count, int thread_count);
 
 extern int StratifiedImportanceSampling(Texture *texture, int seed,
     int sample_xres, int sample_yres,
-    DomeSample *dome_samples, int sample_count);
+    DomeSample *dome_samples, int sample_count, int thread_count);
 
 extern int StructuredImportanceSampling(Texture *texture, int seed,
     int sample_xres, int sample_yres,
+    DomeSample *dome_samples, int sample_count, int thread_count);
+
+// labels pixels connected through their edges in the same stratum with
+// 0, 1, ... in scan order. returns the number of components
+extern int LabelConnectedStrata(int sample_xres, int sample_yres,
+    const char *strata_id, int *connected_label, int thread_count);
+
+// returns -1 when the file is missing or made from a different key
+extern int ReadDomeSampleCache(const char *filename, const DomeSampleCacheKey &key,
     DomeSample *dome_samples, int sample_count);
+extern int WriteDomeSampleCache(const char *filename, const DomeSampleCacheKey &key,
+    const DomeSample *dome_samples, int sample_count);
 
 } // namespace xxx
 
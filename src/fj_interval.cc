@@ -2,7 +2,9 @@
 // See LICENSE and README
 
 #include "fj_interval.h"
+#include "fj_memory_arena.h"
 #include "fj_numeric.h"
+#include <new>
 
 namespace fj {
 
@@ -11,8 +13,10 @@ static int closer_than(const Interval *interval, const Interval *other);
 static Interval *dup_interval(const Interval &src);
 static void free_interval(Interval *interval);
 
-IntervalList::IntervalList() :
+IntervalList::IntervalList(MemoryArena *arena) :
     root_(),
+    arena_(arena),
+    first_alloc_(NULL),
     num_nodes_(0),
     tmin_(REAL_MAX),
     tmax_(-REAL_MAX)
@@ -21,14 +25,29 @@ IntervalList::IntervalList() :
 
 IntervalList::~IntervalList()
 {
-  free_interval_nodes(root_.next);
+  if (arena_ != NULL) {
+    // Interval has nothing to destruct
+    arena_->Release(first_alloc_);
+  } else {
+    free_interval_nodes(root_.next);
+  }
 }
 
 void IntervalList::Push(const Interval &interval)
 {
-  Interval *new_node = dup_interval(interval);
+  Interval *new_node = NULL;
   Interval *current = NULL;
 
+  if (arena_ != NULL) {
+    new_node = new (arena_->Allocate(sizeof(Interval))) Interval(interval);
+    new_node->next = NULL;
+    if (first_alloc_ == NULL) {
+      first_alloc_ = new_node;
+    }
+  } else {
+    new_node = dup_interval(interval);
+  }
+
   for (current = &root_; current != NULL; current = current->next) {
     if (current->next == NULL || closer_than(&interval, current->next)) {
       new_node->next = current->next;
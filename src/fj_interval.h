@@ -11,6 +11,7 @@ namespace fj {
 
 class IntervalList;
 class ObjectInstance;
+class MemoryArena;
 
 // ray-march interval for volumetric object
 class Interval {
@@ -32,7 +33,8 @@ public:
 
 class IntervalList {
 public:
-  IntervalList();
+  // nodes are taken from arena if given, otherwise from the heap
+  explicit IntervalList(MemoryArena *arena = NULL);
   ~IntervalList();
 
   void Push(const Interval &interval);
@@ -45,9 +47,15 @@ public:
 
 private:
   Interval root_;
+  MemoryArena *arena_;
+  Interval *first_alloc_;
   int num_nodes_;
   Real tmin_;
   Real tmax_;
+
+  // no copy
+  IntervalList(const IntervalList &);
+  const IntervalList &operator=(const IntervalList &);
 };
 
 } // namespace xxx
@@ -5,55 +5,64 @@
 #include "fj_framebuffer_io.h"
 #include "fj_framebuffer.h"
 #include "fj_numeric.h"
+#include "fj_os.h"
 #include "fj_texture.h"
+#include <cassert>
+#include <cstdio>
 #include <cfloat>
+#include <string>
 
 namespace fj {
 
 static int point_light_get_sample_count(const Light *light);
 static void point_light_get_samples(const Light *light,
-    LightSample *samples, int max_samples);
+    LightSample *samples, int max_samples, XorShift *rng);
 static void point_light_illuminate(const Light *light,
     const LightSample *sample,
     const Vector *Ps, Color *Cl);
 
 static int grid_light_get_sample_count(const Light *light);
 static void grid_light_get_samples(const Light *light,
-    LightSample *samples, int max_samples);
+    LightSample *samples, int max_samples, XorShift *rng);
 static void grid_light_illuminate(const Light *light,
     const LightSample *sample,
     const Vector *Ps, Color *Cl);
 
 static int sphere_light_get_sample_count(const Light *light);
 static void sphere_light_get_samples(const Light *light,
-    LightSample *samples, int max_samples);
+    LightSample *samples, int max_samples, XorShift *rng);
 static void sphere_light_illuminate(const Light *light,
     const LightSample *sample,
     const Vector *Ps, Color *Cl);
 
 static int dome_light_get_sample_count(const Light *light);
 static void dome_light_get_samples(const Light *light,
-    LightSample *samples, int max_samples);
+    LightSample *samples, int max_samples, XorShift *rng);
 static void dome_light_illuminate(const Light *light,
     const LightSample *sample,
     const Vector *Ps, Color *Cl);
-static int dome_light_preprocess(Light *light);
+static int dome_light_preprocess(Light *light, int thread_count);
+static std::string make_dome_cache_filename(const Texture *texture,
+    DomeSampleCacheKey *key);
 
-static int no_preprocess(Light *light);
+static int no_preprocess(Light *light, int thread_count);
 
 Light::Light() :
   color_(1, 1, 1),
   intensity_(1),
   transform_samples_(),
-  xr_(),
 
   type_(LGT_POINT),
   double_sided_(false),
   sample_count_(16),
   sample_intensity_(intensity_ / sample_count_),
+  sample_cache_(false),
+  per_point_sampling_(false),
+  sampling_method_(DOME_SAMPLING_STRATIFIED),
 
   environment_map_(NULL),
   dome_samples_(),
+  alias_table_(),
 
   GetSampleCount_(NULL),
   GetSamples_(NULL),
@@ -72,7 +81,6 @@ void Light::SetLightType(int light_type)
   type_ = light_type;
 
   XfmInitTransformSampleList(&transform_samples_);
-  XorInit(&xr_);
 
   switch (type_) {
   case LGT_POINT:
@@ -139,6 +147,24 @@ void Light::SetEnvironmentMap(Texture *texture)
   environment_map_ = texture;
 }
 
+void Light::SetSampleCache(bool on_or_off)
+{
+  sample_cache_ = on_or_off;
+}
+
+void Light::SetPerPointSampling(bool on_or_off)
+{
+  per_point_sampling_ = on_or_off;
+}
+
+void Light::SetSamplingMethod(int sampling_method)
+{
+  assert(sampling_method == DOME_SAMPLING_RANDOM ||
+      sampling_method == DOME_SAMPLING_STRATIFIED ||
+      sampling_method == DOME_SAMPLING_STRUCTURED);
+  sampling_method_ = sampling_method;
+}
+
 void Light::SetTranslate(Real tx, Real ty, Real tz, Real time)
 {
   XfmPushTranslateSample(&transform_samples_, tx, ty, tz, time);
@@ -164,9 +190,9 @@ void Light::SetRotateOrder(int order)
   XfmSetSampleRotateOrder(&transform_samples_, order);
 }
 
-void Light::GetSamples(LightSample *samples, int max_samples) const
+void Light::GetSamples(LightSample *samples, int max_samples, XorShift *rng) const
 {
-  GetSamples_(this, samples, max_samples);
+  GetSamples_(this, samples, max_samples, rng);
 }
 
 int Light::GetSampleCount() const
@@ -181,9 +207,9 @@ Color Light::Illuminate(const LightSample &sample, const Vector &Ps) const
   return Cl;
 }
 
-int Light::Preprocess()
+int Light::Preprocess(int thread_count)
 {
-  return Preprocess_(this);
+  return Preprocess_(this, thread_count);
 }
 
 // point light
@@ -193,7 +219,7 @@ static int point_light_get_sample_count(const Light *light)
 }
 
 static void point_light_get_samples(const Light *light,
-    LightSample *samples, int max_samples)
+    LightSample *samples, int max_samples, XorShift *rng)
 {
   if (max_samples == 0)
     return;
@@ -221,7 +247,7 @@ static int grid_light_get_sample_count(const Light *light)
 }
 
 static void grid_light_get_samples(const Light *light,
-    LightSample *samples, int max_samples)
+    LightSample *samples, int max_samples, XorShift *rng)
 {
   Transform transform_interp;
   // TODO time sampling
@@ -234,13 +260,17 @@ static void grid_light_get_samples(const Light *light,
   int nsamples = light->GetSampleCount();
   nsamples = Min(nsamples, max_samples);
 
+  // a new scramble for each call decorrelates the pattern between pixels
+  const uint32_t seed_x = XorNextInteger(rng);
+  const uint32_t seed_z = XorNextInteger(rng);
+
   for (int i = 0; i < nsamples; i++) {
-    XorShift *mutable_xr = (XorShift *) &light->xr_;
-    const Real x = (XorNextFloat01(mutable_xr) - .5);
-    const Real z = (XorNextFloat01(mutable_xr) - .5);
+    double x = 0, z = 0;
+    ScrambledSobol2D(i, seed_x, seed_z, &x, &z);
+
     Vector P_sample;
-    P_sample.x = x;
-    P_sample.z = z;
+    P_sample.x = x - .5;
+    P_sample.z = z - .5;
 
     XfmTransformPoint(&transform_interp, &P_sample);
 
@@ -275,7 +305,7 @@ static int sphere_light_get_sample_count(const Light *light)
 }
 
 static void sphere_light_get_samples(const Light *light,
-    LightSample *samples, int max_samples)
+    LightSample *samples, int max_samples, XorShift *rng)
 {
   Transform transform_interp;
   // TODO time sampling
@@ -284,12 +314,22 @@ static void sphere_light_get_samples(const Light *light,
   int nsamples = light->GetSampleCount();
   nsamples = Min(nsamples, max_samples);
 
+  const uint32_t seed_u = XorNextInteger(rng);
+  const uint32_t seed_v = XorNextInteger(rng);
+
   for (int i = 0; i < nsamples; i++) {
-    XorShift *mutable_xr = (XorShift *) &light->xr_;
     Vector P_sample;
     Vector N_sample;
-
-    XorHollowSphereRand(mutable_xr, &P_sample);
+    double u = 0, v = 0;
+
+    // area preserving map keeps the stratification on the sphere
+    ScrambledSobol2D(i, seed_u, seed_v, &u, &v);
+    const Real y = 1 - 2 * u;
+    const Real r = sqrt(Max(0., 1 - y * y));
+    const Real phi = 2 * PI * v;
+    P_sample.x = r * cos(phi);
+    P_sample.y = y;
+    P_sample.z = r * sin(phi);
     N_sample = P_sample;
 
     XfmTransformPoint(&transform_interp, &P_sample);
@@ -324,7 +364,7 @@ static int dome_light_get_sample_count(const Light *light)
 }
 
 static void dome_light_get_samples(const Light *light,
-    LightSample *samples, int max_samples)
+    LightSample *samples, int max_samples, XorShift *rng)
 {
   Transform transform_interp;
   // TODO time sampling
@@ -333,8 +373,23 @@ static void dome_light_get_samples(const Light *light,
   int nsamples = light->GetSampleCount();
   nsamples = Min(nsamples, max_samples);
 
+  const bool per_point = !light->alias_table_.IsEmpty();
+
   for (int i = 0; i < nsamples; i++) {
     const DomeSample *dome_sample = &light->dome_samples_[i];
+    DomeSample new_sample;
+
+    if (per_point) {
+      // stratified on the pick of pixels. the color is divided by the pdf
+      // so that the samples average the map over the whole sphere
+      const Real u0 = (i + XorNextFloat01(rng)) / nsamples;
+      const Real u1 = XorNextFloat01(rng);
+      const Real u2 = XorNextFloat01(rng);
+      const Real pdf = light->alias_table_.Sample(u0, u1, u2, &new_sample);
+
+      new_sample.color *= 1. / (4 * PI * pdf);
+      dome_sample = &new_sample;
+    }
 
     // TODO CHANGE IT TO REAL_MAX WHEN FINISHING IT TO OTHERS
     Vector P_sample = dome_sample->dir * FLT_MAX;
@@ -358,7 +413,7 @@ static void dome_light_illuminate(const Light *light,
   *Cl = light->sample_intensity_ * sample->color;
 }
 
-static int dome_light_preprocess(Light *light)
+static int dome_light_preprocess(Light *light, int thread_count)
 {
   const int NSAMPLES = light->GetSampleCount();
   DomeSample init_sample;
@@ -381,24 +436,78 @@ static int dome_light_preprocess(Light *light)
   XRES /= 8;
   YRES /= 8;
 
-  if (0) {
+  light->alias_table_.Clear();
+  if (light->per_point_sampling_) {
+    light->alias_table_.Build(light->environment_map_, XRES, YRES, thread_count);
+    return 0;
+  }
+
+  DomeSampleCacheKey key;
+  key.method = light->sampling_method_;
+  key.sample_count = NSAMPLES;
+  key.sample_xres = XRES;
+  key.sample_yres = YRES;
+
+  std::string cache_filename;
+  if (light->sample_cache_) {
+    cache_filename = make_dome_cache_filename(light->environment_map_, &key);
+  }
+  if (cache_filename != "" &&
+      ReadDomeSampleCache(cache_filename.c_str(), key,
+          &light->dome_samples_[0], NSAMPLES) == 0) {
+    printf("#   Dome Sample Cache: %s\n", cache_filename.c_str());
+    return 0;
+  }
+
+  switch (key.method) {
+  case DOME_SAMPLING_RANDOM:
     ImportanceSampling(light->environment_map_, 0,
         XRES, YRES,
-        &light->dome_samples_[0], NSAMPLES);
-  } else if (1) {
+        &light->dome_samples_[0], NSAMPLES, thread_count);
+    break;
+  case DOME_SAMPLING_STRATIFIED:
     StratifiedImportanceSampling(light->environment_map_, 0,
         XRES, YRES,
-        &light->dome_samples_[0], NSAMPLES);
-  } else {
+        &light->dome_samples_[0], NSAMPLES, thread_count);
+    break;
+  case DOME_SAMPLING_STRUCTURED:
+  default:
     StructuredImportanceSampling(light->environment_map_, 0,
         XRES, YRES,
-        &light->dome_samples_[0], NSAMPLES);
+        &light->dome_samples_[0], NSAMPLES, thread_count);
+    break;
+  }
+
+  // failing to write the cache only costs the next render the preprocess
+  if (cache_filename != "" &&
+      WriteDomeSampleCache(cache_filename.c_str(), key,
+          &light->dome_samples_[0], NSAMPLES) == 0) {
+    printf("#   Dome Sample Cache: %s (saved)\n", cache_filename.c_str());
   }
 
   return 0;
 }
 
-static int no_preprocess(Light *light)
+// the cache file is named after the map, method and sample count.
+// the size and time of the map find out when the map is replaced
+static std::string make_dome_cache_filename(const Texture *texture,
+    DomeSampleCacheKey *key)
+{
+  static const char *method_names[] = {"random", "stratified", "structured"};
+  const std::string &texture_filename = texture->GetFilename();
+
+  if (texture_filename == "" || OsGetFileTime(texture_filename.c_str(),
+      &key->texture_size, &key->texture_time) != 0) {
+    return "";
+  }
+
+  char suffix[64] = {'\0'};
+  sprintf(suffix, ".%s%d.dome", method_names[key->method], key->sample_count);
+
+  return texture_filename + suffix;
+}
+
+static int no_preprocess(Light *light, int thread_count)
 {
   // does nothing
   return 0;
@@ -27,13 +27,15 @@ class Texture;
 
 class LightSample {
 public:
-  LightSample() : light(NULL), P(), N(), color() {}
+  LightSample() : light(NULL), P(), N(), color(), weight(1) {}
   ~LightSample() {}
 
   const Light *light;
   Vector P;
   Vector N;
   Color color;
+  // scales the light for samples picked from a subset of lights
+  Real weight;
 };
 
 class Light {
@@ -49,6 +51,14 @@ public:
   void SetSampleCount(int sample_count);
   void SetDoubleSided(bool on_or_off);
   void SetEnvironmentMap(Texture *texture);
+  // keeps dome samples in a file next to the environment map
+  void SetSampleCache(bool on_or_off);
+  // picks new dome samples for each shading point instead of sharing
+  // one set of directions in the frame
+  void SetPerPointSampling(bool on_or_off);
+  // DOME_SAMPLING_RANDOM, DOME_SAMPLING_STRATIFIED or
+  // DOME_SAMPLING_STRUCTURED to pick the shared dome samples
+  void SetSamplingMethod(int sampling_method);
 
   // transformation
   void SetTranslate(Real tx, Real ty, Real tz, Real time);
@@ -58,10 +68,10 @@ public:
   void SetRotateOrder(int order);
 
   // samples
-  void GetSamples(LightSample *samples, int max_samples) const;
+  void GetSamples(LightSample *samples, int max_samples, XorShift *rng) const;
   int GetSampleCount() const;
   Color Illuminate(const LightSample &sample, const Vector &Ps) const;
-  int Preprocess();
+  int Preprocess(int thread_count);
 
 public: // TODO ONCE FINISHING INHERITANCE MAKE IT PRAIVATE
   Color color_;
@@ -70,27 +80,28 @@ public: // TODO ONCE FINISHING INHERITANCE MAKE IT PRAIVATE
   // transformation properties
   TransformSampleList transform_samples_;
 
-  // rng
-  XorShift xr_;
-
   int type_;
   bool double_sided_;
   int sample_count_;
   float sample_intensity_;
+  bool sample_cache_;
+  bool per_point_sampling_;
+  int sampling_method_;
 
   Texture *environment_map_;
   // TODO tmp solution for dome light data
   std::vector<DomeSample> dome_samples_;
+  EnvironmentAliasTable alias_table_;
 
   // TODO USE INHERITANCE
   // functions
   int (*GetSampleCount_)(const Light *light);
   void (*GetSamples_)(const Light *light,
-      LightSample *samples, int max_samples);
+      LightSample *samples, int max_samples, XorShift *rng);
   void (*Illuminate_)(const Light *light,
       const LightSample *sample,
       const Vector *Ps, Color *Cl);
-  int (*Preprocess_)(Light *light);
+  int (*Preprocess_)(Light *light, int thread_count);
 };
 
 } // namespace xxx
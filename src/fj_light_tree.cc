@@ -0,0 +1,296 @@
+// Copyright (c) 2011-2014 Hiroshi Tsubokawa
+// See LICENSE and README
+
+#include "fj_light_tree.h"
+#include "fj_transform.h"
+#include "fj_numeric.h"
+#include "fj_light.h"
+
+#include <algorithm>
+#include <cassert>
+#include <limits>
+#include <cmath>
+
+namespace fj {
+
+static bool setup_leaf(const Light *light, int light_index, LightTreeNode *leaf);
+static void merge_cones(const LightTreeNode &a, const LightTreeNode &b,
+    Vector *axis, Real *cos_theta);
+static Real node_importance(const LightTreeNode &node, const Vector &P);
+
+class CentroidLess {
+public:
+  CentroidLess(int axis) : axis_(axis) {}
+  ~CentroidLess() {}
+
+  bool operator()(const LightTreeNode &a, const LightTreeNode &b) const
+  {
+    return BoxCentroid(a.bounds)[axis_] < BoxCentroid(b.bounds)[axis_];
+  }
+
+private:
+  int axis_;
+};
+
+LightTree::LightTree() :
+    lights_(NULL),
+    nlights_(0),
+    budget_(0),
+    sample_count_(0),
+    nodes_()
+{
+}
+
+LightTree::~LightTree()
+{
+}
+
+void LightTree::Build(const Light **lights, int nlights)
+{
+  std::vector<LightTreeNode> leaves;
+
+  lights_ = lights;
+  nlights_ = nlights;
+  sample_count_ = 0;
+  nodes_.clear();
+
+  for (int i = 0; i < nlights; i++) {
+    LightTreeNode leaf;
+    if (setup_leaf(lights[i], i, &leaf)) {
+      leaves.push_back(leaf);
+      sample_count_ += lights[i]->GetSampleCount();
+    }
+  }
+
+  if (leaves.empty()) {
+    return;
+  }
+
+  nodes_.reserve(2 * leaves.size() - 1);
+  build_recursive(leaves, 0, leaves.size());
+}
+
+void LightTree::SetSampleBudget(int budget)
+{
+  assert(budget >= 0);
+  budget_ = budget;
+}
+
+bool LightTree::IsBuiltFor(const Light **lights, int nlights) const
+{
+  return !nodes_.empty() && lights_ == lights && nlights_ == nlights;
+}
+
+int LightTree::GetSampleBudget() const
+{
+  return budget_;
+}
+
+int LightTree::GetNodeCount() const
+{
+  return nodes_.size();
+}
+
+int LightTree::GetLightCount() const
+{
+  return (nodes_.size() + 1) / 2;
+}
+
+int LightTree::GetSampleCount() const
+{
+  return sample_count_;
+}
+
+int LightTree::PickLight(const Vector &P, Real u, Real *pdf) const
+{
+  assert(!nodes_.empty());
+  Real prob = 1;
+  int index = 0;
+
+  for (;;) {
+    const LightTreeNode &node = nodes_[index];
+    if (node.IsLeaf()) {
+      *pdf = prob;
+      return node.light_index;
+    }
+
+    const Real I_left  = node_importance(nodes_[node.left], P);
+    const Real I_right = node_importance(nodes_[node.right], P);
+    if (I_left + I_right <= 0) {
+      // nothing below can light up P. keep going to return some light
+      prob = 0;
+      index = node.left;
+      continue;
+    }
+
+    // reuse u for the next level
+    const Real p_left = I_left / (I_left + I_right);
+    if (u < p_left) {
+      u = u / p_left;
+      prob *= p_left;
+      index = node.left;
+    } else {
+      u = (u - p_left) / (1 - p_left);
+      prob *= 1 - p_left;
+      index = node.right;
+    }
+    u = Min(u, 1 - std::numeric_limits<Real>::epsilon());
+  }
+}
+
+int LightTree::build_recursive(std::vector<LightTreeNode> &leaves, int begin, int end)
+{
+  const int index = nodes_.size();
+  nodes_.push_back(LightTreeNode());
+
+  if (end - begin == 1) {
+    nodes_[index] = leaves[begin];
+    return index;
+  }
+
+  Box centroid_bounds;
+  BoxReverseInfinite(&centroid_bounds);
+  for (int i = begin; i < end; i++) {
+    BoxAddPoint(&centroid_bounds, BoxCentroid(leaves[i].bounds));
+  }
+
+  const Vector size = BoxSize(centroid_bounds);
+  int axis = 0;
+  if (size[1] > size[axis]) axis = 1;
+  if (size[2] > size[axis]) axis = 2;
+
+  const int mid = (begin + end) / 2;
+  std::nth_element(leaves.begin() + begin, leaves.begin() + mid,
+      leaves.begin() + end, CentroidLess(axis));
+
+  const int left = build_recursive(leaves, begin, mid);
+  const int right = build_recursive(leaves, mid, end);
+
+  LightTreeNode node;
+  node.left = left;
+  node.right = right;
+  node.bounds = nodes_[left].bounds;
+  BoxAddBox(&node.bounds, nodes_[right].bounds);
+  node.power = nodes_[left].power + nodes_[right].power;
+  merge_cones(nodes_[left], nodes_[right], &node.axis, &node.cos_theta);
+  nodes_[index] = node;
+
+  return index;
+}
+
+static bool setup_leaf(const Light *light, int light_index, LightTreeNode *leaf)
+{
+  Transform transform_interp;
+  XfmLerpTransformSample(&light->transform_samples_, 0, &transform_interp);
+
+  BoxReverseInfinite(&leaf->bounds);
+  leaf->axis = Vector(0, 1, 0);
+  leaf->cos_theta = -1;
+  leaf->power = Max(0., light->intensity_ *
+      (light->color_.r + light->color_.g + light->color_.b) / 3.);
+  leaf->light_index = light_index;
+
+  switch (light->type_) {
+  case LGT_POINT:
+    BoxAddPoint(&leaf->bounds, transform_interp.translate);
+    break;
+  case LGT_GRID:
+    for (int i = 0; i < 4; i++) {
+      Vector corner((i & 1) ? .5 : -.5, 0, (i & 2) ? .5 : -.5);
+      XfmTransformPoint(&transform_interp, &corner);
+      BoxAddPoint(&leaf->bounds, corner);
+    }
+    // emits to the side of its normal only
+    if (!light->double_sided_) {
+      XfmTransformVector(&transform_interp, &leaf->axis);
+      Normalize(&leaf->axis);
+      leaf->cos_theta = 1;
+    }
+    break;
+  case LGT_SPHERE:
+    for (int i = 0; i < 8; i++) {
+      Vector corner((i & 1) ? 1 : -1, (i & 2) ? 1 : -1, (i & 4) ? 1 : -1);
+      XfmTransformPoint(&transform_interp, &corner);
+      BoxAddPoint(&leaf->bounds, corner);
+    }
+    break;
+  case LGT_DOME:
+  default:
+    return false;
+  }
+
+  return true;
+}
+
+static void merge_cones(const LightTreeNode &a, const LightTreeNode &b,
+    Vector *axis, Real *cos_theta)
+{
+  *axis = a.axis;
+  *cos_theta = -1;
+
+  if (a.cos_theta <= -1 || b.cos_theta <= -1) {
+    return;
+  }
+
+  const LightTreeNode &wide   = a.cos_theta < b.cos_theta ? a : b;
+  const LightTreeNode &narrow = a.cos_theta < b.cos_theta ? b : a;
+  const Real theta_w = acos(wide.cos_theta);
+  const Real theta_n = acos(narrow.cos_theta);
+  const Real theta_d = acos(Clamp(Dot(wide.axis, narrow.axis), -1, 1));
+
+  // the wide one already covers the narrow one
+  if (theta_d + theta_n <= theta_w) {
+    *axis = wide.axis;
+    *cos_theta = wide.cos_theta;
+    return;
+  }
+
+  const Real theta_o = .5 * (theta_w + theta_d + theta_n);
+  if (theta_o >= PI) {
+    return;
+  }
+
+  // rotate the wide axis toward the narrow one
+  const Real theta_r = theta_o - theta_w;
+  Vector ortho = narrow.axis - Dot(wide.axis, narrow.axis) * wide.axis;
+  if (Length(ortho) == 0) {
+    *axis = wide.axis;
+  } else {
+    Normalize(&ortho);
+    *axis = cos(theta_r) * wide.axis + sin(theta_r) * ortho;
+    Normalize(axis);
+  }
+  *cos_theta = cos(theta_o);
+}
+
+// lights have no distance falloff in this renderer, so importance
+// is power bounded by the cone of emission seen from P
+static Real node_importance(const LightTreeNode &node, const Vector &P)
+{
+  if (node.power <= 0) {
+    return 0;
+  }
+  if (node.cos_theta <= -1 || BoxContainsPoint(node.bounds, P)) {
+    return node.power;
+  }
+
+  Vector dir = P - BoxCentroid(node.bounds);
+  const Real dist = Length(dir);
+  const Real radius = BoxDiagonal(node.bounds);
+  if (dist <= radius) {
+    return node.power;
+  }
+  Normalize(&dir);
+
+  const Real theta_b = asin(radius / dist);
+  const Real theta_o = acos(node.cos_theta);
+  const Real theta = acos(Clamp(Dot(node.axis, dir), -1, 1));
+  const Real theta_p = Max(theta - theta_o - theta_b, 0.);
+
+  if (theta_p >= PI / 2) {
+    return 0;
+  }
+  return node.power * cos(theta_p);
+}
+
+} // namespace xxx
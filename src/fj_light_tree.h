@@ -0,0 +1,76 @@
+// Copyright (c) 2011-2014 Hiroshi Tsubokawa
+// See LICENSE and README
+
+#ifndef FJ_LIGHT_TREE_H
+#define FJ_LIGHT_TREE_H
+
+#include "fj_compatibility.h"
+#include "fj_vector.h"
+#include "fj_types.h"
+#include "fj_box.h"
+#include <vector>
+
+namespace fj {
+
+class Light;
+
+// bounds, power and a cone of emission directions of a light cluster
+class LightTreeNode {
+public:
+  LightTreeNode() :
+      bounds(),
+      axis(0, 1, 0),
+      cos_theta(-1),
+      power(0),
+      left(-1),
+      right(-1),
+      light_index(-1) {}
+  ~LightTreeNode() {}
+
+  bool IsLeaf() const { return light_index != -1; }
+
+  Box bounds;
+  Vector axis;
+  Real cos_theta; // -1 emits in all directions
+  Real power;
+
+  int left;
+  int right;
+  int light_index;
+};
+
+// a hierarchy of lights to pick a fixed number of lights per shading point
+// instead of sampling all of them. dome lights are left out as they are
+// everywhere, and lights are taken at time 0
+class FJ_API LightTree {
+public:
+  LightTree();
+  ~LightTree();
+
+  void Build(const Light **lights, int nlights);
+  void SetSampleBudget(int budget);
+
+  bool IsBuiltFor(const Light **lights, int nlights) const;
+  int GetSampleBudget() const;
+  int GetNodeCount() const;
+  int GetLightCount() const;
+  int GetSampleCount() const;
+
+  // picks a light with probability proportional to its importance at P.
+  // returns the index in the light list. pdf is 0 when nothing can
+  // light up P
+  int PickLight(const Vector &P, Real u, Real *pdf) const;
+
+private:
+  int build_recursive(std::vector<LightTreeNode> &leaves, int begin, int end);
+
+  const Light **lights_;
+  int nlights_;
+  int budget_;
+  int sample_count_;
+  std::vector<LightTreeNode> nodes_;
+};
+
+} // namespace xxx
+
+#endif // FJ_XXX_H
@@ -0,0 +1,89 @@
+// Copyright (c) 2011-2014 Hiroshi Tsubokawa
+// See LICENSE and README
+
+#include "fj_memory_arena.h"
+#include <cassert>
+
+namespace fj {
+
+static const size_t BLOCK_SIZE = 64 * 1024;
+static const size_t ALIGNMENT = 16;
+
+static size_t align_size(size_t size)
+{
+  return (size + ALIGNMENT - 1) & ~(ALIGNMENT - 1);
+}
+
+MemoryArena::MemoryArena() : blocks_(), current_(0)
+{
+}
+
+MemoryArena::~MemoryArena()
+{
+  for (size_t i = 0; i < blocks_.size(); i++) {
+    delete [] blocks_[i].data;
+  }
+}
+
+void *MemoryArena::Allocate(size_t size)
+{
+  const size_t aligned_size = align_size(size);
+
+  for (;;) {
+    if (current_ == blocks_.size()) {
+      Block block;
+      block.size = aligned_size > BLOCK_SIZE ? aligned_size : BLOCK_SIZE;
+      block.data = new char[block.size];
+      blocks_.push_back(block);
+    }
+
+    Block &block = blocks_[current_];
+    if (block.used + aligned_size <= block.size) {
+      void *ptr = block.data + block.used;
+      block.used += aligned_size;
+      return ptr;
+    }
+
+    // blocks after the current one are always empty
+    current_++;
+  }
+}
+
+void MemoryArena::Release(void *ptr)
+{
+  const char *p = static_cast<const char *>(ptr);
+
+  if (p == NULL || blocks_.empty()) {
+    return;
+  }
+
+  // ptr is almost always in the current block
+  for (size_t i = current_ + 1; i-- > 0; ) {
+    Block &block = blocks_[i];
+
+    if (block.data <= p && p < block.data + block.size) {
+      block.used = p - block.data;
+      for (size_t j = i + 1; j <= current_; j++) {
+        blocks_[j].used = 0;
+      }
+      current_ = i;
+      return;
+    }
+  }
+  assert(!"pointer not in arena");
+}
+
+void MemoryArena::Reset()
+{
+  for (size_t i = 0; i < blocks_.size(); i++) {
+    blocks_[i].used = 0;
+  }
+  current_ = 0;
+}
+
+int MemoryArena::GetBlockCount() const
+{
+  return (int) blocks_.size();
+}
+
+} // namespace xxx
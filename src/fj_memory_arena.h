@@ -0,0 +1,49 @@
+// Copyright (c) 2011-2014 Hiroshi Tsubokawa
+// See LICENSE and README
+
+#ifndef FJ_MEMORY_ARENA_H
+#define FJ_MEMORY_ARENA_H
+
+#include "fj_compatibility.h"
+#include <vector>
+#include <cstddef>
+
+namespace fj {
+
+// scratch memory for one thread. allocations are released in reverse order
+// by giving back the pointer of the oldest one to be released. memory blocks
+// are kept after release so that it stops hitting the heap once warmed up.
+class MemoryArena {
+public:
+  MemoryArena();
+  ~MemoryArena();
+
+  void *Allocate(size_t size);
+  // releases ptr and everything allocated after it
+  void Release(void *ptr);
+  void Reset();
+
+  int GetBlockCount() const;
+
+private:
+  class Block {
+  public:
+    Block() : data(NULL), size(0), used(0) {}
+    ~Block() {}
+
+    char *data;
+    size_t size;
+    size_t used;
+  };
+
+  std::vector<Block> blocks_;
+  size_t current_;
+
+  // no copy
+  MemoryArena(const MemoryArena &);
+  const MemoryArena &operator=(const MemoryArena &);
+};
+
+} // namespace xxx
+
+#endif // FJ_XXX_H
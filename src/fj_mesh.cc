@@ -2,11 +2,15 @@
 // See LICENSE and README
 
 #include "fj_mesh.h"
+#include "fj_multi_thread.h"
+#include "fj_numeric.h"
 #include "fj_intersection.h"
 #include "fj_primitive_set.h"
 #include "fj_triangle.h"
 #include "fj_ray.h"
 
+#include <cmath>
+
 #define ATTRIBUTE_LIST(ATTR) \
   ATTR(Vertex, Vector,   P_,        Position) \
   ATTR(Vertex, Vector,   N_,        Normal) \
@@ -43,6 +47,167 @@ bool Mesh::Has##Class##Label() const \
   ATTRIBUTE_LIST(ATTR)
 #undef ATTR
 
+class MeshBoundsLoop {
+public:
+  MeshBoundsLoop() : mesh(NULL), face_count(0) {}
+  ~MeshBoundsLoop() {}
+
+public:
+  const Mesh *mesh;
+  int face_count;
+  std::vector<Box> chunk_bounds;
+};
+
+// vertex normals are gathered from the corners that refer to each vertex.
+// corners of vertex i are vertex_corner[vertex_offset[i] .. vertex_offset[i+1]]
+// and stored in face order so the sum is the same for any thread count
+class MeshNormalLoop {
+public:
+  MeshNormalLoop() : mesh(NULL), vertex_count(0), face_count(0),
+      weighting(NML_WEIGHT_UNIFORM), vertex_normal(NULL) {}
+  ~MeshNormalLoop() {}
+
+public:
+  const Mesh *mesh;
+  int vertex_count;
+  int face_count;
+  int weighting;
+  std::vector<Vector> face_normal;
+  std::vector<Real> corner_weight;
+  std::vector<int> vertex_offset;
+  std::vector<int> vertex_corner;
+  Vector *vertex_normal;
+};
+
+static ThreadStatus compute_bounds_chunk(void *data, const ThreadContext *context)
+{
+  MeshBoundsLoop *loop = static_cast<MeshBoundsLoop *>(data);
+  const int chunk_id = context->iteration_id;
+  int begin = 0;
+  int end = 0;
+
+  Box chunk_bounds;
+  BoxReverseInfinite(&chunk_bounds);
+
+  MtGetChunkRange(chunk_id, loop->face_count, &begin, &end);
+  for (int i = begin; i < end; i++) {
+    Box tri_bounds;
+    loop->mesh->GetPrimitiveBounds(i, &tri_bounds);
+    BoxAddBox(&chunk_bounds, tri_bounds);
+  }
+
+  loop->chunk_bounds[chunk_id] = chunk_bounds;
+
+  return THREAD_LOOP_CONTINUE;
+}
+
+static Real corner_angle(const Vector &P, const Vector &Pnext, const Vector &Pprev)
+{
+  const Vector a = Pnext - P;
+  const Vector b = Pprev - P;
+
+  return atan2(Length(Cross(a, b)), Dot(a, b));
+}
+
+static ThreadStatus compute_face_normal_chunk(void *data, const ThreadContext *context)
+{
+  MeshNormalLoop *loop = static_cast<MeshNormalLoop *>(data);
+  int begin = 0;
+  int end = 0;
+
+  MtGetChunkRange(context->iteration_id, loop->face_count, &begin, &end);
+  for (int i = begin; i < end; i++) {
+    const Index3 face = loop->mesh->GetFaceIndices(i);
+
+    const Vector P0 = loop->mesh->GetVertexPosition(face.i0);
+    const Vector P1 = loop->mesh->GetVertexPosition(face.i1);
+    const Vector P2 = loop->mesh->GetVertexPosition(face.i2);
+
+    Real *weight = &loop->corner_weight[3*i];
+
+    switch (loop->weighting) {
+    case NML_WEIGHT_AREA:
+      // the length of the cross product is twice the area
+      loop->face_normal[i] = .5 * Cross(P1 - P0, P2 - P0);
+      weight[0] = weight[1] = weight[2] = 1;
+      break;
+    case NML_WEIGHT_ANGLE:
+      loop->face_normal[i] = TriComputeFaceNormal(P0, P1, P2);
+      weight[0] = corner_angle(P0, P1, P2);
+      weight[1] = corner_angle(P1, P2, P0);
+      weight[2] = corner_angle(P2, P0, P1);
+      break;
+    case NML_WEIGHT_UNIFORM:
+    default:
+      loop->face_normal[i] = TriComputeFaceNormal(P0, P1, P2);
+      weight[0] = weight[1] = weight[2] = 1;
+      break;
+    }
+  }
+
+  return THREAD_LOOP_CONTINUE;
+}
+
+static ThreadStatus gather_vertex_normal_chunk(void *data, const ThreadContext *context)
+{
+  MeshNormalLoop *loop = static_cast<MeshNormalLoop *>(data);
+  int begin = 0;
+  int end = 0;
+
+  MtGetChunkRange(context->iteration_id, loop->vertex_count, &begin, &end);
+  for (int i = begin; i < end; i++) {
+    Vector N(0, 0, 0);
+
+    for (int j = loop->vertex_offset[i]; j < loop->vertex_offset[i + 1]; j++) {
+      const int corner = loop->vertex_corner[j];
+      N += loop->corner_weight[corner] * loop->face_normal[corner / 3];
+    }
+
+    loop->vertex_normal[i] = Normalize(&N);
+  }
+
+  return THREAD_LOOP_CONTINUE;
+}
+
+static void build_vertex_corner_list(const Mesh *mesh, MeshNormalLoop *loop)
+{
+  const int nverts = loop->vertex_count;
+  const int nfaces = loop->face_count;
+  std::vector<int> &offset = loop->vertex_offset;
+  std::vector<int> &corner = loop->vertex_corner;
+
+  // count corners per vertex. out of range indices are ignored
+  offset.assign(nverts + 1, 0);
+  for (int i = 0; i < nfaces; i++) {
+    const Index3 face = mesh->GetFaceIndices(i);
+    const Index idx[3] = {face.i0, face.i1, face.i2};
+
+    for (int k = 0; k < 3; k++) {
+      if (idx[k] >= 0 && idx[k] < nverts) {
+        offset[idx[k] + 1]++;
+      }
+    }
+  }
+
+  for (int i = 0; i < nverts; i++) {
+    offset[i + 1] += offset[i];
+  }
+
+  // fill corners in face order
+  std::vector<int> cursor(offset.begin(), offset.end() - 1);
+  corner.resize(offset[nverts]);
+  for (int i = 0; i < nfaces; i++) {
+    const Index3 face = mesh->GetFaceIndices(i);
+    const Index idx[3] = {face.i0, face.i1, face.i2};
+
+    for (int k = 0; k < 3; k++) {
+      if (idx[k] >= 0 && idx[k] < nverts) {
+        corner[cursor[idx[k]]++] = 3*i + k;
+      }
+    }
+  }
+}
+
 void Mesh::Clear()
 {
   nverts_ = 0;
@@ -101,7 +266,7 @@ int Mesh::CreateFaceGroup(const std::string &group_name)
   return 0;
 }
 
-void Mesh::ComputeNormals()
+void Mesh::ComputeNormals(int weighting)
 {
   if (!HasVertexPosition() || !HasFaceIndices())
     return;
@@ -113,44 +278,43 @@ void Mesh::ComputeNormals()
     AddVertexNormal();
   }
 
-  // initialize N
-  for (int i = 0; i < nverts; i++) {
-    SetVertexNormal(i, Vector(0, 0, 0));
-  }
-
-  // compute N
-  for (int i = 0; i < nfaces; i++) {
-    const Index3 face = GetFaceIndices(i);
-
-    const Vector P0 = GetVertexPosition(face.i0);
-    const Vector P1 = GetVertexPosition(face.i1);
-    const Vector P2 = GetVertexPosition(face.i2);
+  MeshNormalLoop loop;
+  loop.mesh = this;
+  loop.vertex_count = nverts;
+  loop.face_count = nfaces;
+  loop.weighting = weighting;
+  loop.face_normal.resize(nfaces);
+  loop.corner_weight.resize(3 * nfaces);
+  loop.vertex_normal = &N_[0];
 
-    const Vector Ng = TriComputeFaceNormal(P0, P1, P2);
-    const Vector N0 = GetVertexNormal(face.i0) + Ng;
-    const Vector N1 = GetVertexNormal(face.i1) + Ng;
-    const Vector N2 = GetVertexNormal(face.i2) + Ng;
+  // compute Ng
+  MtRunThreadLoop(&loop, compute_face_normal_chunk, MtGetMaxThreadCount(),
+      0, MtGetChunkCount(nfaces));
 
-    SetVertexNormal(face.i0, N0);
-    SetVertexNormal(face.i1, N1);
-    SetVertexNormal(face.i2, N2);
-  }
+  build_vertex_corner_list(this, &loop);
 
-  // normalize N
-  for (int i = 0; i < nverts; i++) {
-    Vector N = GetVertexNormal(i);
-    SetVertexNormal(i, Normalize(&N));
-  }
+  // compute N. each vertex gathers only its own corners
+  MtRunThreadLoop(&loop, gather_vertex_normal_chunk, MtGetMaxThreadCount(),
+      0, MtGetChunkCount(nverts));
 }
 
 void Mesh::ComputeBounds()
 {
+  const int NFACES = GetFaceCount();
+  const int NCHUNKS = MtGetChunkCount(NFACES);
+
+  MeshBoundsLoop loop;
+  loop.mesh = this;
+  loop.face_count = NFACES;
+  loop.chunk_bounds.resize(NCHUNKS);
+
+  MtRunThreadLoop(&loop, compute_bounds_chunk, MtGetMaxThreadCount(), 0, NCHUNKS);
+
+  // merge in chunk order so the result does not depend on threads
   BoxReverseInfinite(&bounds_);
 
-  for (int i = 0; i < GetFaceCount(); i++) {
-    Box tri_bounds;
-    GetPrimitiveBounds(i, &tri_bounds);
-    BoxAddBox(&bounds_, tri_bounds);
+  for (int i = 0; i < NCHUNKS; i++) {
+    BoxAddBox(&bounds_, loop.chunk_bounds[i]);
   }
 }
 
@@ -18,6 +18,13 @@
 
 namespace fj {
 
+// how face normals are weighted when they are summed at vertices
+enum {
+  NML_WEIGHT_UNIFORM = 0,
+  NML_WEIGHT_AREA,
+  NML_WEIGHT_ANGLE
+};
+
 class FJ_API Mesh : public PrimitiveSet {
 public:
   Mesh();
@@ -63,7 +70,7 @@ public:
 
   int CreateFaceGroup(const std::string &group_name);
 
-  void ComputeNormals();
+  void ComputeNormals(int weighting = NML_WEIGHT_UNIFORM);
   void ComputeBounds();
   void Clear();
 
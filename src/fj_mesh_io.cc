@@ -6,8 +6,10 @@
 #include "fj_vector.h"
 #include "fj_color.h"
 #include "fj_mesh.h"
+#include "fj_timer.h"
 
 #include <cstring>
+#include <cstdio>
 
 #define MSH_FILE_VERSION 1
 #define MSH_FILE_MAGIC "MESH"
@@ -521,7 +523,20 @@ int MshLoadFile(Mesh *mesh, const char *filename)
     }
   }
 
+  printf("# Preprocessing Mesh\n");
+  printf("#   Face Count: %d\n", mesh->GetFaceCount());
+  Timer timer;
+
+  timer.Start();
   mesh->ComputeBounds();
+  printf("#   Bounds:     %.3fs\n", timer.GetElapsedSeconds());
+
+  if (!mesh->HasVertexNormal()) {
+    timer.Start();
+    mesh->ComputeNormals();
+    printf("#   Normals:    %.3fs\n", timer.GetElapsedSeconds());
+  }
+  printf("\n");
 
   return 0;
 }
@@ -66,4 +66,17 @@ void MtCriticalSection(void *data, CriticalFunction critical)
   critical(data);
 }
 
+static const int CHUNK_SIZE = 4096;
+
+int MtGetChunkCount(int count)
+{
+  return (count + CHUNK_SIZE - 1) / CHUNK_SIZE;
+}
+
+void MtGetChunkRange(int chunk_id, int count, int *begin, int *end)
+{
+  *begin = chunk_id * CHUNK_SIZE;
+  *end = *begin + CHUNK_SIZE < count ? *begin + CHUNK_SIZE : count;
+}
+
 } // namespace xxx
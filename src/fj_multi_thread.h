@@ -41,6 +41,12 @@ extern ThreadStatus MtRunThreadLoop(void *data, ThreadFunction run_thread, int t
     int start, int end);
 extern void MtCriticalSection(void *data, CriticalFunction critical);
 
+// splits count items into chunks of a fixed size so that the work split
+// does not depend on the number of threads. run MtRunThreadLoop over
+// [0, MtGetChunkCount(count)) and get the items of each iteration
+extern int MtGetChunkCount(int count);
+extern void MtGetChunkRange(int chunk_id, int count, int *begin, int *end);
+
 } // namespace xxx
 
 #endif // FJ_XXX_H
@@ -5,6 +5,7 @@
 #include "fj_intersection.h"
 #include "fj_accelerator.h"
 #include "fj_object_group.h"
+#include "fj_ray_packet.h"
 #include "fj_interval.h"
 #include "fj_numeric.h"
 #include "fj_vector.h"
@@ -242,6 +243,65 @@ bool ObjectInstance::RayIntersect(const Ray &ray, Real time, Intersection *isect
   return true;
 }
 
+int ObjectInstance::RayIntersectPacket(const RayPacket &packet, int first,
+    Intersection *isects) const
+{
+  if (!IsSurface()) {
+    return 0;
+  }
+
+  // transform rays to object space. rays from first are moved to
+  // the head of the packet. transform is updated only when time changes
+  RayPacket packet_object_space;
+  Transform transform_interp;
+  Intersection *isects_object_space = isects + first;
+
+  packet_object_space.count = packet.count - first;
+  for (int i = 0; i < packet_object_space.count; i++) {
+    const Real time = packet.time[first + i];
+    Ray &ray_object_space = packet_object_space.ray[i];
+
+    if (i == 0 || time != packet_object_space.time[i - 1]) {
+      XfmLerpTransformSample(&transform_samples_, time, &transform_interp);
+    }
+    ray_object_space = packet.ray[first + i];
+    XfmTransformPointInverse(&transform_interp, &ray_object_space.orig);
+    XfmTransformVectorInverse(&transform_interp, &ray_object_space.dir);
+    packet_object_space.time[i] = time;
+  }
+  packet_object_space.ComputeFrustum();
+
+  const int hit_count = acc_->IntersectPacket(packet_object_space,
+      isects_object_space);
+  if (hit_count == 0) {
+    return 0;
+  }
+
+  // transform intersections back to world space
+  for (int i = 0; i < packet_object_space.count; i++) {
+    const Real time = packet_object_space.time[i];
+    Intersection *isect = &isects_object_space[i];
+
+    if (i == 0 || time != packet_object_space.time[i - 1]) {
+      XfmLerpTransformSample(&transform_samples_, time, &transform_interp);
+    }
+    if (isect->t_hit >= packet_object_space.ray[i].tmax) {
+      continue;
+    }
+
+    XfmTransformPoint(&transform_interp, &isect->P);
+    XfmTransformVector(&transform_interp, &isect->N);
+    Normalize(&isect->N);
+
+    XfmTransformVector(&transform_interp, &isect->dPdu);
+    XfmTransformVector(&transform_interp, &isect->dPdv);
+
+    isect->object = this;
+  }
+
+  return hit_count;
+}
+
 bool ObjectInstance::RayVolumeIntersect(const Ray &ray, Real time,
     Interval *interval) const
 {
@@ -296,6 +356,26 @@ bool ObjectInstance::GetVolumeSample(const Vector &point, Real time,
   return hit;
 }
 
+Real ObjectInstance::GetVolumeEmptySpan(const Vector &point, const Vector &dir,
+    Real time, Real *occupied) const
+{
+  if (!IsVolume()) {
+    *occupied = REAL_MAX;
+    return REAL_MAX;
+  }
+
+  Transform transform_interp;
+  XfmLerpTransformSample(&transform_samples_, time, &transform_interp);
+
+  // affine transforms keep the ray parameter
+  Vector point_in_objspace = point;
+  Vector dir_in_objspace = dir;
+  XfmTransformPointInverse(&transform_interp, &point_in_objspace);
+  XfmTransformVectorInverse(&transform_interp, &dir_in_objspace);
+
+  return volume_->GetEmptySpan(point_in_objspace, dir_in_objspace, occupied);
+}
+
 void ObjectInstance::update_bounds()
 {
   if (IsSurface()) {
@@ -14,6 +14,7 @@ namespace fj {
 
 class Intersection;
 class VolumeSample;
+class RayPacket;
 class Accelerator;
 class Interval;
 class Shader;
@@ -62,8 +63,13 @@ public:
 
   // sampling
   bool RayIntersect(const Ray &ray, Real time, Intersection *isect) const;
+  int RayIntersectPacket(const RayPacket &packet, int first,
+      Intersection *isects) const;
   bool RayVolumeIntersect(const Ray &ray, Real time, Interval *interval) const;
   bool GetVolumeSample(const Vector &point, Real time, VolumeSample *sample) const;
+  // see Volume::GetEmptySpan. distances are in units of dir in world space
+  Real GetVolumeEmptySpan(const Vector &point, const Vector &dir, Real time,
+      Real *occupied) const;
 
 private:
   void update_bounds();
@@ -61,6 +61,13 @@ bool ObjectSet::ray_intersect(Index prim_id, Real time,
   return obj->RayIntersect(ray, time, isect);
 }
 
+int ObjectSet::ray_intersect_packet(Index prim_id, const RayPacket &packet,
+    int first, Intersection *isects) const
+{
+  const ObjectInstance *obj = GetObject(prim_id);
+  return obj->RayIntersectPacket(packet, first, isects);
+}
+
 void ObjectSet::get_primitive_bounds(Index prim_id, Box *bounds) const
 {
   const ObjectInstance *obj = GetObject(prim_id);
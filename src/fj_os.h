@@ -13,6 +13,14 @@ extern void *OsDlsym(void *handle, const char *symbol);
 extern char *OsDlerror(void *handle);
 extern int OsDlclose(void *handle);
 
+// wall clock time in seconds with sub-second resolution.
+// only the difference between two calls is meaningful
+extern double OsGetWallClock(void);
+
+// size in bytes and last modification time in seconds of the file.
+// returns -1 when the file cannot be found
+extern int OsGetFileTime(const char *filename, double *size, double *modified_time);
+
 } // namespace xxx
 
 #endif /* FJ_XXX_H */
@@ -6,40 +6,120 @@
 #include "fj_numeric.h"
 #include "fj_ray.h"
 
+#include <algorithm>
+#include <utility>
 #include <cstdio>
+#include <cmath>
 
 #define ATTRIBUTE_LIST(ATTR) \
-  ATTR(Point, Vector,   P_,        Position) \
-  ATTR(Point, Vector,   velocity_, Velocity) \
-  ATTR(Point, Real,     radius_,   Radius)
+  ATTR(Point, P_,        Position) \
+  ATTR(Point, velocity_, Velocity)
 
 namespace fj {
 
-#define ATTR(Class, Type, Name, Label) \
+// number of spheres tested at once at the bottom of the hierarchy
+static const int PACKET_SIZE = 4;
+
+// a node at level l stands for this many points
+static inline int get_node_point_count(int level)
+{
+  int count = PACKET_SIZE;
+  for (int i = 0; i < level; i++) {
+    count *= PACKET_SIZE;
+  }
+  return count;
+}
+
+static inline int get_node_count(int point_count, int level)
+{
+  const int node_point_count = get_node_point_count(level);
+  return (point_count + node_point_count - 1) / node_point_count;
+}
+
+// returns the near and far roots of ray-sphere intersection
+static inline bool intersect_sphere(const Ray &ray, const Vector &center, Real radius,
+    Real *t_near, Real *t_far)
+{
+/*
+  X = o + t * d;
+  (X - center) * (X - center) = R * R;
+  |d|^2 * t^2 + 2 * d * (o - center) * t + |o - center|^2 - r^2 = 0;
+
+  t = (-d * (o - center) +- sqrt(D)) / |d|^2;
+  D = {d * (o - center)}^2 - |d|^2 * (|o - center|^2 - r^2);
+*/
+  const Vector orig_local = ray.orig - center;
+
+  const Real a = Dot(ray.dir, ray.dir);
+  const Real b = Dot(ray.dir, orig_local);
+  const Real c = Dot(orig_local, orig_local) - radius * radius;
+
+  const Real discriminant = b * b - a * c;
+  if (discriminant < 0.) {
+    return false;
+  }
+
+  const Real disc_sqrt = sqrt(discriminant);
+  *t_near = (-b - disc_sqrt) / a;
+  *t_far  = (-b + disc_sqrt) / a;
+
+  return true;
+}
+
+#define ATTR(Class, Name, Label) \
 void PointCloud::Add##Class##Label() \
 { \
-  Name.resize(Get##Class##Count()); \
+  for (int i = 0; i < 3; i++) { \
+    Name[i].resize(Get##Class##Count()); \
+  } \
 } \
-Type PointCloud::Get##Class##Label(int idx) const \
+Vector PointCloud::Get##Class##Label(int idx) const \
 { \
-  if (idx < 0 || idx >= static_cast<int>(Name.size())) { \
-    return Type(); \
+  if (idx < 0 || idx >= static_cast<int>(Name[0].size())) { \
+    return Vector(); \
   } \
-  return Name[idx]; \
+  return Vector(Name[0][idx], Name[1][idx], Name[2][idx]); \
 } \
-void PointCloud::Set##Class##Label(int idx, const Type &value) \
+void PointCloud::Set##Class##Label(int idx, const Vector &value) \
 { \
-  if (idx < 0 || idx >= static_cast<int>(Name.size())) \
+  if (idx < 0 || idx >= static_cast<int>(Name[0].size())) \
     return; \
-  Name[idx] = value; \
+  Name[0][idx] = static_cast<float>(value.x); \
+  Name[1][idx] = static_cast<float>(value.y); \
+  Name[2][idx] = static_cast<float>(value.z); \
 } \
 bool PointCloud::Has##Class##Label() const \
 { \
-  return !Name.empty(); \
+  return !Name[0].empty(); \
 }
   ATTRIBUTE_LIST(ATTR)
 #undef ATTR
 
+void PointCloud::AddPointRadius()
+{
+  radius_.resize(GetPointCount());
+}
+
+Real PointCloud::GetPointRadius(int idx) const
+{
+  if (idx < 0 || idx >= static_cast<int>(radius_.size())) {
+    return Real();
+  }
+  return radius_[idx];
+}
+
+void PointCloud::SetPointRadius(int idx, const Real &value)
+{
+  if (idx < 0 || idx >= static_cast<int>(radius_.size()))
+    return;
+  radius_[idx] = static_cast<float>(value);
+}
+
+bool PointCloud::HasPointRadius() const
+{
+  return !radius_.empty();
+}
+
 PointCloud::PointCloud() : point_count_(0)
 {
 }
@@ -63,59 +143,211 @@ const Box &PointCloud::GetBounds() const
   return bounds_;
 }
 
+template<typename T>
+static void reorder_array(std::vector<T> *array, const std::vector<std::pair<unsigned int, int> > &order)
+{
+  if (array->empty()) {
+    return;
+  }
+
+  std::vector<T> reordered(array->size());
+  for (size_t i = 0; i < order.size(); i++) {
+    reordered[i] = (*array)[order[i].second];
+  }
+  array->swap(reordered);
+}
+
+void PointCloud::PackPoints()
+{
+  const int NPOINTS = GetPointCount();
+
+  if (!HasPointPosition() || NPOINTS < 2) {
+    return;
+  }
+
+  Box center_bounds;
+  BoxReverseInfinite(&center_bounds);
+  for (int i = 0; i < NPOINTS; i++) {
+    BoxAddPoint(&center_bounds, GetPointPosition(i));
+  }
+
+  // sorting along a morton curve puts close points in the same packet
+  // in the order a bvh over the points would visit its leaves.
+  // ties are broken by the original index so the order is stable
+  std::vector<std::pair<unsigned int, int> > order(NPOINTS);
+  for (int i = 0; i < NPOINTS; i++) {
+    order[i] = std::make_pair(BoxMortonCode(center_bounds, GetPointPosition(i)), i);
+  }
+  std::sort(order.begin(), order.end());
+
+  for (int i = 0; i < 3; i++) {
+    reorder_array(&P_[i], order);
+    reorder_array(&velocity_[i], order);
+  }
+  reorder_array(&radius_, order);
+}
+
 void PointCloud::ComputeBounds()
 {
-  BoxReverseInfinite(&bounds_); 
+  build_hierarchy();
+
+  BoxReverseInfinite(&bounds_);
 
-  for (int i = 0; i < GetPointCount(); i++) {
-    Box ptbox;
-    GetPrimitiveBounds(i, &ptbox);
-    BoxAddBox(&bounds_, ptbox);
+  for (int i = 0; i < GetPrimitiveCount(); i++) {
+    Box packet_box;
+    GetPrimitiveBounds(i, &packet_box);
+    BoxAddBox(&bounds_, packet_box);
   }
 }
 
-bool PointCloud::ray_intersect(Index prim_id, Real time,
-    const Ray &ray, Intersection *isect) const
+size_t PointCloud::GetMemoryUsage() const
 {
-/*
-  X = o + t * d;
-  (X - center) * (X - center) = R * R;
-  |d|^2 * t^2 + 2 * d * (o - center) * t + |o - center|^2 - r^2 = 0;
+  size_t total = sizeof(*this);
 
-  t = (-d * (o - center) +- sqrt(D)) / |d|^2;
-  D = {d * (o - center)}^2 - |d|^2 * (|o - center|^2 - r^2);
-*/
-  const Vector P = GetPointPosition(prim_id);
-  const Vector velocity = GetPointVelocity(prim_id);
-  const double radius = GetPointRadius(prim_id);
+  for (int i = 0; i < 3; i++) {
+    total += P_[i].capacity() * sizeof(float);
+    total += velocity_[i].capacity() * sizeof(float);
+  }
+  total += radius_.capacity() * sizeof(float);
 
-  const Vector center = P + time * velocity;
-  const Vector orig_local = ray.orig - center;
+  for (int i = 0; i < NODE_LEVEL_COUNT; i++) {
+    total += nodes_[i].capacity() * sizeof(PointCloudNode);
+  }
 
-  const Real a = Dot(ray.dir, ray.dir);
-  const Real b = Dot(ray.dir, orig_local);
-  const Real c = Dot(orig_local, orig_local) - radius * radius;
+  return total;
+}
 
-  const Real discriminant = b * b - a * c;
-  if (discriminant < 0.) {
+// a node on the traversal stack with the range its bound sphere covers
+class NodeEntry {
+public:
+  int level;
+  int index;
+  Real t_near;
+  Real t_far;
+};
+
+static inline Vector node_center_at(const PointCloudNode &node, Real time)
+{
+  return Vector(
+      node.center[0] + time * node.velocity[0],
+      node.center[1] + time * node.velocity[1],
+      node.center[2] + time * node.velocity[2]);
+}
+
+static inline bool intersect_node(const PointCloudNode &node, Real time, const Ray &ray,
+    int level, int index, NodeEntry *entry)
+{
+  const Vector center = node_center_at(node, time);
+
+  if (!intersect_sphere(ray, center, node.bound_radius, &entry->t_near, &entry->t_far)) {
+    return false;
+  }
+  if (entry->t_far < ray.tmin || entry->t_near > ray.tmax) {
     return false;
   }
 
-  const Real disc_sqrt = sqrt(discriminant);
-  const Real t0 = -b - disc_sqrt;
-  const Real t1 = -b + disc_sqrt;
+  entry->level = level;
+  entry->index = index;
+  return true;
+}
+
+bool PointCloud::ray_intersect(Index prim_id, Real time,
+    const Ray &ray, Intersection *isect) const
+{
+  // nodes whose size is below the ray footprint at their distance are
+  // hit as one proxy sphere instead of descending to their points
+  const bool use_lod = ray.lod_footprint > 0;
+  const Real ray_length = Length(ray.dir);
+
+  Real t_hit = REAL_MAX;
+  int hit_id = -1;
+  Vector hit_center;
+
+  NodeEntry stack[NODE_LEVEL_COUNT * PACKET_SIZE];
+  int depth = 0;
+
+  if (intersect_node(nodes_[NODE_LEVEL_COUNT - 1][prim_id], time, ray,
+      NODE_LEVEL_COUNT - 1, prim_id, &stack[depth])) {
+    depth++;
+  }
+
+  while (depth > 0) {
+    depth--;
+    const NodeEntry entry = stack[depth];
+    const int level = entry.level;
+    const int index = entry.index;
+    const PointCloudNode &node = nodes_[level][index];
+
+    // a closer hit may have been found since this node was pushed
+    if (entry.t_near >= t_hit) {
+      continue;
+    }
+
+    if (use_lod) {
+      const Real t_center = Max(.5 * (entry.t_near + entry.t_far), ray.tmin);
+      const Real footprint = ray.lod_footprint * t_center * ray_length;
+
+      if (2 * node.bound_radius <= footprint) {
+        const Vector center = node_center_at(node, time);
+        Real t_proxy = 0;
+        Real t_proxy_far = 0;
+        if (intersect_sphere(ray, center, node.proxy_radius, &t_proxy, &t_proxy_far) &&
+            t_proxy >= ray.tmin && t_proxy <= ray.tmax && t_proxy < t_hit) {
+          t_hit = t_proxy;
+          hit_id = index * get_node_point_count(level);
+          hit_center = center;
+        }
+        continue;
+      }
+    }
+
+    if (level == 0) {
+      intersect_packet(index, time, ray, &t_hit, &hit_id, &hit_center);
+      continue;
+    }
+
+    // sort the children hit by the ray from far to near so that the
+    // nearest one is popped first and its hit culls the others
+    const int child_begin = index * PACKET_SIZE;
+    const int child_end = Min(child_begin + PACKET_SIZE,
+        static_cast<int>(nodes_[level - 1].size()));
+    NodeEntry children[PACKET_SIZE];
+    int child_count = 0;
+
+    for (int i = child_begin; i < child_end; i++) {
+      NodeEntry child;
+      if (!intersect_node(nodes_[level - 1][i], time, ray, level - 1, i, &child) ||
+          child.t_near >= t_hit) {
+        continue;
+      }
+      int j = child_count;
+      while (j > 0 && children[j - 1].t_near < child.t_near) {
+        children[j] = children[j - 1];
+        j--;
+      }
+      children[j] = child;
+      child_count++;
+    }
+
+    for (int i = 0; i < child_count; i++) {
+      stack[depth++] = children[i];
+    }
+  }
 
-  if (t1 <= 0.) {
+  if (hit_id < 0) {
     return false;
   }
-  const Real t_hit = (t1 <= 0.) ? t1 : t0;
+
+  if (isect == NULL) {
+    return true;
+  }
 
   isect->P = RayPointAt(ray, t_hit);
-  isect->N = isect->P - center;
+  isect->N = isect->P - hit_center;
   Normalize(&isect->N);
 
   isect->object = NULL;
-  isect->prim_id = prim_id;
+  isect->prim_id = hit_id;
   isect->t_hit = t_hit;
 
   return true;
@@ -123,17 +355,27 @@ bool PointCloud::ray_intersect(Index prim_id, Real time,
 
 void PointCloud::get_primitive_bounds(Index prim_id, Box *bounds) const
 {
-  const Vector P = GetPointPosition(prim_id);
-  const Vector velocity = GetPointVelocity(prim_id);
-  const Real radius = GetPointRadius(prim_id);
+  const int node_point_count = get_node_point_count(NODE_LEVEL_COUNT - 1);
+  const int begin = prim_id * node_point_count;
+  const int end = Min(begin + node_point_count, GetPointCount());
+
+  BoxReverseInfinite(bounds);
 
-  *bounds = Box(
-      P.x, P.y, P.z,
-      P.x, P.y, P.z);
+  for (int i = begin; i < end; i++) {
+    const Vector P = GetPointPosition(i);
+    const Vector velocity = GetPointVelocity(i);
+    const Real radius = GetPointRadius(i);
 
-  BoxAddPoint(bounds, P + velocity);
-  BoxExpand(bounds, radius);
+    Box point_bounds(
+        P.x, P.y, P.z,
+        P.x, P.y, P.z);
+
+    BoxAddPoint(&point_bounds, P + velocity);
+    BoxExpand(&point_bounds, radius);
+    BoxAddBox(bounds, point_bounds);
+  }
 }
+
 void PointCloud::get_bounds(Box *bounds) const
 {
   *bounds = GetBounds();
@@ -141,7 +383,141 @@ void PointCloud::get_bounds(Box *bounds) const
 
 Index PointCloud::get_primitive_count() const
 {
-  return GetPointCount();
+  return get_node_count(GetPointCount(), NODE_LEVEL_COUNT - 1);
+}
+
+bool PointCloud::intersect_packet(int packet_id, Real time, const Ray &ray,
+    Real *t_hit, int *hit_id, Vector *hit_center) const
+{
+  const int begin = packet_id * PACKET_SIZE;
+  const int count = Min(PACKET_SIZE, GetPointCount() - begin);
+  const bool has_velocity = HasPointVelocity();
+
+  // load the packet
+  Real center[3][PACKET_SIZE];
+  Real radius[PACKET_SIZE];
+  for (int k = 0; k < count; k++) {
+    for (int i = 0; i < 3; i++) {
+      center[i][k] = P_[i][begin + k];
+      if (has_velocity) {
+        center[i][k] += time * velocity_[i][begin + k];
+      }
+    }
+    radius[k] = radius_[begin + k];
+  }
+
+  const Real a = Dot(ray.dir, ray.dir);
+  int hit_k = -1;
+
+  for (int k = 0; k < count; k++) {
+    const Real ox = ray.orig.x - center[0][k];
+    const Real oy = ray.orig.y - center[1][k];
+    const Real oz = ray.orig.z - center[2][k];
+
+    const Real b = ray.dir.x * ox + ray.dir.y * oy + ray.dir.z * oz;
+    const Real c = ox * ox + oy * oy + oz * oz - radius[k] * radius[k];
+
+    const Real discriminant = b * b - a * c;
+    if (discriminant < 0.) {
+      continue;
+    }
+
+    const Real disc_sqrt = sqrt(discriminant);
+    const Real t0 = (-b - disc_sqrt) / a;
+    const Real t1 = (-b + disc_sqrt) / a;
+
+    if (t1 <= 0.) {
+      continue;
+    }
+    // the near root is the hit of each sphere. accelerators would
+    // discard it outside of [tmin, tmax], so skip it here the same way
+    if (t0 < ray.tmin || t0 > ray.tmax || t0 >= *t_hit) {
+      continue;
+    }
+    hit_k = k;
+    *t_hit = t0;
+  }
+
+  if (hit_k < 0) {
+    return false;
+  }
+
+  *hit_id = begin + hit_k;
+  *hit_center = Vector(center[0][hit_k], center[1][hit_k], center[2][hit_k]);
+
+  return true;
+}
+
+// a node is centered at the average of its children weighted by their
+// cross section area, and the proxy sphere keeps that total area
+void PointCloud::build_hierarchy()
+{
+  const int NPOINTS = GetPointCount();
+  const bool has_velocity = HasPointVelocity();
+
+  for (int level = 0; level < NODE_LEVEL_COUNT; level++) {
+    std::vector<PointCloudNode> &nodes = nodes_[level];
+    nodes.clear();
+    nodes.resize(get_node_count(NPOINTS, level));
+
+    const int child_count = level == 0 ? NPOINTS : nodes_[level - 1].size();
+
+    for (int i = 0; i < static_cast<int>(nodes.size()); i++) {
+      const int begin = i * PACKET_SIZE;
+      const int end = Min(begin + PACKET_SIZE, child_count);
+
+      Vector child_center[PACKET_SIZE];
+      Vector child_velocity[PACKET_SIZE];
+      Real child_bound[PACKET_SIZE];
+      Real child_proxy[PACKET_SIZE];
+
+      for (int j = begin; j < end; j++) {
+        const int k = j - begin;
+        if (level == 0) {
+          child_center[k] = GetPointPosition(j);
+          child_velocity[k] = has_velocity ? GetPointVelocity(j) : Vector();
+          child_bound[k] = GetPointRadius(j);
+          child_proxy[k] = GetPointRadius(j);
+        } else {
+          const PointCloudNode &child = nodes_[level - 1][j];
+          child_center[k] = Vector(child.center[0], child.center[1], child.center[2]);
+          child_velocity[k] = Vector(child.velocity[0], child.velocity[1], child.velocity[2]);
+          child_bound[k] = child.bound_radius;
+          child_proxy[k] = child.proxy_radius;
+        }
+      }
+
+      const int count = end - begin;
+      Vector center;
+      Vector velocity;
+      Real total_weight = 0;
+      for (int k = 0; k < count; k++) {
+        total_weight += child_proxy[k] * child_proxy[k];
+      }
+      for (int k = 0; k < count; k++) {
+        const Real weight = total_weight > 0 ?
+            child_proxy[k] * child_proxy[k] / total_weight : 1. / count;
+        center += weight * child_center[k];
+        velocity += weight * child_velocity[k];
+      }
+
+      Real bound = 0;
+      for (int k = 0; k < count; k++) {
+        const Real reach = Length(child_center[k] - center) + child_bound[k] +
+            Length(child_velocity[k] - velocity);
+        bound = Max(bound, reach);
+      }
+
+      PointCloudNode &node = nodes[i];
+      for (int j = 0; j < 3; j++) {
+        node.center[j] = static_cast<float>(center[j]);
+        node.velocity[j] = static_cast<float>(velocity[j]);
+      }
+      // round up so that float centers do not cut off children
+      node.bound_radius = static_cast<float>(bound * (1 + 1e-5) + 1e-6);
+      node.proxy_radius = static_cast<float>(Min(sqrt(total_weight), bound));
+    }
+  }
 }
 
 } // namespace xxx
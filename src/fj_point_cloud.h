@@ -10,9 +10,27 @@
 #include "fj_types.h"
 #include "fj_box.h"
 #include <vector>
+#include <cstddef>
 
 namespace fj {
 
+// an aggregated sphere standing for a group of points
+class PointCloudNode {
+public:
+  PointCloudNode() : bound_radius(0), proxy_radius(0)
+  {
+    center[0] = center[1] = center[2] = 0;
+    velocity[0] = velocity[1] = velocity[2] = 0;
+  }
+  ~PointCloudNode() {}
+
+public:
+  float center[3];
+  float velocity[3];
+  float bound_radius;
+  float proxy_radius;
+};
+
 class FJ_API PointCloud : public PrimitiveSet {
 public:
   PointCloud();
@@ -38,8 +56,14 @@ public:
   bool HasPointVelocity() const;
   bool HasPointRadius() const;
 
+  // reorders points so that spatial neighbours share a packet.
+  // point indices change. call before ComputeBounds()
+  void PackPoints();
+  // also builds the node hierarchy
   void ComputeBounds();
 
+  size_t GetMemoryUsage() const;
+
 private:
   virtual bool ray_intersect(Index prim_id, Real time,
       const Ray &ray, Intersection *isect) const;
@@ -47,11 +71,22 @@ private:
   virtual void get_bounds(Box *bounds) const;
   virtual Index get_primitive_count() const;
 
+  bool intersect_packet(int packet_id, Real time, const Ray &ray,
+      Real *t_hit, int *hit_id, Vector *hit_center) const;
+  void build_hierarchy();
+
+  // points are stored as float arrays per component and every
+  // PACKET_SIZE consecutive points are one primitive for accelerators
   int point_count_;
-  std::vector<Vector> P_;
-  std::vector<Vector> velocity_;
-  std::vector<Real> radius_;
+  std::vector<float> P_[3];
+  std::vector<float> velocity_[3];
+  std::vector<float> radius_;
   Box bounds_;
+
+  // level 0 nodes stand for packets and each node above stands for
+  // PACKET_SIZE nodes below. nodes at the top level are the primitives
+  enum { NODE_LEVEL_COUNT = 4 };
+  std::vector<PointCloudNode> nodes_[NODE_LEVEL_COUNT];
 };
 
 } // namespace xxx
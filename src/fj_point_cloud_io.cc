@@ -4,10 +4,12 @@
 #include "fj_point_cloud_io.h"
 #include "fj_point_cloud.h"
 #include "fj_vector.h"
+#include "fj_timer.h"
 #include "fj_io.h"
 
 #include <vector>
 #include <cstddef>
+#include <cstdio>
 
 #define PTC_FILE_VERSION 1
 #define PTC_FILE_MAGIC "PTCD"
@@ -182,11 +184,22 @@ int PtcLoadFile(PointCloud *ptc, const char *filename)
 
   PtcCloseInputFile(in);
 
+  // velocity is stored only when points move
+  bool has_velocity = false;
+  for (int i = 0; i < point_count; i++) {
+    if (velocity[i].x != 0 || velocity[i].y != 0 || velocity[i].z != 0) {
+      has_velocity = true;
+      break;
+    }
+  }
+
   // copy data to ptc
   ptc->SetPointCount(point_count);
   ptc->AddPointPosition();
-  ptc->AddPointVelocity();
   ptc->AddPointRadius();
+  if (has_velocity) {
+    ptc->AddPointVelocity();
+  }
 
   for (int i = 0; i < ptc->GetPointCount(); i++) {
     ptc->SetPointPosition(i, P[i]);
@@ -194,7 +207,22 @@ int PtcLoadFile(PointCloud *ptc, const char *filename)
     ptc->SetPointRadius(i, radius[i]);
   }
 
+  printf("# Preprocessing Point Cloud\n");
+  printf("#   Point Count: %d\n", point_count);
+  Timer timer;
+
+  timer.Start();
+  ptc->PackPoints();
+  printf("#   Packing:     %.3fs\n", timer.GetElapsedSeconds());
+
+  timer.Start();
   ptc->ComputeBounds();
+  printf("#   Bounds:      %.3fs\n", timer.GetElapsedSeconds());
+
+  const size_t memory = ptc->GetMemoryUsage();
+  printf("#   Memory:      %.1fMB (%.1f bytes/point)\n",
+      memory / (1024. * 1024.), point_count > 0 ? memory / (double) point_count : 0.);
+  printf("\n");
 
   return 0;
 }
@@ -0,0 +1,27 @@
+// Copyright (c) 2011-2014 Hiroshi Tsubokawa
+// See LICENSE and README
+
+#include "fj_primitive_set.h"
+#include "fj_intersection.h"
+#include "fj_ray_packet.h"
+
+namespace fj {
+
+int PrimitiveSet::ray_intersect_packet(Index prim_id, const RayPacket &packet,
+    int first, Intersection *isects) const
+{
+  int hit_count = 0;
+
+  for (int i = first; i < packet.count; i++) {
+    Intersection isect;
+
+    if (ray_intersect(prim_id, packet.time[i], packet.ray[i], &isect) &&
+        isect.t_hit < packet.ray[i].tmax) {
+      isects[i] = isect;
+      hit_count++;
+    }
+  }
+  return hit_count;
+}
+
+} // namespace xxx
@@ -10,6 +10,7 @@
 namespace fj {
 
 class Intersection;
+class RayPacket;
 class Box;
 class Ray;
 
@@ -24,6 +25,14 @@ public:
     return ray_intersect(prim_id, time, ray, isect);
   }
 
+  // intersects rays from first to the end of packet. isects[i] is only
+  // overwritten when ray i hits closer than its tmax. returns hit count
+  int RayIntersectPacket(Index prim_id, const RayPacket &packet, int first,
+      Intersection *isects) const
+  {
+    return ray_intersect_packet(prim_id, packet, first, isects);
+  }
+
   void GetPrimitiveBounds(Index prim_id, Box *bounds) const
   {
     get_primitive_bounds(prim_id, bounds);
@@ -45,6 +54,10 @@ private:
   virtual void get_primitive_bounds(Index prim_id, Box *bounds) const = 0;
   virtual void get_bounds(Box *bounds) const = 0;
   virtual Index get_primitive_count() const = 0;
+
+  // traces rays one by one unless overridden
+  virtual int ray_intersect_packet(Index prim_id, const RayPacket &packet,
+      int first, Intersection *isects) const;
 };
 
 } // namespace xxx
@@ -6,6 +6,7 @@ See LICENSE and README
 #include "fj_random.h"
 #include "fj_vector.h"
 #include <limits.h>
+#include <cassert>
 
 namespace fj {
 
@@ -17,6 +18,9 @@ XorShift::XorShift(unsigned int seed)
   }
 }
 
+static uint32_t reverse_bits(uint32_t x);
+static uint32_t nested_uniform_scramble(uint32_t x, uint32_t seed);
+
 void XorInit(XorShift *xr)
 {
   xr->state[0] = 123456789;
@@ -25,6 +29,17 @@ void XorInit(XorShift *xr)
   xr->state[3] = 88675123;
 }
 
+uint32_t HashInteger(uint32_t key)
+{
+  // finalizer of murmur3
+  key ^= key >> 16;
+  key *= 0x85ebca6b;
+  key ^= key >> 13;
+  key *= 0xc2b2ae35;
+  key ^= key >> 16;
+  return key;
+}
+
 uint32_t XorNextInteger(XorShift *xr)
 {
   uint32_t *st = xr->state;
@@ -148,4 +163,85 @@ double XorGaussianRand(XorShift *xr)
     return P.x * sqrt(-2 * log(dot) / dot);
 }
 
+void ScrambledSobol2D(uint32_t index, uint32_t seed_x, uint32_t seed_y,
+    double *x, double *y)
+{
+  // first dimension is van der Corput, second is the Sobol generator
+  // matrix of Pascal's triangle
+  uint32_t sobol_x = reverse_bits(index);
+  uint32_t sobol_y = 0;
+  for (uint32_t v = 1U << 31; index != 0; index >>= 1, v ^= v >> 1) {
+    if (index & 1) {
+      sobol_y ^= v;
+    }
+  }
+
+  sobol_x = nested_uniform_scramble(sobol_x, seed_x);
+  sobol_y = nested_uniform_scramble(sobol_y, seed_y);
+
+  *x = sobol_x * (1. / 4294967296.);
+  *y = sobol_y * (1. / 4294967296.);
+}
+
+uint32_t PermuteIndex(uint32_t index, uint32_t count, uint32_t seed)
+{
+  assert(count > 0);
+  assert(index < count);
+
+  // hashes in the smallest power of two range over count and
+  // cycles until the index falls in the count
+  uint32_t w = count - 1;
+  w |= w >> 1;
+  w |= w >> 2;
+  w |= w >> 4;
+  w |= w >> 8;
+  w |= w >> 16;
+
+  uint32_t i = index;
+  do {
+    i ^= seed;
+    i *= 0xe170893dU;
+    i ^= seed >> 16;
+    i ^= (i & w) >> 4;
+    i ^= seed >> 8;
+    i *= 0x0929eb3fU;
+    i ^= seed >> 23;
+    i ^= (i & w) >> 1;
+    i *= 1 | seed >> 27;
+    i *= 0x6935fa69U;
+    i ^= (i & w) >> 11;
+    i *= 0x74dcb303U;
+    i ^= (i & w) >> 2;
+    i *= 0x9e501cc3U;
+    i ^= (i & w) >> 2;
+    i *= 0xc860a3dfU;
+    i &= w;
+    i ^= i >> 5;
+  } while (i >= count);
+
+  return (i + seed) % count;
+}
+
+static uint32_t reverse_bits(uint32_t x)
+{
+  x = ((x >> 1) & 0x55555555U) | ((x & 0x55555555U) << 1);
+  x = ((x >> 2) & 0x33333333U) | ((x & 0x33333333U) << 2);
+  x = ((x >> 4) & 0x0F0F0F0FU) | ((x & 0x0F0F0F0FU) << 4);
+  x = ((x >> 8) & 0x00FF00FFU) | ((x & 0x00FF00FFU) << 8);
+  return (x >> 16) | (x << 16);
+}
+
+// Laine-Karras hash. each bit is flipped depending only on the bits
+// above it, which is what Owen scrambling does
+static uint32_t nested_uniform_scramble(uint32_t x, uint32_t seed)
+{
+  x = reverse_bits(x);
+  x += seed;
+  x ^= x * 0x6c50b47cU;
+  x ^= x * 0xb82f1e52U;
+  x ^= x * 0xc7afe638U;
+  x ^= x * 0x8d22f6e6U;
+  return reverse_bits(x);
+}
+
 } // namespace xxx
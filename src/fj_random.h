@@ -38,6 +38,19 @@ FJ_API void XorGaussianDiskRand(XorShift *xr, Vector2 *out_position);
 
 FJ_API double XorGaussianRand(XorShift *xr);
 
+// spreads close keys over the whole range. good for seeds from positions
+FJ_API uint32_t HashInteger(uint32_t key);
+
+// Owen scrambled (0,2)-sequence. the first 2^m points of any scramble
+// have one point in every elementary interval of area 2^-m. draw the
+// seeds from a per sample rng to decorrelate the pattern between pixels
+FJ_API void ScrambledSobol2D(uint32_t index, uint32_t seed_x, uint32_t seed_y,
+    double *x, double *y);
+
+// random permutation of [0, count) chosen by the seed. returns the
+// position of index. Correlated Multi-Jittered Sampling, Andrew Kensler
+FJ_API uint32_t PermuteIndex(uint32_t index, uint32_t count, uint32_t seed);
+
 } // namespace xxx
 
 #endif // FJ_XXX_H
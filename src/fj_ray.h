@@ -13,7 +13,7 @@ namespace fj {
 
 class Ray {
 public:
-  Ray() : orig(), dir(0, 0, 1), tmin(.001), tmax(1000) {}
+  Ray() : orig(), dir(0, 0, 1), tmin(.001), tmax(1000), lod_footprint(0) {}
   ~Ray() {}
 
   Vector orig;
@@ -21,6 +21,10 @@ public:
 
   Real tmin;
   Real tmax;
+
+  // width of the ray per unit distance. geometry smaller than this
+  // may be replaced by an aggregated proxy. 0 means full detail
+  Real lod_footprint;
 };
 
 inline Vector RayPointAt(const Ray &ray, Real t)
@@ -0,0 +1,95 @@
+// Copyright (c) 2011-2014 Hiroshi Tsubokawa
+// See LICENSE and README
+
+#include "fj_ray_packet.h"
+#include "fj_numeric.h"
+#include "fj_box.h"
+
+namespace fj {
+
+static int get_sign(Real x)
+{
+  if (x > 0)
+    return 1;
+  else if (x < 0)
+    return -1;
+  else
+    return 0;
+}
+
+void RayPacket::ComputeFrustum()
+{
+  has_frustum = false;
+
+  if (count == 0) {
+    return;
+  }
+
+  const Ray &first = ray[0];
+  const int sign[3] = {
+      get_sign(first.dir[0]),
+      get_sign(first.dir[1]),
+      get_sign(first.dir[2])};
+
+  if (sign[0] == 0 || sign[1] == 0 || sign[2] == 0) {
+    return;
+  }
+
+  origin = first.orig;
+  tmin = first.tmin;
+  tmax = first.tmax;
+  for (int k = 0; k < 3; k++) {
+    inv_dir_min[k] = 1 / first.dir[k];
+    inv_dir_max[k] = inv_dir_min[k];
+  }
+
+  for (int i = 1; i < count; i++) {
+    const Ray &r = ray[i];
+
+    if (r.orig.x != origin.x || r.orig.y != origin.y || r.orig.z != origin.z) {
+      return;
+    }
+
+    for (int k = 0; k < 3; k++) {
+      if (get_sign(r.dir[k]) != sign[k]) {
+        return;
+      }
+      const Real inv_dir = 1 / r.dir[k];
+      inv_dir_min[k] = Min(inv_dir_min[k], inv_dir);
+      inv_dir_max[k] = Max(inv_dir_max[k], inv_dir);
+    }
+    tmin = Min(tmin, r.tmin);
+    tmax = Max(tmax, r.tmax);
+  }
+
+  has_frustum = true;
+}
+
+bool RayPacketMayHitBox(const RayPacket &packet, const Box &box)
+{
+  if (!packet.has_frustum) {
+    return true;
+  }
+
+  Real t_near = packet.tmin;
+  Real t_far = packet.tmax;
+
+  // interval arithmetic over the range of inverse directions.
+  // t_near and t_far bound the entry and exit of every ray in the packet
+  for (int k = 0; k < 3; k++) {
+    const Real lo = box.min[k] - packet.origin[k];
+    const Real hi = box.max[k] - packet.origin[k];
+    const Real entry = packet.inv_dir_min[k] > 0 ? lo : hi;
+    const Real exit  = packet.inv_dir_min[k] > 0 ? hi : lo;
+
+    const Real entry_min = Min(entry * packet.inv_dir_min[k], entry * packet.inv_dir_max[k]);
+    const Real exit_max  = Max(exit  * packet.inv_dir_min[k], exit  * packet.inv_dir_max[k]);
+
+    t_near = Max(t_near, entry_min);
+    t_far  = Min(t_far,  exit_max);
+  }
+
+  return t_near <= t_far;
+}
+
+} // namespace xxx
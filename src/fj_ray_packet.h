@@ -0,0 +1,55 @@
+// Copyright (c) 2011-2014 Hiroshi Tsubokawa
+// See LICENSE and README
+
+#ifndef FJ_RAY_PACKET_H
+#define FJ_RAY_PACKET_H
+
+#include "fj_compatibility.h"
+#include "fj_vector.h"
+#include "fj_types.h"
+#include "fj_ray.h"
+
+namespace fj {
+
+class Box;
+
+enum { MAX_PACKET_RAY_COUNT = 64 };
+
+// a group of coherent rays traversed together. each ray has its own time
+class RayPacket {
+public:
+  RayPacket() :
+      count(0),
+      has_frustum(false),
+      origin(),
+      inv_dir_min(),
+      inv_dir_max(),
+      tmin(0),
+      tmax(0)
+  {}
+  ~RayPacket() {}
+
+  // call after rays are set
+  void ComputeFrustum();
+
+  int count;
+  Ray ray[MAX_PACKET_RAY_COUNT];
+  Real time[MAX_PACKET_RAY_COUNT];
+
+  // conservative bounds of all rays used for culling boxes at once.
+  // only valid when rays share the origin and the signs of directions
+  bool has_frustum;
+  Vector origin;
+  Vector inv_dir_min;
+  Vector inv_dir_max;
+  Real tmin;
+  Real tmax;
+};
+
+// returns false if none of the rays can hit the box.
+// true does not mean any of them does.
+FJ_API bool RayPacketMayHitBox(const RayPacket &packet, const Box &box);
+
+} // namespace xxx
+
+#endif // FJ_XXX_H
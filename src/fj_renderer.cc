@@ -3,13 +3,19 @@
 
 #include "fj_renderer.h"
 #include "fj_multi_thread.h"
+#include "fj_memory_arena.h"
+#include "fj_intersection.h"
+#include "fj_object_instance.h"
+#include "fj_ray_packet.h"
 #include "fj_framebuffer.h"
 #include "fj_rectangle.h"
 #include "fj_property.h"
 #include "fj_protocol.h"
 #include "fj_numeric.h"
+#include "fj_random.h"
 #include "fj_sampler.h"
 #include "fj_shading.h"
+#include "fj_shader.h"
 #include "fj_camera.h"
 #include "fj_filter.h"
 #include "fj_socket.h"
@@ -19,16 +25,23 @@
 #include "fj_ray.h"
 #include "fj_box.h"
 
+#include <algorithm>
 #include <cassert>
 #include <cstring>
 #include <cstdio>
 #include <cfloat>
+#include <vector>
 #include <ctime>
 
 #include <cerrno>
 
 namespace fj {
 
+// packets are square blocks of samples
+static const int MAX_PACKET_BLOCK_SIZE = 8;
+// hits sharing a shader are evaluated in chunks of this size at most
+static const int MAX_SHADER_BATCH_SIZE = 256;
+
 static bool is_socket_ready = false;
 static int renderer_instance_count = 0;
 
@@ -409,12 +422,28 @@ Renderer::Renderer()
   SetShadowEnable(1);
   SetMaxReflectDepth(3);
   SetMaxRefractDepth(3);
+  SetRouletteThreshold(0);
 
   SetRaymarchStep(.05);
   SetRaymarchShadowStep(.1);
   SetRaymarchReflectStep(.1);
   SetRaymarchRefractStep(.1);
 
+  SetLODThreshold(0);
+  SetRayPacketSize(0);
+  SetSortedShadingEnable(0);
+  SetShaderBatchEnable(0);
+  SetLightSampleBudget(0);
+  SetDomeSampleBudget(0);
+  SetAdaptiveThreshold(0);
+  SetAdaptiveMaxPixelSamples(8, 8);
+  SetSampleCountOutput(0);
+  SetProgressive(0);
+  SetSampleSplatting(1);
+  SetFilterType(FLT_GAUSSIAN);
+  SetSamplerType(SMP_JITTERED);
+  SetSampleSeed(0);
+
   SetUseMaxThread(0);
   SetThreadCount(1);
 
@@ -550,6 +579,12 @@ void Renderer::SetMaxRefractDepth(int max_depth)
   max_refract_depth_ = max_depth;
 }
 
+void Renderer::SetRouletteThreshold(float threshold)
+{
+  assert(threshold >= 0);
+  roulette_threshold_ = threshold;
+}
+
 void Renderer::SetRaymarchStep(double step)
 {
   assert(step > 0);
@@ -574,6 +609,83 @@ void Renderer::SetRaymarchRefractStep(double step)
   raymarch_refract_step_ = Max(step, .001);
 }
 
+void Renderer::SetLODThreshold(double pixel_size)
+{
+  assert(pixel_size >= 0);
+  lod_threshold_ = Max(pixel_size, 0.);
+}
+
+void Renderer::SetRayPacketSize(int packet_size)
+{
+  assert(packet_size >= 0);
+  ray_packet_size_ = (int) Clamp(packet_size, 1, MAX_PACKET_BLOCK_SIZE);
+}
+
+void Renderer::SetSortedShadingEnable(int enable)
+{
+  assert(enable == 0 || enable == 1);
+  sorted_shading_ = enable;
+}
+
+void Renderer::SetShaderBatchEnable(int enable)
+{
+  assert(enable == 0 || enable == 1);
+  shader_batch_ = enable;
+}
+
+void Renderer::SetLightSampleBudget(int budget)
+{
+  light_sample_budget_ = Max(budget, 0);
+}
+
+void Renderer::SetDomeSampleBudget(int budget)
+{
+  dome_sample_budget_ = Max(budget, 0);
+}
+
+void Renderer::SetAdaptiveThreshold(float threshold)
+{
+  adaptive_threshold_ = Max(threshold, 0.);
+}
+
+void Renderer::SetAdaptiveMaxPixelSamples(int max_xrate, int max_yrate)
+{
+  adaptive_max_pixelsamples_[0] = Max(max_xrate, 1);
+  adaptive_max_pixelsamples_[1] = Max(max_yrate, 1);
+}
+
+void Renderer::SetSampleCountOutput(int enable)
+{
+  sample_count_output_ = (enable != 0);
+}
+
+void Renderer::SetProgressive(int enable)
+{
+  progressive_ = (enable != 0);
+}
+
+void Renderer::SetSampleSplatting(int enable)
+{
+  sample_splatting_ = (enable != 0);
+}
+
+void Renderer::SetFilterType(int filter_type)
+{
+  assert(filter_type >= FLT_BOX && filter_type <= FLT_BLACKMAN_HARRIS);
+  filter_type_ = filter_type;
+}
+
+void Renderer::SetSamplerType(int sampler_type)
+{
+  assert(sampler_type == SMP_JITTERED || sampler_type == SMP_SOBOL);
+  sampler_type_ = sampler_type;
+}
+
+void Renderer::SetSampleSeed(int seed)
+{
+  sample_seed_ = seed;
+}
+
 void Renderer::SetCamera(Camera *cam)
 {
   assert(cam != NULL);
@@ -672,6 +784,96 @@ int Renderer::RenderScene()
   return 0;
 }
 
+const RayCounts &Renderer::GetRayCounts() const
+{
+  return ray_counts_;
+}
+
+static Color4 normalize_pixel(const Color4 &pixel, float wgt_sum);
+
+// filtered sums of colors and weights splatted by each tile over the tile
+// and its margins. sums of a pixel are added up from all tiles around in
+// the order of tiles so that images do not change with thread count
+class SplatBuffer {
+public:
+  SplatBuffer() {}
+  ~SplatBuffer() {}
+
+  void Init(const Tiler *tiler, int xmargin, int ymargin)
+  {
+    const int tile_count = tiler->GetTileCount();
+    tile_splats_.resize(tile_count);
+    regions_.resize(tile_count);
+
+    for (int i = 0; i < tile_count; i++) {
+      const Tile *tile = tiler->GetTile(i);
+      Rectangle &region = regions_[i];
+      region.xmin = tile->xmin - xmargin;
+      region.ymin = tile->ymin - ymargin;
+      region.xmax = tile->xmax + xmargin;
+      region.ymax = tile->ymax + ymargin;
+      tile_splats_[i].Resize(SizeX(region), SizeY(region), 5);
+    }
+  }
+
+  float *GetWritable(int tile_id, int x, int y)
+  {
+    const Rectangle &region = regions_[tile_id];
+    return tile_splats_[tile_id].GetWritable(x - region.xmin, y - region.ymin, 0);
+  }
+
+  const Rectangle &GetRegion(int tile_id) const
+  {
+    return regions_[tile_id];
+  }
+
+  void Resolve(const Tile &tile, FrameBuffer *fb) const
+  {
+    std::vector<int> overlaps;
+    for (size_t i = 0; i < regions_.size(); i++) {
+      const Rectangle &region = regions_[i];
+      if (region.xmin < tile.xmax && tile.xmin < region.xmax &&
+          region.ymin < tile.ymax && tile.ymin < region.ymax) {
+        overlaps.push_back(i);
+      }
+    }
+
+    for (int y = tile.ymin; y < tile.ymax; y++) {
+      for (int x = tile.xmin; x < tile.xmax; x++) {
+        float sum[5] = {0, 0, 0, 0, 0};
+
+        for (size_t i = 0; i < overlaps.size(); i++) {
+          const Rectangle &region = regions_[overlaps[i]];
+          const float *splat = tile_splats_[overlaps[i]].GetReadOnly(
+              x - region.xmin, y - region.ymin, 0);
+          if (splat == NULL) {
+            continue;
+          }
+          for (int k = 0; k < 5; k++) {
+            sum[k] += splat[k];
+          }
+        }
+        fb->SetColor(x, y, normalize_pixel(Color4(sum[0], sum[1], sum[2], sum[3]), sum[4]));
+      }
+    }
+  }
+
+private:
+  std::vector<FrameBuffer> tile_splats_;
+  std::vector<Rectangle> regions_;
+};
+
+class ResolveJob {
+public:
+  ResolveJob(const SplatBuffer *splats, const Tiler *tiler, FrameBuffer *fb) :
+      splats(splats), tiler(tiler), fb(fb) {}
+  ~ResolveJob() {}
+
+  const SplatBuffer *splats;
+  const Tiler *tiler;
+  FrameBuffer *fb;
+};
+
 // TODO TMP REMOVE LATER
 class Worker;
 static Worker *new_worker_list(int worker_count,
@@ -680,6 +882,13 @@ static int render_frame_start(Renderer *renderer, const Tiler *tiler);
 static ThreadStatus render_tile(void *data, const ThreadContext *context);
 static void render_frame_done(Renderer *renderer, const Tiler *tiler);
 static void free_worker_list(Worker *worker_list, int worker_count);
+static double count_spent_samples(const Worker *worker_list, int worker_count);
+static RayCounts count_rays(const Worker *worker_list, int worker_count);
+static const char *filter_type_name(int filter_type);
+static const char *sampler_type_name(int sampler_type);
+static void set_pass(Worker *worker_list, int worker_count,
+    FrameBuffer *accumulation, SplatBuffer *splats, int pass);
+static ThreadStatus resolve_tile(void *data, const ThreadContext *context);
 
 int Renderer::prepare_rendering()
 {
@@ -722,7 +931,13 @@ int Renderer::execute_rendering()
   const float xfilterwidth = filterwidth_[0];
   const float yfilterwidth = filterwidth_[1];
 
+  int pass_count = 1;
+  int pass = 0;
+  FrameBuffer accumulation;
+  SplatBuffer splats;
+
   int err = 0;
+  Timer timer;
 
   // Frame ID
   frame_id_ = generate_frame_id();
@@ -741,9 +956,11 @@ int Renderer::execute_rendering()
   }
 
   // FrameProgress
+  // filter width 1 leaves out the margins which splatting does not trace
   init_frame_progress(&frame_progress_, &tiler,
       xpixelsamples, ypixelsamples,
-      xfilterwidth, yfilterwidth);
+      sample_splatting_ ? 1 : xfilterwidth,
+      sample_splatting_ ? 1 : yfilterwidth);
 
   // Run sampling
   err = render_frame_start(this, &tiler);
@@ -752,10 +969,78 @@ int Renderer::execute_rendering()
     goto cleanup_and_exit;
   }
 
-  MtRunThreadLoop(worker_list, render_tile, thread_count, 0, tile_count);
+  // each pass renders all tiles with a stratum of the pixel samples
+  if (progressive_) {
+    pass_count = xpixelsamples * ypixelsamples;
+  }
+  if (sample_splatting_) {
+    int xmargin = 0, ymargin = 0;
+    Sampler::GetSplatMargin(xpixelsamples, ypixelsamples,
+        xfilterwidth, yfilterwidth, &xmargin, &ymargin);
+    splats.Init(&tiler, xmargin, ymargin);
+  } else if (progressive_) {
+    accumulation.Resize(xres, yres, 5);
+  }
+
+  timer.Start();
+  for (pass = 0; pass < pass_count; pass++) {
+    set_pass(worker_list, thread_count,
+        progressive_ && !sample_splatting_ ? &accumulation : NULL,
+        sample_splatting_ ? &splats : NULL,
+        progressive_ ? pass : -1);
+
+    const ThreadStatus status =
+        MtRunThreadLoop(worker_list, render_tile, thread_count, 0, tile_count);
+
+    // tiles showed their own samples only. now all splats are in
+    if (sample_splatting_ && !sample_count_output_) {
+      ResolveJob job(&splats, &tiler, framebuffer_);
+      MtRunThreadLoop(&job, resolve_tile, thread_count, 0, tile_count);
+    }
+    if (status == THREAD_LOOP_CANCEL) {
+      break;
+    }
+  }
 
   render_frame_done(this, &tiler);
 
+  printf("# Sampling Done\n");
+  printf("#   Ray Packet: %d x %d\n", ray_packet_size_, ray_packet_size_);
+  printf("#   Sorted Shading: %s\n", sorted_shading_ ? "On" : "Off");
+  printf("#   Shader Batch: %s\n", shader_batch_ ? "On" : "Off");
+  printf("#   Sample Splatting: %s\n", sample_splatting_ ? "On" : "Off");
+  printf("#   Filter Type: %s\n", filter_type_name(filter_type_));
+  printf("#   Sampler Type: %s\n", sampler_type_name(sampler_type_));
+  if (progressive_) {
+    printf("#   Progressive Passes: %d / %d\n", pass, pass_count);
+  } else if (adaptive_threshold_ > 0) {
+    printf("#   Adaptive Threshold: %g\n", adaptive_threshold_);
+    printf("#   Samples per Pixel: %g\n",
+        count_spent_samples(worker_list, thread_count) / ((double) xres * yres));
+  }
+
+  ray_counts_ = count_rays(worker_list, thread_count);
+  printf("#   Rays: %ld (Camera %ld, Shadow %ld, Reflect %ld, Refract %ld)\n",
+      ray_counts_.GetTotal(),
+      ray_counts_.traced[CXT_CAMERA_RAY],
+      ray_counts_.traced[CXT_SHADOW_RAY],
+      ray_counts_.traced[CXT_REFLECT_RAY],
+      ray_counts_.traced[CXT_REFRACT_RAY]);
+  if (ray_counts_.volume_samples > 0) {
+    printf("#   Volume Samples: %ld\n", ray_counts_.volume_samples);
+  }
+  if (roulette_threshold_ > 0) {
+    printf("#   Russian Roulette: %g (%ld rays terminated)\n",
+        roulette_threshold_, ray_counts_.terminated);
+  }
+  {
+    const double elapsed = timer.GetElapsedSeconds();
+    if (elapsed > 0) {
+      printf("#   Rays per Second: %.0f\n", ray_counts_.GetTotal() / elapsed);
+    }
+    printf("#   Elapsed: %g sec\n\n", elapsed);
+  }
+
 cleanup_and_exit:
   free_worker_list(worker_list, thread_count);
 
@@ -798,7 +1083,7 @@ int Renderer::preprocess_lights()
 
   for (int i = 0; i < NLIGHTS; i++) {
     Light *light = target_lights_[i];
-    const int err = light->Preprocess();
+    const int err = light->Preprocess(GetThreadCount());
 
     if (err) {
       /* TODO error handling */
@@ -806,6 +1091,13 @@ int Renderer::preprocess_lights()
     }
   }
 
+  light_tree_.SetSampleBudget(light_sample_budget_);
+  if (light_sample_budget_ > 0) {
+    light_tree_.Build((const Light **) target_lights_, NLIGHTS);
+    printf("#   Light Tree Nodes: %d\n", light_tree_.GetNodeCount());
+    printf("#   Light Sample Budget: %d\n", light_sample_budget_);
+  }
+
   const Elapse elapse = timer.GetElapse();
   printf("# Preprocessing Lights Done\n");
   printf("#   %dh %dm %ds\n\n", elapse.hour, elapse.min, elapse.sec);
@@ -813,6 +1105,17 @@ int Renderer::preprocess_lights()
   return 0;
 }
 
+// a camera hit waiting to be shaded in sorted order
+class ShadingPoint {
+public:
+  ShadingPoint() : sample(NULL), ray(), isect() {}
+  ~ShadingPoint() {}
+
+  Sample *sample;
+  Ray ray;
+  Intersection isect;
+};
+
 class Worker {
 public:
   Worker() {}
@@ -829,9 +1132,31 @@ public:
   FrameBuffer *framebuffer;
   Sampler sampler;
   Filter filter;
-  Sample *pixel_samples;
+  std::vector<const Sample *> pixel_samples;
+  std::vector<float> filter_xweights, filter_yweights;
 
   TraceContext context;
+  RayCounts ray_counts;
+  MemoryArena arena;
+  XorShift rng;
+  int ray_packet_size;
+  int sorted_shading;
+  int shader_batch;
+  int sample_count_output;
+  int max_pixel_samples;
+  double spent_sample_count;
+  // filtered sums of colors and weights over passes
+  FrameBuffer *accumulation;
+  SplatBuffer *splats;
+  int pass;
+  std::vector<float> pixel_weights;
+  std::vector<ShadingPoint> shading_points;
+  std::vector<std::pair<unsigned int, int> > shading_order;
+
+  TraceContext batch_contexts[MAX_SHADER_BATCH_SIZE];
+  XorShift batch_rngs[MAX_SHADER_BATCH_SIZE];
+  SurfaceInput batch_inputs[MAX_SHADER_BATCH_SIZE];
+  SurfaceOutput batch_outputs[MAX_SHADER_BATCH_SIZE];
   Rectangle tile_region;
 
   TileReport tile_report;
@@ -863,23 +1188,58 @@ static void init_worker(Worker *worker, int id,
 
   // Sampler
   worker->sampler.Initialize(xres, yres, xrate, yrate, xfwidth, yfwidth);
+  worker->sampler.SetSplatting(renderer->sample_splatting_);
+  worker->sampler.SetSamplerType(renderer->sampler_type_);
+  worker->sampler.SetSeed(renderer->sample_seed_);
   worker->sampler.SetJitter(renderer->jitter_);
   worker->sampler.SetSampleTimeRange(
       renderer->sample_time_start_, renderer->sample_time_end_);
-  worker->pixel_samples = worker->sampler.AllocatePixelSamples();
+  worker->max_pixel_samples = xrate * yrate;
+  if (renderer->adaptive_threshold_ > 0 && !renderer->progressive_) {
+    worker->max_pixel_samples = Max(worker->max_pixel_samples,
+        renderer->adaptive_max_pixelsamples_[0] * renderer->adaptive_max_pixelsamples_[1]);
+    worker->sampler.SetAdaptiveSampling(
+        renderer->adaptive_threshold_, worker->max_pixel_samples);
+  }
+  worker->pixel_samples.resize(worker->sampler.GetSampleCountForPixel());
+  worker->pixel_weights.resize(worker->sampler.GetSampleCountForPixel());
+  worker->sample_count_output = renderer->sample_count_output_;
+  worker->spent_sample_count = 0;
+  worker->accumulation = NULL;
+  worker->splats = NULL;
+  worker->pass = -1;
 
   // Filter
-  worker->filter.SetFilterType(FLT_GAUSSIAN, xfwidth, yfwidth);
+  worker->filter.SetFilterType(renderer->filter_type_, xfwidth, yfwidth);
+  {
+    int xmargin = 0, ymargin = 0;
+    Sampler::GetSplatMargin(xrate, yrate, xfwidth, yfwidth, &xmargin, &ymargin);
+    worker->filter_xweights.resize(2 * xmargin + 2);
+    worker->filter_yweights.resize(2 * ymargin + 2);
+  }
 
   /* context */
   worker->context = SlCameraContext(renderer->target_objects_);
   worker->context.cast_shadow = renderer->cast_shadow_;
   worker->context.max_reflect_depth = renderer->max_reflect_depth_;
   worker->context.max_refract_depth = renderer->max_refract_depth_;
+  worker->context.roulette_threshold = renderer->roulette_threshold_;
+  worker->context.ray_counts = &worker->ray_counts;
   worker->context.raymarch_step = renderer->raymarch_step_;
   worker->context.raymarch_shadow_step = renderer->raymarch_shadow_step_;
   worker->context.raymarch_reflect_step = renderer->raymarch_reflect_step_;
   worker->context.raymarch_refract_step = renderer->raymarch_refract_step_;
+  worker->context.lod_footprint =
+      renderer->lod_threshold_ * renderer->camera_->GetPixelFootprint(yres);
+  worker->context.arena = &worker->arena;
+  worker->context.rng = &worker->rng;
+  if (renderer->light_sample_budget_ > 0) {
+    worker->context.light_tree = &renderer->light_tree_;
+  }
+  worker->context.dome_sample_budget = renderer->dome_sample_budget_;
+  worker->ray_packet_size = renderer->ray_packet_size_;
+  worker->sorted_shading = renderer->sorted_shading_;
+  worker->shader_batch = renderer->shader_batch_;
 
   /* region */
   worker->tile_region.xmin = 0;
@@ -919,6 +1279,7 @@ static void set_working_region(Worker *worker, int region_id)
   worker->tile_region.xmax = tile->xmax;
   worker->tile_region.ymax = tile->ymax;
 
+  worker->sampler.SetStratum(worker->pass);
   if (worker->sampler.GenerateSamples(worker->tile_region)) {
     /* TODO error handling */
   }
@@ -926,7 +1287,6 @@ static void set_working_region(Worker *worker, int region_id)
 
 static void finish_worker(Worker *worker)
 {
-  worker->sampler.FreePixelSamples(worker->pixel_samples);
 }
 
 static void free_worker_list(Worker *worker_list, int worker_count)
@@ -944,42 +1304,180 @@ static void free_worker_list(Worker *worker_list, int worker_count)
   delete [] worker_list;
 }
 
-static Color4 apply_pixel_filter(Worker *worker, int x, int y)
+static const char *filter_type_name(int filter_type)
+{
+  switch (filter_type) {
+  case FLT_BOX:             return "Box";
+  case FLT_GAUSSIAN:        return "Gaussian";
+  case FLT_MITCHELL:        return "Mitchell";
+  case FLT_BLACKMAN_HARRIS: return "Blackman-Harris";
+  default:                  return "Unknown";
+  }
+}
+
+static const char *sampler_type_name(int sampler_type)
+{
+  switch (sampler_type) {
+  case SMP_JITTERED: return "Jittered";
+  case SMP_SOBOL:    return "Sobol";
+  default:           return "Unknown";
+  }
+}
+
+static void set_pass(Worker *worker_list, int worker_count,
+    FrameBuffer *accumulation, SplatBuffer *splats, int pass)
+{
+  for (int i = 0; i < worker_count; i++) {
+    worker_list[i].accumulation = accumulation;
+    worker_list[i].splats = splats;
+    worker_list[i].pass = pass;
+  }
+}
+
+static double count_spent_samples(const Worker *worker_list, int worker_count)
+{
+  double count = 0;
+
+  for (int i = 0; i < worker_count; i++) {
+    count += worker_list[i].spent_sample_count;
+  }
+  return count;
+}
+
+static RayCounts count_rays(const Worker *worker_list, int worker_count)
+{
+  RayCounts counts;
+
+  for (int i = 0; i < worker_count; i++) {
+    const RayCounts &worker_counts = worker_list[i].ray_counts;
+    for (int j = 0; j <= CXT_REFRACT_RAY; j++) {
+      counts.traced[j] += worker_counts.traced[j];
+    }
+    counts.terminated += worker_counts.terminated;
+    counts.volume_samples += worker_counts.volume_samples;
+  }
+  return counts;
+}
+
+// sums up samples weighted by the filter without normalization
+static void filter_pixel_samples(const Worker *worker, int nsamples, int x, int y,
+    Color4 *pixel, float *wgt_sum)
 {
-  const int nsamples = worker->sampler.GetSampleCountForPixel();
   const int xres = worker->xres;
   const int yres = worker->yres;
-  Sample *pixel_samples = worker->pixel_samples;
+  const Sample *const *pixel_samples = &worker->pixel_samples[0];
+  const float *pixel_weights = &worker->pixel_weights[0];
   const Filter &filter = worker->filter;
-
-  Color4 pixel;
-  float wgt_sum = 0.f;
-  float inv_sum = 0.f;
   int i;
 
   for (i = 0; i < nsamples; i++) {
-    Sample *sample = &pixel_samples[i];
+    const Sample *sample = pixel_samples[i];
     double filtx = 0, filty = 0;
     double wgt = 0;
 
     filtx = xres * sample->uv.x - (x + .5);
     filty = yres * (1-sample->uv.y) - (y + .5);
-    wgt = filter.Evaluate(filtx, filty);
+    wgt = filter.Evaluate(filtx, filty) * pixel_weights[i];
+
+    pixel->r += wgt * sample->data.r;
+    pixel->g += wgt * sample->data.g;
+    pixel->b += wgt * sample->data.b;
+    pixel->a += wgt * sample->data.a;
+    *wgt_sum += wgt;
+  }
+}
+
+static Color4 normalize_pixel(const Color4 &pixel, float wgt_sum)
+{
+  if (wgt_sum == 0) {
+    return Color4();
+  }
+
+  const float inv_sum = 1.f / wgt_sum;
+  return Color4(
+      pixel.r * inv_sum,
+      pixel.g * inv_sum,
+      pixel.b * inv_sum,
+      pixel.a * inv_sum);
+}
+
+static Color4 apply_pixel_filter(Worker *worker, int nsamples, int x, int y)
+{
+  Color4 pixel;
+  float wgt_sum = 0.f;
+
+  filter_pixel_samples(worker, nsamples, x, y, &pixel, &wgt_sum);
 
-    pixel.r += wgt * sample->data[0];
-    pixel.g += wgt * sample->data[1];
-    pixel.b += wgt * sample->data[2];
-    pixel.a += wgt * sample->data[3];
-    wgt_sum += wgt;
+  if (worker->accumulation != NULL) {
+    float *accum = worker->accumulation->GetWritable(x, y, 0);
+    accum[0] += pixel.r;
+    accum[1] += pixel.g;
+    accum[2] += pixel.b;
+    accum[3] += pixel.a;
+    accum[4] += wgt_sum;
+    return normalize_pixel(Color4(accum[0], accum[1], accum[2], accum[3]), accum[4]);
   }
 
-  inv_sum = 1.f / wgt_sum;
-  pixel.r *= inv_sum;
-  pixel.g *= inv_sum;
-  pixel.b *= inv_sum;
-  pixel.a *= inv_sum;
+  return normalize_pixel(pixel, wgt_sum);
+}
 
-  return pixel;
+static void splat_samples(Worker *worker)
+{
+  const int xres = worker->xres;
+  const int yres = worker->yres;
+  const int sample_count = worker->sampler.GetSampleCount();
+  const Rectangle &region = worker->splats->GetRegion(worker->region_id);
+  const Filter &filter = worker->filter;
+  float *xweights = &worker->filter_xweights[0];
+  float *yweights = &worker->filter_yweights[0];
+
+  for (int i = 0; i < sample_count; i++) {
+    const Sample &sample = worker->sampler.GetSample(i);
+    Rectangle pixels;
+    float weight = 0;
+
+    if (!worker->sampler.GetSplatFootprint(i, &pixels, &weight)) {
+      continue;
+    }
+    pixels.xmin = Max(pixels.xmin, region.xmin);
+    pixels.ymin = Max(pixels.ymin, region.ymin);
+    pixels.xmax = Min(pixels.xmax, region.xmax);
+    pixels.ymax = Min(pixels.ymax, region.ymax);
+    assert(SizeX(pixels) <= (int) worker->filter_xweights.size());
+    assert(SizeY(pixels) <= (int) worker->filter_yweights.size());
+
+    // the filter is separable
+    for (int x = pixels.xmin; x < pixels.xmax; x++) {
+      xweights[x - pixels.xmin] = filter.EvaluateX(xres * sample.uv.x - (x + .5));
+    }
+    for (int y = pixels.ymin; y < pixels.ymax; y++) {
+      yweights[y - pixels.ymin] = filter.EvaluateY(yres * (1-sample.uv.y) - (y + .5)) * weight;
+    }
+
+    for (int y = pixels.ymin; y < pixels.ymax; y++) {
+      float *splat = worker->splats->GetWritable(worker->region_id, pixels.xmin, y);
+
+      for (int x = pixels.xmin; x < pixels.xmax; x++) {
+        const float wgt = xweights[x - pixels.xmin] * yweights[y - pixels.ymin];
+
+        splat[0] += wgt * sample.data.r;
+        splat[1] += wgt * sample.data.g;
+        splat[2] += wgt * sample.data.b;
+        splat[3] += wgt * sample.data.a;
+        splat[4] += wgt;
+        splat += 5;
+      }
+    }
+  }
+}
+
+static ThreadStatus resolve_tile(void *data, const ThreadContext *context)
+{
+  const ResolveJob *job = (const ResolveJob *) data;
+
+  job->splats->Resolve(*job->tiler->GetTile(context->iteration_id), job->fb);
+
+  return THREAD_LOOP_CONTINUE;
 }
 
 static void reconstruct_image(Worker *worker)
@@ -991,12 +1489,27 @@ static void reconstruct_image(Worker *worker)
   const int ymax = worker->tile_region.ymax;
   int x, y;
 
+  if (worker->splats != NULL && !worker->sample_count_output) {
+    splat_samples(worker);
+  }
+
   for (y = ymin; y < ymax; y++) {
     for (x = xmin; x < xmax; x++) {
+      const int spent = worker->sampler.GetSpentSampleCount(x, y);
       Color4 pixel;
 
-      worker->sampler.GetPixelSamples(worker->pixel_samples, x, y);
-      pixel = apply_pixel_filter(worker, x, y);
+      if (worker->sample_count_output) {
+        const float ratio = spent / (float) worker->max_pixel_samples;
+        pixel = Color4(ratio, ratio, ratio, 1);
+      } else if (worker->splats != NULL) {
+        const float *splat = worker->splats->GetWritable(worker->region_id, x, y);
+        pixel = normalize_pixel(Color4(splat[0], splat[1], splat[2], splat[3]), splat[4]);
+      } else {
+        const int nsamples = worker->sampler.GetPixelSamples(
+            &worker->pixel_samples[0], x, y, &worker->pixel_weights[0]);
+        pixel = apply_pixel_filter(worker, nsamples, x, y);
+      }
+      worker->spent_sample_count += spent;
 
       fb->SetColor(x, y, pixel);
     }
@@ -1069,35 +1582,312 @@ static void render_tile_done(Worker *worker)
   CbReportTileDone(&worker->tile_report, &info);
 }
 
+// the random stream of a sample only depends on its pixel in the image
+// and its number in the pixel so that images do not change with thread
+// count, tile size or whichever region takes the sample
+static uint32_t make_sample_seed(const Sampler &sampler, int sample_index)
+{
+  int xpixel = 0, ypixel = 0, pixel_sample = 0;
+  sampler.GetSamplePixel(sample_index, &xpixel, &ypixel, &pixel_sample);
+
+  uint32_t seed = HashInteger(xpixel);
+  seed = HashInteger(seed ^ ypixel);
+  seed = HashInteger(seed ^ pixel_sample);
+  return seed;
+}
+
+static void store_sample_color(Sample *smp, int hit, const Color4 &C_trace)
+{
+  if (hit) {
+    smp->data = C_trace;
+  } else {
+    smp->data = Color4();
+  }
+}
+
+// progress counts grid samples only as the frame total knows nothing
+// about samples added by adaptive sampling
+static int report_sample_done(Worker *worker, int sample_index)
+{
+  if (sample_index >= worker->sampler.GetGridSampleCount()) {
+    return 0;
+  }
+  return CbReportSampleDone(&worker->tile_report);
+}
+
+static void setup_camera_packet(const Worker *worker,
+    Sample **block, int count, RayPacket *packet)
+{
+  packet->count = count;
+  for (int i = 0; i < count; i++) {
+    worker->camera->GetRay(block[i]->GetUV(), block[i]->time, &packet->ray[i]);
+    packet->ray[i].lod_footprint = worker->context.lod_footprint;
+    packet->time[i] = block[i]->time;
+  }
+  packet->ComputeFrustum();
+}
+
+// intersects camera rays in packets first then shades each hit.
+// results are the same as integrate_samples
+static int integrate_sample_packets(Worker *worker)
+{
+  const int packet_size = worker->ray_packet_size;
+  Sample *block[MAX_PACKET_RAY_COUNT];
+  int indices[MAX_PACKET_RAY_COUNT];
+  Intersection isects[MAX_PACKET_RAY_COUNT];
+  RayPacket packet;
+  TraceContext cxt = worker->context;
+  int count = 0;
+
+  while ((count = worker->sampler.GetNextSampleBlock(packet_size, block, indices)) > 0) {
+    setup_camera_packet(worker, block, count, &packet);
+    for (int i = 0; i < count; i++) {
+      isects[i] = Intersection();
+    }
+    SlSurfacePacketIntersect(&cxt, &packet, isects);
+
+    for (int i = 0; i < count; i++) {
+      Sample *smp = block[i];
+      Color4 C_trace;
+      double t_hit = FLT_MAX;
+      int hit = 0;
+      int interrupted = 0;
+
+      worker->rng = XorShift(make_sample_seed(worker->sampler, indices[i]));
+      cxt.time = smp->time;
+
+      hit = SlTraceIntersection(&cxt, &packet.ray[i], &isects[i], &C_trace, &t_hit);
+      store_sample_color(smp, hit, C_trace);
+
+      interrupted = report_sample_done(worker, indices[i]);
+      if (interrupted) {
+        printf("integrate_sample_packets CANCELED!\n");
+        return -1;
+      }
+    }
+  }
+  return 0;
+}
+
+// sorts by the octant of the mirror direction first then by the position
+// so that neighbors in the order trace secondary rays in similar directions
+// from close points
+static unsigned int shading_order_key(const ShadingPoint &point, const Box &bounds)
+{
+  const Vector &I = point.ray.dir;
+  const Vector &N = point.isect.N;
+  const Vector R = I - 2 * Dot(I, N) * N;
+  const unsigned int octant =
+      (R.x < 0 ? 4 : 0) | (R.y < 0 ? 2 : 0) | (R.z < 0 ? 1 : 0);
+
+  return (octant << 27) | (BoxMortonCode(bounds, point.isect.P) >> 3);
+}
+
+static const Shader *shader_of(const ShadingPoint &point)
+{
+  if (point.isect.object == NULL) {
+    return NULL;
+  }
+  return point.isect.GetShader();
+}
+
+// groups hits by shader keeping the sorted order in each group
+class ShaderOrder {
+public:
+  ShaderOrder(const std::vector<ShadingPoint> &points) : points_(points) {}
+  ~ShaderOrder() {}
+
+  bool operator()(const std::pair<unsigned int, int> &a,
+      const std::pair<unsigned int, int> &b) const
+  {
+    return std::less<const Shader *>()(
+        shader_of(points_[a.second]), shader_of(points_[b.second]));
+  }
+
+private:
+  const std::vector<ShadingPoint> &points_;
+};
+
+// evaluates runs of hits sharing the shader in batches. misses and hits
+// without shader are traced one by one
+static int shade_in_batches(Worker *worker)
+{
+  const std::vector<ShadingPoint> &points = worker->shading_points;
+  const std::vector<std::pair<unsigned int, int> > &order = worker->shading_order;
+  const int NPOINTS = static_cast<int>(order.size());
+  TraceContext *contexts = worker->batch_contexts;
+  XorShift *rngs = worker->batch_rngs;
+  SurfaceInput *inputs = worker->batch_inputs;
+  SurfaceOutput *outputs = worker->batch_outputs;
+  int begin = 0;
+
+  while (begin < NPOINTS) {
+    const Shader *shader = shader_of(points[order[begin].second]);
+    int end = begin + 1;
+
+    while (end < NPOINTS && end - begin < MAX_SHADER_BATCH_SIZE &&
+        shader_of(points[order[end].second]) == shader) {
+      end++;
+    }
+
+    // each hit has its own random stream as the shader sees them all at once
+    for (int k = begin; k < end; k++) {
+      const int index = order[k].second;
+      const ShadingPoint &point = points[index];
+      const int i = k - begin;
+
+      rngs[i] = XorShift(make_sample_seed(worker->sampler, index));
+      contexts[i] = worker->context;
+      contexts[i].time = point.sample->time;
+      contexts[i].rng = &rngs[i];
+      if (shader != NULL) {
+        SlSetupSurfaceInput(&point.ray, &point.isect, &inputs[i]);
+      }
+    }
+
+    if (shader != NULL) {
+      shader->EvaluateBatch(contexts, inputs, outputs, end - begin);
+    }
+
+    for (int k = begin; k < end; k++) {
+      const int index = order[k].second;
+      const ShadingPoint &point = points[index];
+      const int i = k - begin;
+      Color4 C_trace;
+      double t_hit = FLT_MAX;
+      int hit = 0;
+      int interrupted = 0;
+
+      if (shader != NULL) {
+        hit = SlTraceShadedIntersection(&contexts[i], &point.ray, &point.isect,
+            &outputs[i], &C_trace, &t_hit);
+      } else {
+        hit = SlTraceIntersection(&contexts[i], &point.ray, &point.isect,
+            &C_trace, &t_hit);
+      }
+      store_sample_color(point.sample, hit, C_trace);
+
+      interrupted = report_sample_done(worker, index);
+      if (interrupted) {
+        printf("shade_in_batches CANCELED!\n");
+        return -1;
+      }
+    }
+    begin = end;
+  }
+  return 0;
+}
+
+// sorted shading. all camera rays in the tile are intersected first, then
+// hits are shaded in the sorted order or in batches by shader.
+// results are the same as integrate_samples
+static int integrate_sorted_samples(Worker *worker)
+{
+  const int packet_size = worker->ray_packet_size;
+  std::vector<ShadingPoint> &points = worker->shading_points;
+  std::vector<std::pair<unsigned int, int> > &order = worker->shading_order;
+  Sample *block[MAX_PACKET_RAY_COUNT];
+  int indices[MAX_PACKET_RAY_COUNT];
+  Intersection isects[MAX_PACKET_RAY_COUNT];
+  RayPacket packet;
+  TraceContext cxt = worker->context;
+  int count = 0;
+
+  // the vectors keep their capacity over tiles. order only has the samples
+  // traced this time, which are not all of them in adaptive rounds and passes
+  points.resize(worker->sampler.GetSampleCount());
+  order.clear();
+
+  while ((count = worker->sampler.GetNextSampleBlock(packet_size, block, indices)) > 0) {
+    setup_camera_packet(worker, block, count, &packet);
+    for (int i = 0; i < count; i++) {
+      isects[i] = Intersection();
+    }
+    SlSurfacePacketIntersect(&cxt, &packet, isects);
+
+    for (int i = 0; i < count; i++) {
+      ShadingPoint &point = points[indices[i]];
+      point.sample = block[i];
+      point.ray = packet.ray[i];
+      point.isect = isects[i];
+      order.push_back(std::make_pair(0U, indices[i]));
+    }
+  }
+
+  Box bounds;
+  BoxReverseInfinite(&bounds);
+  for (size_t k = 0; k < order.size(); k++) {
+    const ShadingPoint &point = points[order[k].second];
+    if (point.isect.object != NULL) {
+      BoxAddPoint(&bounds, point.isect.P);
+    }
+  }
+
+  // misses go last
+  for (size_t k = 0; k < order.size(); k++) {
+    const ShadingPoint &point = points[order[k].second];
+    order[k].first = point.isect.object != NULL ?
+        shading_order_key(point, bounds) : 0xFFFFFFFF;
+  }
+  std::sort(order.begin(), order.end());
+
+  if (worker->shader_batch) {
+    std::stable_sort(order.begin(), order.end(), ShaderOrder(points));
+    return shade_in_batches(worker);
+  }
+
+  for (size_t k = 0; k < order.size(); k++) {
+    const int index = order[k].second;
+    const ShadingPoint &point = points[index];
+    Sample *smp = point.sample;
+    Color4 C_trace;
+    double t_hit = FLT_MAX;
+    int hit = 0;
+    int interrupted = 0;
+
+    worker->rng = XorShift(make_sample_seed(worker->sampler, index));
+    cxt.time = smp->time;
+
+    hit = SlTraceIntersection(&cxt, &point.ray, &point.isect, &C_trace, &t_hit);
+    store_sample_color(smp, hit, C_trace);
+
+    interrupted = report_sample_done(worker, index);
+    if (interrupted) {
+      printf("integrate_sorted_samples CANCELED!\n");
+      return -1;
+    }
+  }
+  return 0;
+}
+
 static int integrate_samples(Worker *worker)
 {
+  if (worker->sorted_shading || worker->shader_batch) {
+    return integrate_sorted_samples(worker);
+  }
+  if (worker->ray_packet_size > 1) {
+    return integrate_sample_packets(worker);
+  }
+
   Sample *smp = NULL;
   TraceContext cxt = worker->context;
   Ray ray;
-
   while ((smp = worker->sampler.GetNextSample()) != NULL) {
+    const int sample_index = worker->sampler.GetNextSampleIndex() - 1;
     Color4 C_trace;
     double t_hit = FLT_MAX;
     int hit = 0;
     int interrupted = 0;
 
-    worker->camera->GetRay(smp->uv, smp->time, &ray);
+    worker->rng = XorShift(make_sample_seed(worker->sampler, sample_index));
+
+    worker->camera->GetRay(smp->GetUV(), smp->time, &ray);
     cxt.time = smp->time;
 
     hit = SlTrace(&cxt, &ray.orig, &ray.dir, ray.tmin, ray.tmax, &C_trace, &t_hit);
-    if (hit) {
-      smp->data[0] = C_trace.r;
-      smp->data[1] = C_trace.g;
-      smp->data[2] = C_trace.b;
-      smp->data[3] = C_trace.a;
-    } else {
-      smp->data[0] = 0;
-      smp->data[1] = 0;
-      smp->data[2] = 0;
-      smp->data[3] = 0;
-    }
+    store_sample_color(smp, hit, C_trace);
 
-    interrupted = CbReportSampleDone(&worker->tile_report);
+    interrupted = report_sample_done(worker, sample_index);
     if (interrupted) {
       printf("integrate_samples CANCELED!\n");
       return -1;
@@ -1120,6 +1910,11 @@ static ThreadStatus render_tile(void *data, const ThreadContext *context)
   }
 
   interrupted = integrate_samples(worker);
+
+  // keeps adding samples to noisy pixels until all of them converge
+  while (!interrupted && worker->sampler.GenerateAdaptiveSamples() > 0) {
+    interrupted = integrate_samples(worker);
+  }
   reconstruct_image(worker);
 
   render_tile_done(worker);
@@ -5,6 +5,8 @@
 #define FJ_RENDERER_H
 
 #include "fj_compatibility.h"
+#include "fj_light_tree.h"
+#include "fj_shading.h"
 #include "fj_callback.h"
 #include "fj_progress.h"
 #include "fj_timer.h"
@@ -52,12 +54,59 @@ public:
   void SetShadowEnable(int enable);
   void SetMaxReflectDepth(int max_depth);
   void SetMaxRefractDepth(int max_depth);
+  // reflection and refraction rays adding less than the threshold to
+  // the pixel are randomly terminated. 0 traces up to the max depths
+  void SetRouletteThreshold(float threshold);
 
   void SetRaymarchStep(double step);
   void SetRaymarchShadowStep(double step);
   void SetRaymarchReflectStep(double step);
   void SetRaymarchRefractStep(double step);
 
+  void SetLODThreshold(double pixel_size);
+
+  // traces camera rays in blocks of packet_size x packet_size.
+  // 0 or 1 traces them one by one
+  void SetRayPacketSize(int packet_size);
+
+  // intersects all camera rays in a tile first then shades the hits
+  // sorted by position and mirror direction. secondary rays are still
+  // traced by the shaders as they ask for them
+  void SetSortedShadingEnable(int enable);
+
+  // evaluates hits in a tile in batches grouped by shader.
+  // hits are collected the same way as in sorted shading
+  void SetShaderBatchEnable(int enable);
+
+  // picks this many light samples for each shading point from a tree of
+  // lights weighted by importance. 0 samples all lights
+  void SetLightSampleBudget(int budget);
+
+  // traces shadow rays for this many samples of each dome light picked
+  // by their unshadowed contribution. 0 traces all samples
+  void SetDomeSampleBudget(int budget);
+
+  // adds samples to pixels whose standard error is over threshold up to
+  // max_xrate x max_yrate samples in a pixel. 0 threshold turns it off
+  void SetAdaptiveThreshold(float threshold);
+  void SetAdaptiveMaxPixelSamples(int max_xrate, int max_yrate);
+  // writes the number of samples taken in each pixel over the max
+  // into the framebuffer instead of the image
+  void SetSampleCountOutput(int enable);
+  // renders the frame in passes of one sample per pixel, accumulating
+  // them up to the pixel samples. the framebuffer is updated every pass
+  void SetProgressive(int enable);
+  // traces each camera sample once and splats it into the pixels around.
+  // otherwise tiles trace their own samples in the filter margins
+  void SetSampleSplatting(int enable);
+  // one of FLT_BOX, FLT_GAUSSIAN, FLT_MITCHELL and FLT_BLACKMAN_HARRIS
+  void SetFilterType(int filter_type);
+  // SMP_JITTERED or SMP_SOBOL
+  void SetSamplerType(int sampler_type);
+  // changes the sample pattern of every pixel. give each frame of
+  // a sequence its own seed for noise that does not stick to the screen
+  void SetSampleSeed(int seed);
+
   void SetCamera(Camera *cam);
   void SetFrameBuffers(FrameBuffer *fb);
   void SetTargetObjects(ObjectGroup *grp);
@@ -79,6 +128,8 @@ public:
       TileDoneCallback tile_done);
 
   int RenderScene();
+  // rays traced in the last RenderScene
+  const RayCounts &GetRayCounts() const;
 
 public:
   int prepare_rendering();
@@ -106,12 +157,31 @@ public:
   int cast_shadow_;
   int max_reflect_depth_;
   int max_refract_depth_;
+  float roulette_threshold_;
+  RayCounts ray_counts_;
 
   double raymarch_step_;
   double raymarch_shadow_step_;
   double raymarch_reflect_step_;
   double raymarch_refract_step_;
 
+  double lod_threshold_;
+  int ray_packet_size_;
+  int sorted_shading_;
+  int shader_batch_;
+  int light_sample_budget_;
+  int dome_sample_budget_;
+  LightTree light_tree_;
+
+  float adaptive_threshold_;
+  int adaptive_max_pixelsamples_[2];
+  int sample_count_output_;
+  int progressive_;
+  int sample_splatting_;
+  int filter_type_;
+  int sampler_type_;
+  int sample_seed_;
+
   int use_max_thread_;
   int thread_count_;
 
@@ -6,15 +6,19 @@
 #include "fj_numeric.h"
 #include "fj_random.h"
 #include "fj_box.h"
+#include "fj_color.h"
 
 #include <cstddef>
 #include <cassert>
+#include <algorithm>
 #include <cmath>
 
 namespace fj {
 
 static int get_pixel_margin(int rate, float fwidth);
 static int get_sample_count_for_region(int rate, int regionsize, int margin);
+static int floor_div(int a, int b);
+static bool is_power_of_two(int n);
 
 Sampler::Sampler() :
   xres_(1),
@@ -24,8 +28,11 @@ Sampler::Sampler() :
   xfwidth_(1),
   yfwidth_(1),
   jitter_(1),
+  sampler_type_(SMP_JITTERED),
+  seed_(0),
 
   samples_(),
+  pattern_(),
 
   xnsamples_(1),
   ynsamples_(1),
@@ -37,12 +44,31 @@ Sampler::Sampler() :
   ynpxlsmps_(1),
 
   current_index_(0),
+  current_block_(0),
 
   need_jitter_(true),
   need_time_sampling_(false),
 
   sample_time_start_(0),
-  sample_time_end_(0)
+  sample_time_end_(0),
+
+  adaptive_threshold_(0),
+  max_pixel_samples_(0),
+  grid_sample_count_(0),
+  xnpixels_(0),
+  ynpixels_(0),
+  adaptive_round_(0),
+  pixel_first_added_(),
+  pixel_added_count_(),
+  pixel_converged_(),
+  next_added_(),
+  added_pixel_(),
+  added_pixel_sample_(),
+
+  stratum_(-1),
+  splatting_(false),
+  xfilter_margin_(0),
+  yfilter_margin_(0)
 {
 }
 
@@ -71,10 +97,22 @@ void Sampler::Initialize(int xres, int yres,
   samples_.clear();
 
   current_index_ = 0;
+  current_block_ = 0;
 
   count_samples_in_pixels();
 }
 
+void Sampler::SetSamplerType(int sampler_type)
+{
+  assert(sampler_type == SMP_JITTERED || sampler_type == SMP_SOBOL);
+  sampler_type_ = sampler_type;
+}
+
+void Sampler::SetSeed(int seed)
+{
+  seed_ = (unsigned int) seed;
+}
+
 void Sampler::SetJitter(float jitter)
 {
   assert(jitter >= 0 && jitter <= 1);
@@ -94,6 +132,26 @@ void Sampler::SetSampleTimeRange(Real start_time, Real end_time)
   need_time_sampling_ = true;
 }
 
+void Sampler::SetAdaptiveSampling(float threshold, int max_pixel_samples)
+{
+  assert(threshold >= 0);
+
+  adaptive_threshold_ = threshold;
+  max_pixel_samples_ = Max(max_pixel_samples, xrate_ * yrate_);
+}
+
+void Sampler::SetSplatting(bool enable)
+{
+  splatting_ = enable;
+  count_samples_in_pixels();
+}
+
+void Sampler::SetStratum(int stratum)
+{
+  assert(stratum < xrate_ * yrate_);
+  stratum_ = stratum;
+}
+
 int Sampler::GenerateSamples(const Rectangle &pixel_bounds)
 {
   const int err = allocate_samples_for_region(pixel_bounds);
@@ -101,46 +159,51 @@ int Sampler::GenerateSamples(const Rectangle &pixel_bounds)
     return -1;
   }
 
-  XorShift xr; // random number generator
-  XorShift rng_time; // for time sampling jitter
-  XorInit(&rng_time);
-  XorInit(&xr);
-
-  // uv delta
-  const Real udelta = 1./(xrate_ * xres_ + 2 * xmargin_);
-  const Real vdelta = 1./(yrate_ * yres_ + 2 * ymargin_);
-
-  // xy offset
-  const int xoffset = xpixel_start_ * xrate_ - xmargin_;
-  const int yoffset = ypixel_start_ * yrate_ - ymargin_;
+  if (sampler_type_ == SMP_SOBOL) {
+    generate_sobol_samples();
+  } else {
+    generate_jittered_samples();
+  }
+  return 0;
+}
 
-  Sample *sample = &samples_[0];
+int Sampler::GenerateAdaptiveSamples()
+{
+  const int NPIXELS = xnpixels_ * ynpixels_;
+  const int BASE_COUNT = xrate_ * yrate_;
+  const int old_count = GetSampleCount();
 
-  for (int y = 0; y < ynsamples_; y++) {
-    for (int x = 0; x < xnsamples_; x++) {
-      sample->uv.x =     (.5 + x + xoffset) * udelta;
-      sample->uv.y = 1 - (.5 + y + yoffset) * vdelta;
+  if (adaptive_threshold_ <= 0) {
+    return 0;
+  }
 
-      if (need_jitter_) {
-        const Real u_jitter = XorNextFloat01(&xr) * jitter_;
-        const Real v_jitter = XorNextFloat01(&xr) * jitter_;
+  for (int i = 0; i < NPIXELS; i++) {
+    pixel_converged_[i] = compute_pixel_error(i) <= adaptive_threshold_;
+  }
 
-        sample->uv.x += udelta * (u_jitter - .5);
-        sample->uv.y += vdelta * (v_jitter - .5);
-      }
+  // a few samples can all agree by chance so a pixel also takes more
+  // when any of its neighbors is over the threshold.
+  // each round adds as many samples as the grid
+  for (int i = 0; i < NPIXELS; i++) {
+    const int x = i % xnpixels_;
+    const int y = i / xnpixels_;
+    bool converged = true;
 
-      if (need_time_sampling_) {
-        const Real rnd = XorNextFloat01(&rng_time);
-        sample->time = Fit(rnd, 0, 1, sample_time_start_, sample_time_end_);
-      } else {
-        sample->time = 0;
+    if (BASE_COUNT + pixel_added_count_[i] + BASE_COUNT > max_pixel_samples_) {
+      continue;
+    }
+    for (int yy = std::max(y - 1, 0); yy <= std::min(y + 1, ynpixels_ - 1); yy++) {
+      for (int xx = std::max(x - 1, 0); xx <= std::min(x + 1, xnpixels_ - 1); xx++) {
+        converged = converged && pixel_converged_[yy * xnpixels_ + xx];
       }
-
-      sample->data = Vector4();
-      sample++;
+    }
+    if (!converged) {
+      add_pixel_samples(i, adaptive_round_);
     }
   }
-  return 0;
+  adaptive_round_++;
+
+  return GetSampleCount() - old_count;
 }
 
 int Sampler::GetSampleCount() const
@@ -148,8 +211,26 @@ int Sampler::GetSampleCount() const
   return samples_.size();
 }
 
+const Sample &Sampler::GetSample(int index) const
+{
+  return samples_[index];
+}
+
+int Sampler::GetGridSampleCount() const
+{
+  return grid_sample_count_;
+}
+
+int Sampler::GetNextSampleIndex() const
+{
+  return current_index_;
+}
+
 Sample *Sampler::GetNextSample()
 {
+  while (current_index_ < grid_sample_count_ && !is_in_stratum(current_index_)) {
+    current_index_++;
+  }
   if (current_index_ >= GetSampleCount())
     return NULL;
 
@@ -159,7 +240,55 @@ Sample *Sampler::GetNextSample()
   return sample;
 }
 
-void Sampler::GetPixelSamples(Sample *pixelsamples, int pixel_x, int pixel_y) const
+int Sampler::GetNextSampleBlock(int block_size, Sample **block, int *indices)
+{
+  const int XNBLOCKS = (xnsamples_ + block_size - 1) / block_size;
+  const int YNBLOCKS = (ynsamples_ + block_size - 1) / block_size;
+
+  if (current_block_ >= XNBLOCKS * YNBLOCKS) {
+    // added samples are in runs by pixel so a run makes a block
+    current_index_ = Max(current_index_, grid_sample_count_);
+
+    const int count = Min(block_size * block_size, GetSampleCount() - current_index_);
+    for (int i = 0; i < count; i++) {
+      block[i] = &samples_[current_index_];
+      indices[i] = current_index_;
+      current_index_++;
+    }
+    return count;
+  }
+
+  int count = 0;
+
+  // blocks with no samples in the stratum are skipped
+  while (count == 0 && current_block_ < XNBLOCKS * YNBLOCKS) {
+    const int XSTART = (current_block_ % XNBLOCKS) * block_size;
+    const int YSTART = (current_block_ / XNBLOCKS) * block_size;
+    const int XEND = Min(XSTART + block_size, xnsamples_);
+    const int YEND = Min(YSTART + block_size, ynsamples_);
+
+    for (int y = YSTART; y < YEND; y++) {
+      for (int x = XSTART; x < XEND; x++) {
+        const int index = y * xnsamples_ + x;
+        if (!is_in_stratum(index)) {
+          continue;
+        }
+        block[count] = &samples_[index];
+        indices[count] = index;
+        count++;
+      }
+    }
+    current_block_++;
+  }
+  if (count == 0) {
+    return GetNextSampleBlock(block_size, block, indices);
+  }
+
+  return count;
+}
+
+int Sampler::GetPixelSamples(const Sample **pixelsamples, int pixel_x, int pixel_y,
+    float *weights) const
 {
   const int XPIXEL_OFFSET = pixel_x - xpixel_start_;
   const int YPIXEL_OFFSET = pixel_y - ypixel_start_;
@@ -170,31 +299,110 @@ void Sampler::GetPixelSamples(Sample *pixelsamples, int pixel_x, int pixel_y) co
     XPIXEL_OFFSET * xrate_;
   const Sample *src = &samples_[OFFSET];
 
-  Sample *dst = pixelsamples;
+  const Sample **dst = pixelsamples;
 
   for (int y = 0; y < ynpxlsmps_; y++) {
     for (int x = 0; x < xnpxlsmps_; x++) {
-      dst[y * xnpxlsmps_ + x] = src[y * XNSAMPLES + x];
+      dst[y * xnpxlsmps_ + x] = &src[y * XNSAMPLES + x];
     }
   }
-}
 
-// TODO REMOVE THIS OR MAKE FREE FUNCTION
-Sample *Sampler::AllocatePixelSamples()
-{
-  const int sample_count = GetSampleCountForPixel();
-  return new Sample[sample_count];
+  int count = xnpxlsmps_ * ynpxlsmps_;
+  if (weights != NULL) {
+    for (int y = 0; y < ynpxlsmps_; y++) {
+      for (int x = 0; x < xnpxlsmps_; x++) {
+        const int index = OFFSET + y * XNSAMPLES + x;
+        weights[y * xnpxlsmps_ + x] = is_in_stratum(index) ? 1 : 0;
+      }
+    }
+  }
+  if (pixel_first_added_.empty()) {
+    return count;
+  }
+
+  // each sample stands for the area of its pixel over the number of samples
+  // in the pixel so that pixels with more samples do not pull the filter
+  // towards them. margin samples out of the tile are always 1
+  const int BASE_COUNT = xrate_ * yrate_;
+  const int XMIN = std::max(0, (XPIXEL_OFFSET * xrate_ - xmargin_) / xrate_);
+  const int YMIN = std::max(0, (YPIXEL_OFFSET * yrate_ - ymargin_) / yrate_);
+  const int XMAX = std::min(xnpixels_ - 1, XPIXEL_OFFSET + (xmargin_ + xrate_ - 1) / xrate_);
+  const int YMAX = std::min(ynpixels_ - 1, YPIXEL_OFFSET + (ymargin_ + yrate_ - 1) / yrate_);
+
+  // the grid region the filter covers
+  const Real XGRID_MIN = pixel_x * xrate_ - xmargin_;
+  const Real YGRID_MIN = pixel_y * yrate_ - ymargin_;
+  const Real XGRID_MAX = XGRID_MIN + xnpxlsmps_;
+  const Real YGRID_MAX = YGRID_MIN + ynpxlsmps_;
+  const Real XGRID_RES = xrate_ * xres_;
+  const Real YGRID_RES = yrate_ * yres_;
+
+  for (int py = YMIN; py <= YMAX; py++) {
+    for (int px = XMIN; px <= XMAX; px++) {
+      const int PIXEL_INDEX = py * xnpixels_ + px;
+      const int added = pixel_added_count_[PIXEL_INDEX];
+      if (added == 0) {
+        continue;
+      }
+      const float weight = BASE_COUNT / (float) (BASE_COUNT + added);
+
+      if (weights != NULL) {
+        // grid samples of the pixel in the filter
+        const int X0 = std::max(px * xrate_ + xmargin_ - XPIXEL_OFFSET * xrate_, 0);
+        const int Y0 = std::max(py * yrate_ + ymargin_ - YPIXEL_OFFSET * yrate_, 0);
+        const int X1 = std::min(px * xrate_ + xmargin_ - XPIXEL_OFFSET * xrate_ + xrate_, xnpxlsmps_);
+        const int Y1 = std::min(py * yrate_ + ymargin_ - YPIXEL_OFFSET * yrate_ + yrate_, ynpxlsmps_);
+        for (int y = Y0; y < Y1; y++) {
+          for (int x = X0; x < X1; x++) {
+            weights[y * xnpxlsmps_ + x] = weight;
+          }
+        }
+      }
+
+      for (int i = pixel_first_added_[PIXEL_INDEX]; i != -1;
+          i = next_added_[i - grid_sample_count_]) {
+        const Sample &sample = samples_[i];
+        const Real xgrid = sample.uv.x * XGRID_RES;
+        const Real ygrid = (1 - sample.uv.y) * YGRID_RES;
+
+        if (xgrid < XGRID_MIN || xgrid >= XGRID_MAX ||
+            ygrid < YGRID_MIN || ygrid >= YGRID_MAX) {
+          continue;
+        }
+        if (weights != NULL) {
+          weights[count] = weight;
+        }
+        dst[count++] = &sample;
+      }
+    }
+  }
+  return count;
 }
 
-int Sampler::GetSampleCountForPixel() const
+int Sampler::GetSpentSampleCount(int pixel_x, int pixel_y) const
 {
-  return xnpxlsmps_ * ynpxlsmps_;
+  if (pixel_added_count_.empty()) {
+    return xrate_ * yrate_;
+  }
+
+  const int XPIXEL_OFFSET = pixel_x - xpixel_start_;
+  const int YPIXEL_OFFSET = pixel_y - ypixel_start_;
+  const int PIXEL_INDEX = YPIXEL_OFFSET * xnpixels_ + XPIXEL_OFFSET;
+
+  return xrate_ * yrate_ + pixel_added_count_[PIXEL_INDEX];
 }
 
 // TODO REMOVE THIS OR MAKE FREE FUNCTION
-void Sampler::FreePixelSamples(Sample *samples) const
+int Sampler::GetSampleCountForPixel() const
 {
-  delete [] samples;
+  if (adaptive_threshold_ > 0) {
+    // added samples of every pixel the filter overlaps
+    const int XNPIXELS = (xnpxlsmps_ + xrate_ - 1) / xrate_ + 1;
+    const int YNPIXELS = (ynpxlsmps_ + yrate_ - 1) / yrate_ + 1;
+    return xnpxlsmps_ * ynpxlsmps_ +
+        XNPIXELS * YNPIXELS * (max_pixel_samples_ - xrate_ * yrate_);
+  }
+  return xnpxlsmps_ * ynpxlsmps_;
 }
 
 // TODO REMOVE THIS OR MAKE FREE FUNCTION
@@ -209,6 +417,13 @@ int Sampler::GetSampleCountForRegion(const Rectangle &region,
   return xnsamples * ynsamples;
 }
 
+void Sampler::GetSplatMargin(int xrate, int yrate, float xfwidth, float yfwidth,
+    int *xmargin, int *ymargin)
+{
+  *xmargin = (get_pixel_margin(xrate, xfwidth) + xrate - 1) / xrate;
+  *ymargin = (get_pixel_margin(yrate, yfwidth) + yrate - 1) / yrate;
+}
+
 static int get_pixel_margin(int rate, float fwidth)
 {
   return (int) ceil(((fwidth - 1) * rate) * .5);
@@ -216,8 +431,10 @@ static int get_pixel_margin(int rate, float fwidth)
 
 void Sampler::count_samples_in_pixels()
 {
-  xmargin_ = get_pixel_margin(xrate_, xfwidth_);
-  ymargin_ = get_pixel_margin(yrate_, yfwidth_);;
+  xfilter_margin_ = get_pixel_margin(xrate_, xfwidth_);
+  yfilter_margin_ = get_pixel_margin(yrate_, yfwidth_);
+  xmargin_ = splatting_ ? 0 : xfilter_margin_;
+  ymargin_ = splatting_ ? 0 : yfilter_margin_;
   xnpxlsmps_ = xrate_ + 2 * xmargin_;
   ynpxlsmps_ = yrate_ + 2 * ymargin_;
 }
@@ -227,6 +444,85 @@ static int get_sample_count_for_region(int rate, int regionsize, int margin)
   return rate * regionsize + 2 * margin;
 }
 
+static int floor_div(int a, int b)
+{
+  const int q = a / b;
+  return (a % b != 0 && a < 0) ? q - 1 : q;
+}
+
+static bool is_power_of_two(int n)
+{
+  return n > 0 && (n & (n - 1)) == 0;
+}
+
+bool Sampler::GetSplatFootprint(int index, Rectangle *pixels, float *weight) const
+{
+  if (!is_in_stratum(index)) {
+    return false;
+  }
+
+  // the pixels whose filter window of samples has the sample.
+  // the same windows as GetPixelSamples gives for tiles with margins
+  const Sample &sample = samples_[index];
+  const Real xgrid = sample.uv.x * xrate_ * xres_;
+  const Real ygrid = (1 - sample.uv.y) * yrate_ * yres_;
+
+  pixels->xmin = (int) floor((xgrid - xrate_ - xfilter_margin_) / xrate_) + 1;
+  pixels->ymin = (int) floor((ygrid - yrate_ - yfilter_margin_) / yrate_) + 1;
+  pixels->xmax = (int) floor((xgrid + xfilter_margin_) / xrate_) + 1;
+  pixels->ymax = (int) floor((ygrid + yfilter_margin_) / yrate_) + 1;
+
+  *weight = 1;
+  if (!pixel_added_count_.empty()) {
+    int pixel_index = 0;
+    if (index < grid_sample_count_) {
+      const int x = (index % xnsamples_ - xmargin_) / xrate_;
+      const int y = (index / xnsamples_ - ymargin_) / yrate_;
+      pixel_index = y * xnpixels_ + x;
+    } else {
+      pixel_index = added_pixel_[index - grid_sample_count_];
+    }
+    const int BASE_COUNT = xrate_ * yrate_;
+    *weight = BASE_COUNT / (float) (BASE_COUNT + pixel_added_count_[pixel_index]);
+  }
+  return true;
+}
+
+void Sampler::GetSamplePixel(int index, int *pixel_x, int *pixel_y,
+    int *pixel_sample) const
+{
+  if (index >= grid_sample_count_) {
+    const int pixel_index = added_pixel_[index - grid_sample_count_];
+    *pixel_x = xpixel_start_ + pixel_index % xnpixels_;
+    *pixel_y = ypixel_start_ + pixel_index / xnpixels_;
+    *pixel_sample = added_pixel_sample_[index - grid_sample_count_];
+    return;
+  }
+
+  // margin samples belong to pixels out of the region
+  const int x = index % xnsamples_ + xpixel_start_ * xrate_ - xmargin_;
+  const int y = index / xnsamples_ + ypixel_start_ * yrate_ - ymargin_;
+  *pixel_x = floor_div(x, xrate_);
+  *pixel_y = floor_div(y, yrate_);
+  *pixel_sample = (y - *pixel_y * yrate_) * xrate_ + (x - *pixel_x * xrate_);
+}
+
+bool Sampler::is_in_stratum(int index) const
+{
+  if (stratum_ < 0 || index >= grid_sample_count_) {
+    return true;
+  }
+
+  // position in the grid of the whole image so that the stratum
+  // is at the same place in every pixel
+  const int x = index % xnsamples_ + xpixel_start_ * xrate_ - xmargin_;
+  const int y = index / xnsamples_ + ypixel_start_ * yrate_ - ymargin_;
+  const int xstratum = (x % xrate_ + xrate_) % xrate_;
+  const int ystratum = (y % yrate_ + yrate_) % yrate_;
+
+  return ystratum * xrate_ + xstratum == stratum_;
+}
+
 int Sampler::allocate_samples_for_region(const Rectangle &region)
 {
   const int XNSAMPLES = get_sample_count_for_region(xrate_, SizeX(region), xmargin_);
@@ -243,8 +539,252 @@ int Sampler::allocate_samples_for_region(const Rectangle &region)
   ypixel_start_ = YPIXEL_START;
 
   current_index_ = 0;
+  current_block_ = 0;
+
+  grid_sample_count_ = NEW_NSAMPLES;
+  xnpixels_ = SizeX(region);
+  ynpixels_ = SizeY(region);
+  adaptive_round_ = 0;
+  next_added_.clear();
+  added_pixel_.clear();
+  added_pixel_sample_.clear();
+  if (adaptive_threshold_ > 0) {
+    const int NPIXELS = xnpixels_ * ynpixels_;
+    pixel_first_added_.assign(NPIXELS, -1);
+    pixel_added_count_.assign(NPIXELS, 0);
+    pixel_converged_.assign(NPIXELS, 0);
+  } else {
+    pixel_first_added_.clear();
+    pixel_added_count_.clear();
+    pixel_converged_.clear();
+  }
 
   return 0;
 }
 
+// standard error of the mean of the samples in the pixel. luminance is
+// relative to its mean with an offset that keeps noise in dark pixels
+// from asking for samples, alpha catches edges against the background
+float Sampler::compute_pixel_error(int pixel_index) const
+{
+  const int XPIXEL_OFFSET = pixel_index % xnpixels_;
+  const int YPIXEL_OFFSET = pixel_index / xnpixels_;
+  const int OFFSET =
+    (YPIXEL_OFFSET * yrate_ + ymargin_) * xnsamples_ +
+    XPIXEL_OFFSET * xrate_ + xmargin_;
+  double sum_L = 0, sum_LL = 0;
+  double sum_A = 0, sum_AA = 0;
+  int n = 0;
+
+  for (int y = 0; y < yrate_; y++) {
+    for (int x = 0; x < xrate_; x++) {
+      const Color4 &data = samples_[OFFSET + y * xnsamples_ + x].data;
+      const double L = Luminance(Color(data.r, data.g, data.b));
+      sum_L += L;
+      sum_LL += L * L;
+      sum_A += data.a;
+      sum_AA += data.a * data.a;
+      n++;
+    }
+  }
+  for (int i = pixel_first_added_[pixel_index]; i != -1;
+      i = next_added_[i - grid_sample_count_]) {
+    const Color4 &data = samples_[i].data;
+    const double L = Luminance(Color(data.r, data.g, data.b));
+    sum_L += L;
+    sum_LL += L * L;
+    sum_A += data.a;
+    sum_AA += data.a * data.a;
+    n++;
+  }
+
+  if (n < 2) {
+    return 0;
+  }
+
+  const double mean_L = sum_L / n;
+  const double mean_A = sum_A / n;
+  const double var_L = Max(0., (sum_LL - n * mean_L * mean_L) / (n - 1));
+  const double var_A = Max(0., (sum_AA - n * mean_A * mean_A) / (n - 1));
+  const double error_L = sqrt(var_L / n) / (.1 + mean_L);
+  const double error_A = sqrt(var_A / n);
+
+  return Max(error_L, error_A);
+}
+
+void Sampler::generate_jittered_samples()
+{
+  // uv delta. margin samples are out of [0, 1]
+  const Real udelta = 1./(xrate_ * xres_);
+  const Real vdelta = 1./(yrate_ * yres_);
+
+  // xy offset
+  const int xoffset = xpixel_start_ * xrate_ - xmargin_;
+  const int yoffset = ypixel_start_ * yrate_ - ymargin_;
+
+  Sample *sample = &samples_[0];
+
+  for (int y = 0; y < ynsamples_; y++) {
+    for (int x = 0; x < xnsamples_; x++) {
+      // random numbers only depend on the position in the image so that
+      // a sample is the same whichever tile generates it
+      XorShift xr(HashInteger(HashInteger(x + xoffset) ^ (y + yoffset)) ^ seed_);
+
+      Real u =     (.5 + x + xoffset) * udelta;
+      Real v = 1 - (.5 + y + yoffset) * vdelta;
+
+      if (need_jitter_) {
+        const Real u_jitter = XorNextFloat01(&xr) * jitter_;
+        const Real v_jitter = XorNextFloat01(&xr) * jitter_;
+
+        u += udelta * (u_jitter - .5);
+        v += vdelta * (v_jitter - .5);
+      }
+      sample->uv.x = u;
+      sample->uv.y = v;
+
+      if (need_time_sampling_) {
+        const Real rnd = XorNextFloat01(&xr);
+        sample->time = Fit(rnd, 0, 1, sample_time_start_, sample_time_end_);
+      } else {
+        sample->time = 0;
+      }
+
+      sample->data = Color4();
+      sample++;
+    }
+  }
+}
+
+void Sampler::generate_sobol_samples()
+{
+  const Real udelta = 1./(xrate_ * xres_);
+  const Real vdelta = 1./(yrate_ * yres_);
+
+  const int xoffset = xpixel_start_ * xrate_ - xmargin_;
+  const int yoffset = ypixel_start_ * yrate_ - ymargin_;
+
+  // the region can start and end in the middle of the margin pixels
+  const int xpixel_begin = floor_div(xoffset, xrate_);
+  const int ypixel_begin = floor_div(yoffset, yrate_);
+  const int xpixel_end = floor_div(xoffset + xnsamples_ - 1, xrate_) + 1;
+  const int ypixel_end = floor_div(yoffset + ynsamples_ - 1, yrate_) + 1;
+
+  for (int ypixel = ypixel_begin; ypixel < ypixel_end; ypixel++) {
+    for (int xpixel = xpixel_begin; xpixel < xpixel_end; xpixel++) {
+      compute_sobol_pattern(xpixel, ypixel, 0, &pattern_);
+
+      for (int i = 0; i < xrate_ * yrate_; i++) {
+        const int xcell = i % xrate_;
+        const int ycell = i / xrate_;
+        const int x = xpixel * xrate_ + xcell - xoffset;
+        const int y = ypixel * yrate_ + ycell - yoffset;
+
+        if (x < 0 || x >= xnsamples_ || y < 0 || y >= ynsamples_) {
+          continue;
+        }
+
+        const Real u_jitter = .5 + (pattern_[3 * i + 0] - .5) * jitter_;
+        const Real v_jitter = .5 + (pattern_[3 * i + 1] - .5) * jitter_;
+        Sample *sample = &samples_[y * xnsamples_ + x];
+
+        sample->uv.x =     (x + xoffset + u_jitter) * udelta;
+        sample->uv.y = 1 - (y + yoffset + v_jitter) * vdelta;
+        sample->time = Fit(pattern_[3 * i + 2], 0, 1,
+            sample_time_start_, sample_time_end_);
+        sample->data = Color4();
+      }
+    }
+  }
+}
+
+// fills offsets in the cell and time in [0, 1) for each cell of the pixel
+// in the order of the cells. when the rates are powers of two, one point
+// of every 2^m block of the (0, 2)-sequence falls in each cell so
+// positions are stratified over the whole pixel, not only in the cells.
+// otherwise the points are offsets in the cells. times are stratified
+// in a random order of the cells. rounds take the next blocks
+void Sampler::compute_sobol_pattern(int xpixel, int ypixel, int round,
+    std::vector<Real> *pattern) const
+{
+  const int NCELLS = xrate_ * yrate_;
+  const uint32_t pixel_seed = HashInteger(
+      HashInteger(HashInteger(xpixel) ^ ypixel) ^ seed_);
+  const uint32_t seed_x = HashInteger(pixel_seed ^ 1U);
+  const uint32_t seed_y = HashInteger(pixel_seed ^ 2U);
+  const uint32_t seed_t = HashInteger(pixel_seed ^ 3U) + round;
+  const bool stratified = is_power_of_two(xrate_) && is_power_of_two(yrate_);
+  XorShift xr(seed_t);
+
+  pattern->resize(3 * NCELLS);
+
+  for (int i = 0; i < NCELLS; i++) {
+    double x = 0, y = 0;
+    ScrambledSobol2D(round * NCELLS + i, seed_x, seed_y, &x, &y);
+
+    int cell = i;
+    if (stratified) {
+      const int xcell = std::min((int) (x * xrate_), xrate_ - 1);
+      const int ycell = std::min((int) (y * yrate_), yrate_ - 1);
+      cell = ycell * xrate_ + xcell;
+      x = x * xrate_ - xcell;
+      y = y * yrate_ - ycell;
+    }
+
+    const int stratum = PermuteIndex(i, NCELLS, seed_t);
+    (*pattern)[3 * cell + 0] = x;
+    (*pattern)[3 * cell + 1] = y;
+    (*pattern)[3 * cell + 2] = (stratum + XorNextFloat01(&xr)) / NCELLS;
+  }
+}
+
+// adds samples stratified on the same grid as the pixel samples
+void Sampler::add_pixel_samples(int pixel_index, int round)
+{
+  const int XPIXEL_OFFSET = pixel_index % xnpixels_;
+  const int YPIXEL_OFFSET = pixel_index / xnpixels_;
+  const int XPIXEL = xpixel_start_ + XPIXEL_OFFSET;
+  const int YPIXEL = ypixel_start_ + YPIXEL_OFFSET;
+  XorShift xr((unsigned int) (YPIXEL * xres_ + XPIXEL) * 64U + round);
+
+  const Real udelta = 1./(xrate_ * xres_);
+  const Real vdelta = 1./(yrate_ * yres_);
+  const int xoffset = XPIXEL * xrate_;
+  const int yoffset = YPIXEL * yrate_;
+
+  // the next block of the sequence keeps the pixel stratified
+  if (sampler_type_ == SMP_SOBOL) {
+    compute_sobol_pattern(XPIXEL, YPIXEL, round + 1, &pattern_);
+  }
+
+  for (int y = 0; y < yrate_; y++) {
+    for (int x = 0; x < xrate_; x++) {
+      Sample sample;
+
+      if (sampler_type_ == SMP_SOBOL) {
+        const Real *cell = &pattern_[3 * (y * xrate_ + x)];
+        sample.uv.x =     (x + xoffset + cell[0]) * udelta;
+        sample.uv.y = 1 - (y + yoffset + cell[1]) * vdelta;
+        sample.time = Fit(cell[2], 0, 1, sample_time_start_, sample_time_end_);
+      } else {
+        sample.uv.x =     (x + xoffset + XorNextFloat01(&xr)) * udelta;
+        sample.uv.y = 1 - (y + yoffset + XorNextFloat01(&xr)) * vdelta;
+
+        if (need_time_sampling_) {
+          const Real rnd = XorNextFloat01(&xr);
+          sample.time = Fit(rnd, 0, 1, sample_time_start_, sample_time_end_);
+        }
+      }
+
+      next_added_.push_back(pixel_first_added_[pixel_index]);
+      added_pixel_.push_back(pixel_index);
+      added_pixel_sample_.push_back(
+          xrate_ * yrate_ + pixel_added_count_[pixel_index] + y * xrate_ + x);
+      pixel_first_added_[pixel_index] = samples_.size();
+      samples_.push_back(sample);
+    }
+  }
+  pixel_added_count_[pixel_index] += xrate_ * yrate_;
+}
+
 } // namespace xxx
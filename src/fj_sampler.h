@@ -5,6 +5,7 @@
 #define FJ_SAMPLER_H
 
 #include "fj_vector.h"
+#include "fj_color.h"
 #include "fj_types.h"
 #include <vector>
 
@@ -12,15 +13,33 @@ namespace fj {
 
 class Rectangle;
 
+enum {
+  SMP_JITTERED = 0,
+  SMP_SOBOL
+};
+
+// a float is precise to 1e-7 in the screen, far under a sample
+// even at 16 x 16 pixel samples in 8K images
+class SampleUV {
+public:
+  SampleUV() : x(0), y(0) {}
+  ~SampleUV() {}
+
+  float x, y;
+};
+
+// floats halve the memory the sampler streams for every tile
 class Sample {
 public:
   Sample() : uv(), time(0), data() {}
   ~Sample() {}
 
+  Vector2 GetUV() const { return Vector2(uv.x, uv.y); }
+
 public:
-  Vector2 uv;
-  Real time;
-  Vector4 data;
+  SampleUV uv;
+  float time;
+  Color4 data;
 };
 
 class Sampler {
@@ -31,32 +50,83 @@ public:
   void Initialize(int xres, int yres,
       int xsamples, int ysamples, float xfwidth, float yfwidth);
 
+  // SMP_JITTERED jitters each sample in its cell of the pixel.
+  // SMP_SOBOL takes the pixel samples from a scrambled Sobol sequence
+  // and stratifies the times. patterns are scrambled per pixel
+  void SetSamplerType(int sampler_type);
+  // changes the scrambling of every pixel
+  void SetSeed(int seed);
   void SetJitter(float jitter);
   void SetSampleTimeRange(Real start_time, Real end_time);
+  // adds samples to pixels with more error than threshold up to
+  // max_pixel_samples in each pixel. 0 threshold turns it off
+  void SetAdaptiveSampling(float threshold, int max_pixel_samples);
+  // regions have no margin samples for the filter so that each sample
+  // is taken once in the image. reconstruction splats samples instead
+  void SetSplatting(bool enable);
+  // limits samples to the one at the stratum in every pixel, which is
+  // y * xsamples + x in the grid of the pixel. -1 takes all samples
+  void SetStratum(int stratum);
 
   // interfaces for a region
   int GenerateSamples(const Rectangle &pixel_bounds);
+  // appends samples to the pixels whose samples so far have more error
+  // than the threshold. they come after the samples already taken.
+  // returns the number of samples added
+  int GenerateAdaptiveSamples();
   int GetSampleCount() const;
+  int GetGridSampleCount() const;
+  int GetNextSampleIndex() const;
   Sample *GetNextSample();
-  void GetPixelSamples(Sample *pixelsamples, int pixel_x, int pixel_y) const;
+  const Sample &GetSample(int index) const;
+  // fills the next block of block_size x block_size samples in the region
+  // and their indices in the order of GetNextSample. returns the number of
+  // samples in the block, 0 when all blocks are done
+  int GetNextSampleBlock(int block_size, Sample **block, int *indices);
+  // returns the number of samples including the added ones in the filter.
+  // weights get the share of each sample when they are not NULL.
+  // samples out of the stratum get 0
+  // pixelsamples point to the samples in the sampler
+  int GetPixelSamples(const Sample **pixelsamples, int pixel_x, int pixel_y,
+      float *weights = NULL) const;
+  // the number of samples taken inside the pixel
+  int GetSpentSampleCount(int pixel_x, int pixel_y) const;
+
+  // the pixels the sample contributes to and its share. returns false
+  // when the sample is out of the stratum
+  bool GetSplatFootprint(int index, Rectangle *pixels, float *weight) const;
+  // the pixel in the image the sample is in and its number in the pixel.
+  // the same sample has the same numbers whichever region takes it
+  void GetSamplePixel(int index, int *pixel_x, int *pixel_y, int *pixel_sample) const;
 
   // interfaces for a pixel
-  Sample *AllocatePixelSamples();
   int GetSampleCountForPixel() const;
-  void FreePixelSamples(Sample *samples) const;
 
   static int GetSampleCountForRegion(const Rectangle &region,
       int xrate, int yrate, float xfwidth, float yfwidth);
+  // how many pixels a sample reaches out of its pixel
+  static void GetSplatMargin(int xrate, int yrate, float xfwidth, float yfwidth,
+      int *xmargin, int *ymargin);
 
 private:
   void count_samples_in_pixels();
   int allocate_samples_for_region(const Rectangle &region);
+  float compute_pixel_error(int pixel_index) const;
+  void add_pixel_samples(int pixel_index, int round);
+  void generate_jittered_samples();
+  void generate_sobol_samples();
+  void compute_sobol_pattern(int xpixel, int ypixel, int round,
+      std::vector<Real> *pattern) const;
+  bool is_in_stratum(int index) const;
 
   int xres_, yres_;
   int xrate_, yrate_;
   float xfwidth_, yfwidth_;
   float jitter_;
+  int sampler_type_;
+  unsigned int seed_;
   std::vector<Sample> samples_;
+  std::vector<Real> pattern_;
 
   int xnsamples_, ynsamples_;
   int xpixel_start_, ypixel_start_;
@@ -64,12 +134,30 @@ private:
   int xnpxlsmps_, ynpxlsmps_;
 
   int current_index_;
+  int current_block_;
 
   int need_jitter_;
   int need_time_sampling_;
 
   Real sample_time_start_;
   Real sample_time_end_;
+
+  // adaptive sampling. added samples of a pixel are linked by index
+  float adaptive_threshold_;
+  int max_pixel_samples_;
+  int grid_sample_count_;
+  int xnpixels_, ynpixels_;
+  int adaptive_round_;
+  std::vector<int> pixel_first_added_;
+  std::vector<int> pixel_added_count_;
+  std::vector<char> pixel_converged_; // under the threshold in the round
+  std::vector<int> next_added_;
+  std::vector<int> added_pixel_;
+  std::vector<int> added_pixel_sample_;
+
+  int stratum_;
+  bool splatting_;
+  int xfilter_margin_, yfilter_margin_;
 };
 
 } // namespace xxx
@@ -4,6 +4,8 @@
 #include "fj_scene_interface.h"
 #include "fj_volume_accelerator.h"
 #include "fj_framebuffer_io.h"
+#include "fj_filter.h"
+#include "fj_sampler.h"
 #include "fj_point_cloud_io.h"
 #include "fj_primitive_set.h"
 #include "fj_multi_thread.h"
@@ -1115,6 +1117,58 @@ static void build_accelerators(void)
   printf("#   %dh %dm %ds\n\n", elapse.hour, elapse.min, elapse.sec);
 }
 
+static const char *storage_name(int storage)
+{
+  switch (storage) {
+  case VOX_FLOAT: return "Float";
+  case VOX_HALF:  return "Half";
+  case VOX_BYTE:  return "Byte";
+  default:        return "Unknown";
+  }
+}
+
+static void prepare_volumes(void)
+{
+  const int NVOLUMES = get_scene()->GetVolumeCount();
+  double memory = 0;
+  double float_memory = 0;
+  double dense_memory = 0;
+  int i;
+
+  if (NVOLUMES == 0) {
+    return;
+  }
+
+  printf("# Volumes\n");
+  printf("#   Volume Count: %d\n", NVOLUMES);
+
+  for (i = 0; i < NVOLUMES; i++) {
+    Volume *volume = get_scene()->GetVolume(i);
+    int xres, yres, zres;
+
+    float_memory += volume->GetMemoryUsage();
+    volume->Compress();
+    volume->BuildMacroGrid();
+
+    volume->GetResolution(&xres, &yres, &zres);
+    memory += volume->GetMemoryUsage();
+    dense_memory += (double) xres * yres * zres * sizeof(float);
+
+    if (volume->GetStorage() != VOX_FLOAT) {
+      double max_error, rms_error;
+      volume->GetStorageError(&max_error, &rms_error);
+      printf("#   Volume %d Storage: %s (Max Error %g, RMS Error %g)\n",
+          i, storage_name(volume->GetStorage()), max_error, rms_error);
+    }
+  }
+
+  printf("#   Voxel Memory: %.1f MB (Float %.1f MB, Dense %.1f MB)\n",
+      memory / (1024 * 1024),
+      float_memory / (1024 * 1024),
+      dense_memory / (1024 * 1024));
+  printf("\n");
+}
+
 static int prepare_render(const Renderer *renderer)
 {
   int err = 0;
@@ -1131,6 +1185,7 @@ static int prepare_render(const Renderer *renderer)
   }
 
   build_accelerators();
+  prepare_volumes();
 
   return 0;
 }
@@ -66,6 +66,18 @@ void Shader::Evaluate(const TraceContext &cxt, const SurfaceInput &in,
   vptr_->MyEvaluate(self_, &cxt, &in, out);
 }
 
+void Shader::EvaluateBatch(const TraceContext *cxts, const SurfaceInput *ins,
+    SurfaceOutput *outs, int count) const
+{
+  if (vptr_ != NULL && vptr_->MyEvaluateBatch != NULL) {
+    vptr_->MyEvaluateBatch(self_, cxts, ins, outs, count);
+    return;
+  }
+  for (int i = 0; i < count; i++) {
+    Evaluate(cxts[i], ins[i], &outs[i]);
+  }
+}
+
 const Property *Shader::GetPropertyList() const
 {
   // TODO need NullPlugin?
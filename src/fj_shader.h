@@ -20,6 +20,10 @@ class FJ_API ShaderFunctionTable {
 public:
   void (*MyEvaluate)(const void *self, const TraceContext *cxt,
       const SurfaceInput *in, SurfaceOutput *out);
+  // optional. evaluates count surfaces that share the shader at once.
+  // each surface has its own context. NULL falls back to MyEvaluate
+  void (*MyEvaluateBatch)(const void *self, const TraceContext *cxts,
+      const SurfaceInput *ins, SurfaceOutput *outs, int count);
 };
 
 enum ShdErrorNo {
@@ -37,6 +41,8 @@ public:
 
   int Initialize(const Plugin *plugin);
   void Evaluate(const TraceContext &cxt, const SurfaceInput &in, SurfaceOutput *out) const;
+  void EvaluateBatch(const TraceContext *cxts, const SurfaceInput *ins,
+      SurfaceOutput *outs, int count) const;
 
   const Property *GetPropertyList() const;
   int SetProperty(const std::string &prop_name, const PropertyValue &src_data) const;
@@ -6,16 +6,20 @@
 #include "fj_object_instance.h"
 #include "fj_intersection.h"
 #include "fj_object_group.h"
+#include "fj_memory_arena.h"
 #include "fj_accelerator.h"
+#include "fj_light_tree.h"
 #include "fj_interval.h"
 #include "fj_numeric.h"
 #include "fj_shader.h"
 #include "fj_volume.h"
 #include "fj_light.h"
+#include "fj_ray_packet.h"
 #include "fj_ray.h"
 
 #include <cassert>
 #include <cstdio>
+#include <new>
 #include <cfloat>
 #include <cmath>
 
@@ -24,6 +28,8 @@ namespace fj {
 static const Color NO_SHADER_COLOR(.5, 1., 0.);
 
 static int has_reached_bounce_limit(const TraceContext *cxt);
+static bool survives_roulette(const TraceContext *cxt, float *survival);
+static void count_ray(const TraceContext *cxt, int ray_count);
 static int shadow_ray_has_reached_opcity_limit(const TraceContext *cxt, float opac);
 static void setup_ray(const Vector *ray_orig, const Vector *ray_dir,
     double ray_tmin, double ray_tmax,
@@ -33,10 +39,28 @@ static void setup_surface_input(
     const Ray *ray,
     SurfaceInput *in);
 
-static int trace_surface(const TraceContext *cxt, const Ray &ray,
+static int trace_intersection(const TraceContext *cxt, const Ray &ray,
+    const Intersection &isect, int hit_surface, const SurfaceOutput *shaded,
+    Color4 *out_rgba, double *t_hit);
+static int shade_surface(const TraceContext *cxt, const Ray &ray,
+    const Intersection &isect, int hit, const SurfaceOutput *shaded,
     Color4 *out_rgba, double *t_hit);
 static int raymarch_volume(const TraceContext *cxt, const Ray *ray,
     Color4 *out_rgba);
+static Real find_empty_span(const IntervalList &intervals, const Vector &P,
+    const Vector &dir, Real time, Real *occupied);
+static LightSample *new_light_sample_array(const TraceContext *cxt, int count);
+static void free_light_sample_array(const TraceContext *cxt, LightSample *samples);
+static int light_sample_count(const TraceContext *cxt, const Light *light);
+static int get_light_samples(const TraceContext *cxt, const Light *light,
+    const SurfaceInput *in, XorShift *rng, LightSample *samples);
+static void resample_light_samples(const TraceContext *cxt, const Light *light,
+    const SurfaceInput *in, XorShift *rng, LightSample *samples, int count);
+static bool use_light_tree(const TraceContext *cxt,
+    const Light **lights, int nlights);
+static void pick_light_samples(const TraceContext *cxt,
+    const Light **lights, int nlights,
+    const SurfaceInput *in, XorShift *rng, LightSample *samples);
 
 void SlFaceforward(const Vector *I, const Vector *N, Vector *Nf)
 {
@@ -140,11 +164,10 @@ int SlTrace(const TraceContext *cxt,
     const Vector *ray_orig, const Vector *ray_dir,
     double ray_tmin, double ray_tmax, Color4 *out_rgba, double *t_hit)
 {
+  const Accelerator *acc = NULL;
+  Intersection isect;
   Ray ray;
-  Color4 surface_color;
-  Color4 volume_color;
   int hit_surface = 0;
-  int hit_volume = 0;
 
   out_rgba->r = 0;
   out_rgba->g = 0;
@@ -154,27 +177,82 @@ int SlTrace(const TraceContext *cxt,
     return 0;
   }
 
+  float survival = 1;
+  if (!survives_roulette(cxt, &survival)) {
+    return 0;
+  }
+  count_ray(cxt, 1);
+
   setup_ray(ray_orig, ray_dir, ray_tmin, ray_tmax, &ray);
+  ray.lod_footprint = cxt->lod_footprint;
 
-  hit_surface = trace_surface(cxt, ray, &surface_color, t_hit);
+  acc = cxt->trace_target->GetSurfaceAccelerator();
+  hit_surface = acc->Intersect(ray, cxt->time, &isect);
 
-  if (shadow_ray_has_reached_opcity_limit(cxt, surface_color.a)) {
-    *out_rgba = surface_color;
-    return 1;
+  if (survival == 1) {
+    return trace_intersection(cxt, ray, isect, hit_surface, NULL, out_rgba, t_hit);
   }
 
-  if (hit_surface) {
-    ray.tmax = *t_hit;
+  // survivors carry the share of the terminated rays
+  TraceContext surv_cxt = *cxt;
+  surv_cxt.throughput /= survival;
+
+  const int hit = trace_intersection(&surv_cxt, ray, isect, hit_surface, NULL,
+      out_rgba, t_hit);
+  const float inv_survival = 1 / survival;
+  out_rgba->r *= inv_survival;
+  out_rgba->g *= inv_survival;
+  out_rgba->b *= inv_survival;
+  out_rgba->a *= inv_survival;
+
+  return hit;
+}
+
+int SlSurfacePacketIntersect(const TraceContext *cxt,
+    const RayPacket *packet, Intersection *isects)
+{
+  const Accelerator *acc = cxt->trace_target->GetSurfaceAccelerator();
+
+  count_ray(cxt, packet->count);
+  return acc->IntersectPacket(*packet, isects);
+}
+
+int SlTraceIntersection(const TraceContext *cxt,
+    const Ray *ray, const Intersection *isect,
+    Color4 *out_rgba, double *t_hit)
+{
+  out_rgba->r = 0;
+  out_rgba->g = 0;
+  out_rgba->b = 0;
+  out_rgba->a = 0;
+  if (has_reached_bounce_limit(cxt)) {
+    return 0;
   }
 
-  hit_volume = raymarch_volume(cxt, &ray, &volume_color);
+  return trace_intersection(cxt, *ray, *isect, isect->object != NULL, NULL,
+      out_rgba, t_hit);
+}
 
-  out_rgba->r = volume_color.r + surface_color.r * (1 - volume_color.a);
-  out_rgba->g = volume_color.g + surface_color.g * (1 - volume_color.a);
-  out_rgba->b = volume_color.b + surface_color.b * (1 - volume_color.a);
-  out_rgba->a = volume_color.a + surface_color.a * (1 - volume_color.a);
+void SlSetupSurfaceInput(const Ray *ray, const Intersection *isect,
+    SurfaceInput *in)
+{
+  setup_surface_input(isect, ray, in);
+}
 
-  return hit_surface || hit_volume;
+int SlTraceShadedIntersection(const TraceContext *cxt,
+    const Ray *ray, const Intersection *isect, const SurfaceOutput *shaded,
+    Color4 *out_rgba, double *t_hit)
+{
+  out_rgba->r = 0;
+  out_rgba->g = 0;
+  out_rgba->b = 0;
+  out_rgba->a = 0;
+  if (has_reached_bounce_limit(cxt)) {
+    return 0;
+  }
+
+  return trace_intersection(cxt, *ray, *isect, isect->object != NULL, shaded,
+      out_rgba, t_hit);
 }
 
 int SlSurfaceRayIntersect(const TraceContext *cxt,
@@ -188,6 +266,7 @@ int SlSurfaceRayIntersect(const TraceContext *cxt,
   int hit = 0;
 
   setup_ray(ray_orig, ray_dir, ray_tmin, ray_tmax, &ray);
+  ray.lod_footprint = cxt->lod_footprint;
   acc = cxt->trace_target->GetSurfaceAccelerator();
   hit = acc->Intersect(ray, cxt->time, &isect);
 
@@ -220,6 +299,17 @@ TraceContext SlCameraContext(const ObjectGroup *target)
   cxt.raymarch_reflect_step = .05;
   cxt.raymarch_refract_step = .05;
 
+  cxt.lod_footprint = 0;
+
+  cxt.arena = NULL;
+  cxt.rng = NULL;
+  cxt.light_tree = NULL;
+  cxt.dome_sample_budget = 0;
+
+  cxt.throughput = 1;
+  cxt.roulette_threshold = 0;
+  cxt.ray_counts = NULL;
+
   return cxt;
 }
 
@@ -271,6 +361,11 @@ TraceContext SlSelfHitContext(const TraceContext *cxt,
   return self_cxt;
 }
 
+void SlScaleThroughput(TraceContext *cxt, double weight)
+{
+  cxt->throughput *= Max(0., weight);
+}
+
 int SlGetLightCount(const SurfaceInput *in)
 {
   return in->shaded_object->GetLightCount();
@@ -308,6 +403,7 @@ int SlIlluminance(const TraceContext *cxt, const LightSample *sample,
   }
 
   light_color = sample->light->Illuminate(*sample, *Ps);
+  light_color *= sample->weight;
   if (light_color.r < .0001 &&
     light_color.g < .0001 &&
     light_color.b < .0001) {
@@ -342,7 +438,7 @@ int SlIlluminance(const TraceContext *cxt, const LightSample *sample,
 }
 
   // TODO temp solution compute before rendering
-int SlGetLightSampleCount(const SurfaceInput *in)
+int SlGetLightSampleCount(const TraceContext *cxt, const SurfaceInput *in)
 {
   const Light **lights = in->shaded_object->GetLightList();
   const int nlights = SlGetLightCount(in);
@@ -353,44 +449,66 @@ int SlGetLightSampleCount(const SurfaceInput *in)
     return 0;
   }
 
+  if (use_light_tree(cxt, lights, nlights)) {
+    // dome lights are not in the tree
+    for (i = 0; i < nlights; i++) {
+      if (lights[i]->type_ == LGT_DOME) {
+        nsamples += light_sample_count(cxt, lights[i]);
+      }
+    }
+    return nsamples + cxt->light_tree->GetSampleBudget();
+  }
+
   for (i = 0; i < nlights; i++) {
-    nsamples += lights[i]->GetSampleCount();
+    nsamples += light_sample_count(cxt, lights[i]);
   }
 
   return nsamples;
 }
 
-LightSample *SlNewLightSamples(const SurfaceInput *in)
+LightSample *SlNewLightSamples(const TraceContext *cxt,
+    const SurfaceInput *in)
 {
   const Light **lights = in->shaded_object->GetLightList();
   const int nlights = SlGetLightCount(in);
-  const int nsamples = SlGetLightSampleCount(in);
+  const int nsamples = SlGetLightSampleCount(cxt, in);
   int i;
 
   LightSample *samples = NULL;
   LightSample *sample = NULL;
 
+  // a fixed stream for traces made outside of render workers
+  XorShift fallback_rng;
+  XorShift *rng = cxt->rng;
+
   if (nsamples == 0) {
     // TODO handling
     return NULL;
   }
 
-  samples = new LightSample[nsamples];
+  if (rng == NULL) {
+    XorInit(&fallback_rng);
+    rng = &fallback_rng;
+  }
+
+  samples = new_light_sample_array(cxt, nsamples);
   sample = samples;
+
+  if (use_light_tree(cxt, lights, nlights)) {
+    pick_light_samples(cxt, lights, nlights, in, rng, sample);
+    return samples;
+  }
+
   for (i = 0; i < nlights; i++) {
-    const int nsmp = lights[i]->GetSampleCount();
-    lights[i]->GetSamples(sample, nsmp);
-    sample += nsmp;
+    sample += get_light_samples(cxt, lights[i], in, rng, sample);
   }
 
   return samples;
 }
 
-void SlFreeLightSamples(LightSample * samples)
+void SlFreeLightSamples(const TraceContext *cxt, LightSample *samples)
 {
-  if (samples == NULL)
-    return;
-  delete [] samples;
+  free_light_sample_array(cxt, samples);
 }
 
 #define MUL(a,val) do { \
@@ -477,6 +595,37 @@ static int has_reached_bounce_limit(const TraceContext *cxt)
   return current_depth > max_depth;
 }
 
+// Russian roulette. without a random stream the ray is always traced
+static bool survives_roulette(const TraceContext *cxt, float *survival)
+{
+  *survival = 1;
+
+  if (cxt->ray_context != CXT_REFLECT_RAY &&
+      cxt->ray_context != CXT_REFRACT_RAY) {
+    return true;
+  }
+  if (cxt->throughput >= cxt->roulette_threshold || cxt->rng == NULL) {
+    return true;
+  }
+
+  *survival = cxt->throughput / cxt->roulette_threshold;
+  if (*survival > 0 && XorNextFloat01(cxt->rng) < *survival) {
+    return true;
+  }
+
+  if (cxt->ray_counts != NULL) {
+    cxt->ray_counts->terminated++;
+  }
+  return false;
+}
+
+static void count_ray(const TraceContext *cxt, int ray_count)
+{
+  if (cxt->ray_counts != NULL) {
+    cxt->ray_counts->traced[cxt->ray_context] += ray_count;
+  }
+}
+
 static void setup_ray(const Vector *ray_orig, const Vector *ray_dir,
     double ray_tmin, double ray_tmax,
     Ray *ray)
@@ -503,19 +652,45 @@ static void setup_surface_input(
   in->dPdv = isect->dPdv;
 }
 
-static int trace_surface(const TraceContext *cxt, const Ray &ray,
+static int trace_intersection(const TraceContext *cxt, const Ray &surface_ray,
+    const Intersection &isect, int hit_surface, const SurfaceOutput *shaded,
     Color4 *out_rgba, double *t_hit)
 {
-  const Accelerator *acc = NULL;
-  Intersection isect;
-  int hit = 0;
+  Ray ray = surface_ray;
+  Color4 surface_color;
+  Color4 volume_color;
+  int hit_volume = 0;
+
+  hit_surface = shade_surface(cxt, ray, isect, hit_surface, shaded,
+      &surface_color, t_hit);
 
+  if (shadow_ray_has_reached_opcity_limit(cxt, surface_color.a)) {
+    *out_rgba = surface_color;
+    return 1;
+  }
+
+  if (hit_surface) {
+    ray.tmax = *t_hit;
+  }
+
+  hit_volume = raymarch_volume(cxt, &ray, &volume_color);
+
+  out_rgba->r = volume_color.r + surface_color.r * (1 - volume_color.a);
+  out_rgba->g = volume_color.g + surface_color.g * (1 - volume_color.a);
+  out_rgba->b = volume_color.b + surface_color.b * (1 - volume_color.a);
+  out_rgba->a = volume_color.a + surface_color.a * (1 - volume_color.a);
+
+  return hit_surface || hit_volume;
+}
+
+static int shade_surface(const TraceContext *cxt, const Ray &ray,
+    const Intersection &isect, int hit, const SurfaceOutput *shaded,
+    Color4 *out_rgba, double *t_hit)
+{
   out_rgba->r = 0;
   out_rgba->g = 0;
   out_rgba->b = 0;
   out_rgba->a = 0;
-  acc = cxt->trace_target->GetSurfaceAccelerator();
-  hit = acc->Intersect(ray, cxt->time, &isect);
 
   // TODO handle shadow ray for surface geometry
 #if 0
@@ -528,14 +703,19 @@ static int trace_surface(const TraceContext *cxt, const Ray &ray,
     SurfaceInput in;
     SurfaceOutput out;
 
-    setup_surface_input(&isect, &ray, &in);
-
-    const Shader *shader = isect.GetShader();
-    if (shader != NULL) {
-      shader->Evaluate(*cxt, in, &out);
+    if (shaded != NULL) {
+      // already evaluated in a batch
+      out = *shaded;
     } else {
-      out.Cs = NO_SHADER_COLOR;
-      out.Os = 1;
+      setup_surface_input(&isect, &ray, &in);
+
+      const Shader *shader = isect.GetShader();
+      if (shader != NULL) {
+        shader->Evaluate(*cxt, in, &out);
+      } else {
+        out.Cs = NO_SHADER_COLOR;
+        out.Os = 1;
+      }
     }
 
     out.Os = Clamp(out.Os, 0, 1);
@@ -554,7 +734,7 @@ static int raymarch_volume(const TraceContext *cxt, const Ray *ray,
     Color4 *out_rgba)
 {
   const VolumeAccelerator *acc = NULL;
-  IntervalList intervals;
+  IntervalList intervals(cxt->arena);
   int hit = 0;
 
   out_rgba->r = 0;
@@ -610,16 +790,42 @@ static int raymarch_volume(const TraceContext *cxt, const Ray *ray,
     ray_delta.z = t_delta * ray->dir.z;
     t = t_start;
 
+    // no need to look for empty space again until t passes this
+    double t_occupied = t_start;
+    long sample_count = 0;
+
     // raymarch
     while (t <= t_limit && out_rgba->a < opacity_threshold) {
       const Interval *interval = intervals.GetHead();
       Color color;
       float opacity = 0;
 
+      // jumps over empty space by whole steps so that the samples
+      // after it are the same as without jumping
+      if (t >= t_occupied) {
+        Real occupied = 0;
+        const Real empty = find_empty_span(intervals, P, ray->dir, cxt->time,
+            &occupied);
+
+        if (empty >= t_delta) {
+          const double nsteps = floor(empty / t_delta);
+          if (t + nsteps * t_delta > t_limit) {
+            break;
+          }
+          P.x += nsteps * ray_delta.x;
+          P.y += nsteps * ray_delta.y;
+          P.z += nsteps * ray_delta.z;
+          t += nsteps * t_delta;
+          continue;
+        }
+        t_occupied = t + occupied;
+      }
+
       // loop over volume candidates at this sample point
       for (; interval != NULL; interval = interval->next) {
         VolumeSample sample;
         interval->object->GetVolumeSample(P, cxt->time, &sample);
+        sample_count++;
 
         // merge volume with max density
         opacity = Max(opacity, t_delta * sample.density);
@@ -662,12 +868,39 @@ static int raymarch_volume(const TraceContext *cxt, const Ray *ray,
     if (out_rgba->a >= opacity_threshold) {
       out_rgba->a = 1;
     }
+    if (cxt->ray_counts != NULL) {
+      cxt->ray_counts->volume_samples += sample_count;
+    }
   }
   out_rgba->a = Clamp(out_rgba->a, 0, 1);
 
   return hit;
 }
 
+// all volumes have to be empty to skip. when one of them is not, looks
+// again after all of them can have left their dense cells
+static Real find_empty_span(const IntervalList &intervals, const Vector &P,
+    const Vector &dir, Real time, Real *occupied)
+{
+  Real empty = REAL_MAX;
+  Real dense = 0;
+
+  for (const Interval *interval = intervals.GetHead();
+      interval != NULL; interval = interval->next) {
+    Real object_occupied = 0;
+    const Real object_empty = interval->object->GetVolumeEmptySpan(
+        P, dir, time, &object_occupied);
+
+    empty = Min(empty, object_empty);
+    if (object_empty == 0) {
+      dense = Max(dense, object_occupied);
+    }
+  }
+
+  *occupied = dense;
+  return empty;
+}
+
 static int shadow_ray_has_reached_opcity_limit(const TraceContext *cxt, float opac)
 {
   if (cxt->ray_context == CXT_SHADOW_RAY && opac > cxt->opacity_threshold) {
@@ -677,4 +910,154 @@ static int shadow_ray_has_reached_opcity_limit(const TraceContext *cxt, float op
   }
 }
 
+static LightSample *new_light_sample_array(const TraceContext *cxt, int count)
+{
+  LightSample *samples = NULL;
+
+  if (cxt->arena != NULL) {
+    samples = static_cast<LightSample *>(
+        cxt->arena->Allocate(sizeof(LightSample) * count));
+    for (int i = 0; i < count; i++) {
+      new (&samples[i]) LightSample();
+    }
+  } else {
+    samples = new LightSample[count];
+  }
+  return samples;
+}
+
+static void free_light_sample_array(const TraceContext *cxt, LightSample *samples)
+{
+  if (samples == NULL)
+    return;
+
+  // LightSample has nothing to destruct
+  if (cxt->arena != NULL) {
+    cxt->arena->Release(samples);
+  } else {
+    delete [] samples;
+  }
+}
+
+static int light_sample_count(const TraceContext *cxt, const Light *light)
+{
+  const int nsamples = light->GetSampleCount();
+
+  if (light->type_ == LGT_DOME && cxt->dome_sample_budget > 0) {
+    return Min(nsamples, cxt->dome_sample_budget);
+  }
+  return nsamples;
+}
+
+static int get_light_samples(const TraceContext *cxt, const Light *light,
+    const SurfaceInput *in, XorShift *rng, LightSample *samples)
+{
+  const int nsamples = light->GetSampleCount();
+  const int count = light_sample_count(cxt, light);
+
+  if (count < nsamples) {
+    resample_light_samples(cxt, light, in, rng, samples, count);
+  } else {
+    light->GetSamples(samples, nsamples, rng);
+  }
+  return count;
+}
+
+// resampled importance sampling. every sample of the light is a candidate
+// weighted by its contribution without visibility, then only count of them
+// are picked to trace shadow rays. the cosine term is mixed with a constant
+// so that shaders not lit by cosine (hair, volumes) still get all candidates
+static void resample_light_samples(const TraceContext *cxt, const Light *light,
+    const SurfaceInput *in, XorShift *rng, LightSample *samples, int count)
+{
+  const int NCANDIDATES = light->GetSampleCount();
+  LightSample *candidates = new_light_sample_array(cxt, NCANDIDATES);
+  Real sum = 0;
+  Vector Nf;
+
+  light->GetSamples(candidates, NCANDIDATES, rng);
+  SlFaceforward(&in->I, &in->N, &Nf);
+
+  // weight holds the running sum of targets
+  for (int i = 0; i < NCANDIDATES; i++) {
+    const Color Cl = light->Illuminate(candidates[i], in->P);
+    Vector Ln = candidates[i].P - in->P;
+    Normalize(&Ln);
+
+    const Real cosine = Max(Dot(Nf, Ln), 0.);
+    sum += Luminance(Cl) * (.1 + .9 * cosine);
+    candidates[i].weight = sum;
+  }
+
+  for (int k = 0; k < count; k++) {
+    if (sum <= 0) {
+      samples[k] = candidates[k];
+      samples[k].weight = 0;
+      continue;
+    }
+
+    // stratified over the running sum
+    const Real u = (k + XorNextFloat01(rng)) / count * sum;
+    int lo = 0;
+    int hi = NCANDIDATES - 1;
+    while (lo < hi) {
+      const int mid = (lo + hi) / 2;
+      if (candidates[mid].weight <= u) {
+        lo = mid + 1;
+      } else {
+        hi = mid;
+      }
+    }
+
+    const Real target = candidates[lo].weight - (lo > 0 ? candidates[lo - 1].weight : 0);
+    samples[k] = candidates[lo];
+    samples[k].weight = sum / (count * target);
+  }
+
+  free_light_sample_array(cxt, candidates);
+}
+
+static bool use_light_tree(const TraceContext *cxt,
+    const Light **lights, int nlights)
+{
+  const LightTree *tree = cxt->light_tree;
+
+  if (tree == NULL || !tree->IsBuiltFor(lights, nlights)) {
+    return false;
+  }
+  // no need to pick when all samples fit in the budget
+  return tree->GetSampleCount() > tree->GetSampleBudget();
+}
+
+static void pick_light_samples(const TraceContext *cxt,
+    const Light **lights, int nlights,
+    const SurfaceInput *in, XorShift *rng, LightSample *samples)
+{
+  const LightTree *tree = cxt->light_tree;
+  const int BUDGET = tree->GetSampleBudget();
+  LightSample *sample = samples;
+
+  for (int i = 0; i < nlights; i++) {
+    if (lights[i]->type_ == LGT_DOME) {
+      sample += get_light_samples(cxt, lights[i], in, rng, sample);
+    }
+  }
+
+  // each pick takes one of the samples of the light. weight makes up
+  // for the other samples and the lights that are not picked
+  for (int i = 0; i < BUDGET; i++) {
+    Real pdf = 0;
+    const Real u = XorNextFloat01(rng);
+    const Light *light = lights[tree->PickLight(in->P, u, &pdf)];
+
+    light->GetSamples(sample, 1, rng);
+    if (pdf > 0) {
+      sample->weight = light->GetSampleCount() / (BUDGET * pdf);
+    } else {
+      sample->weight = 0;
+    }
+    sample++;
+  }
+}
+
 } // namespace xxx
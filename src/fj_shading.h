@@ -12,8 +12,14 @@
 namespace fj {
 
 class ObjectInstance;
+class Intersection;
+class LightTree;
 class ObjectGroup;
+class RayPacket;
+class MemoryArena;
+class XorShift;
 class Texture;
+class Ray;
 
 enum RayContext {
   CXT_CAMERA_RAY = 0,
@@ -22,6 +28,24 @@ enum RayContext {
   CXT_REFRACT_RAY
 };
 
+// rays traced by a thread for each ray context
+class FJ_API RayCounts {
+public:
+  RayCounts() : traced(), terminated(0), volume_samples(0) {}
+  ~RayCounts() {}
+
+  long GetTotal() const
+  {
+    return traced[0] + traced[1] + traced[2] + traced[3];
+  }
+
+  long traced[CXT_REFRACT_RAY + 1];
+  // secondary rays stopped by russian roulette
+  long terminated;
+  // density lookups of raymarching
+  long volume_samples;
+};
+
 class FJ_API TraceContext {
 public:
   int ray_context;
@@ -39,7 +63,34 @@ public:
   double raymarch_reflect_step;
   double raymarch_refract_step;
 
+  double lod_footprint;
+
   const ObjectGroup *trace_target;
+
+  // per-thread scratch memory. NULL falls back to the heap
+  MemoryArena *arena;
+
+  // per-thread random stream reseeded for every camera sample
+  // so that results do not depend on thread count
+  XorShift *rng;
+
+  // picks a fixed number of lights for each shading point when the
+  // object lights up with the lights in the tree. NULL samples all lights
+  const LightTree *light_tree;
+
+  // resamples each dome light down to this many samples for shadow rays.
+  // 0 uses all samples
+  int dome_sample_budget;
+
+  // how much the ray adds to the pixel. shaders scale it by the weights
+  // of the rays they spawn with SlScaleThroughput
+  float throughput;
+  // reflection and refraction rays under this throughput survive russian
+  // roulette in proportion to it. 0 traces all rays up to the depth limits
+  float roulette_threshold;
+
+  // per-thread ray counts. NULL counts nothing
+  RayCounts *ray_counts;
 };
 
 class FJ_API SurfaceInput {
@@ -86,6 +137,23 @@ FJ_API void SlRefract(const Vector *I, const Vector *N, double ior,
 FJ_API int SlTrace(const TraceContext *cxt,
     const Vector *ray_orig, const Vector *ray_dir,
     double ray_tmin, double ray_tmax, Color4 *out_color, double *t_hit);
+// tracing camera rays in packet. SlSurfacePacketIntersect finds the closest
+// surfaces for all rays at once, then SlTraceIntersection shades each hit
+// the same way SlTrace does
+FJ_API int SlSurfacePacketIntersect(const TraceContext *cxt,
+    const RayPacket *packet, Intersection *isects);
+FJ_API int SlTraceIntersection(const TraceContext *cxt,
+    const Ray *ray, const Intersection *isect,
+    Color4 *out_rgba, double *t_hit);
+// shading hits in batches. shaders are evaluated by the caller with inputs
+// from SlSetupSurfaceInput, then SlTraceShadedIntersection finishes the rest
+// of SlTraceIntersection with the shader output
+FJ_API void SlSetupSurfaceInput(const Ray *ray, const Intersection *isect,
+    SurfaceInput *in);
+FJ_API int SlTraceShadedIntersection(const TraceContext *cxt,
+    const Ray *ray, const Intersection *isect, const SurfaceOutput *shaded,
+    Color4 *out_rgba, double *t_hit);
+
 FJ_API int SlSurfaceRayIntersect(const TraceContext *cxt,
     const Vector *ray_orig, const Vector *ray_dir,
     double ray_tmin, double ray_tmax,
@@ -100,6 +168,8 @@ FJ_API TraceContext SlShadowContext(const TraceContext *cxt,
     const ObjectInstance *obj);
 FJ_API TraceContext SlSelfHitContext(const TraceContext *cxt,
     const ObjectInstance *obj);
+// weight is what the shader multiplies the traced color by
+FJ_API void SlScaleThroughput(TraceContext *cxt, double weight);
 
 // lighting functions
 class LightSample;
@@ -109,9 +179,11 @@ FJ_API int SlIlluminance(const TraceContext *cxt, const LightSample *sample,
     const SurfaceInput *in, LightOutput *out);
 
 FJ_API int SlGetLightCount(const SurfaceInput *in);
-FJ_API int SlGetLightSampleCount(const SurfaceInput *in);
-FJ_API LightSample *SlNewLightSamples(const SurfaceInput *in);
-FJ_API void SlFreeLightSamples(LightSample * samples);
+FJ_API int SlGetLightSampleCount(const TraceContext *cxt,
+    const SurfaceInput *in);
+FJ_API LightSample *SlNewLightSamples(const TraceContext *cxt,
+    const SurfaceInput *in);
+FJ_API void SlFreeLightSamples(const TraceContext *cxt, LightSample *samples);
 
 // texture functions
 FJ_API void SlBumpMapping(const Texture *bump_map,
@@ -148,4 +148,9 @@ int Texture::GetHeight() const
   return cache_list_[0].GetTextureHeight();
 }
 
+const std::string &Texture::GetFilename() const
+{
+  return filename_;
+}
+
 } // namespace xxx
@@ -50,6 +50,7 @@ public:
 
   int GetWidth() const;
   int GetHeight() const;
+  const std::string &GetFilename() const;
 
 private:
   std::string filename_;
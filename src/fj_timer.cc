@@ -2,12 +2,14 @@
 // See LICENSE and README
 
 #include "fj_timer.h"
+#include "fj_os.h"
 
 namespace fj {
 
 void Timer::Start()
 {
   time(&start_time_);
+  start_clock_ = OsGetWallClock();
 }
 
 Elapse Timer::GetElapse() const
@@ -28,4 +30,9 @@ Elapse Timer::GetElapse() const
   return elapse;
 }
 
+double Timer::GetElapsedSeconds() const
+{
+  return OsGetWallClock() - start_clock_;
+}
+
 } // namespace xxx
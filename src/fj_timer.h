@@ -22,14 +22,16 @@ public:
 
 class FJ_API Timer {
 public:
-  Timer() : start_time_(0) {}
+  Timer() : start_time_(0), start_clock_(0) {}
   ~Timer() {}
 
   void Start();
   Elapse GetElapse() const;
+  double GetElapsedSeconds() const;
 
 private:
   time_t start_time_;
+  double start_clock_;
 };
 
 } // namespace xxx
@@ -3,21 +3,58 @@
 
 #include "fj_volume.h"
 #include "fj_numeric.h"
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+#include <cmath>
 
 namespace fj {
 
-VoxelBuffer::VoxelBuffer() : data_(), res_()
+// voxels in a tile and the bits of a voxel index in a tile
+static const int TILE_VOXELS =
+    VoxelBuffer::TILE_SIZE * VoxelBuffer::TILE_SIZE * VoxelBuffer::TILE_SIZE;
+static const int TILE_BITS = 3;
+static const int TILE_MASK = VoxelBuffer::TILE_SIZE - 1;
+
+// a VOX_BYTE tile has the offset and the scale before the voxels
+static const size_t BYTE_TILE_HEADER = 2 * sizeof(float);
+
+static size_t tile_bytes(int storage);
+static void encode_tile(const float *src, int storage, char *dst);
+static float decode_voxel(const char *tile, int storage, int index);
+static uint16_t float_to_half(float value);
+static float half_to_float(uint16_t half);
+
+VoxelBuffer::VoxelBuffer() :
+  tiles_(),
+  res_(),
+  tile_res_(),
+  allocated_tile_count_(0),
+  storage_(VOX_FLOAT),
+  tile_storage_(VOX_FLOAT),
+  max_error_(0),
+  rms_error_(0)
 {
 }
 
 VoxelBuffer::~VoxelBuffer()
 {
+  clear_tiles();
 }
 
 void VoxelBuffer::Resize(int xres, int yres, int zres)
 {
-  data_.resize(xres * yres * zres, 0);
+  clear_tiles();
+
   res_ = Resolution(xres, yres, zres);
+  tile_res_ = Resolution(
+      (xres + TILE_SIZE - 1) / TILE_SIZE,
+      (yres + TILE_SIZE - 1) / TILE_SIZE,
+      (zres + TILE_SIZE - 1) / TILE_SIZE);
+
+  std::vector<char *> tiles(
+      (size_t) tile_res_.x * tile_res_.y * tile_res_.z, (char *) NULL);
+  tiles_.swap(tiles);
 }
 
 const Resolution &VoxelBuffer::GetResolution() const
@@ -27,7 +64,7 @@ const Resolution &VoxelBuffer::GetResolution() const
 
 bool VoxelBuffer::IsEmpty() const
 {
-  return data_.empty();
+  return tiles_.empty();
 }
 
 void VoxelBuffer::SetValue(int x, int y, int z, float value)
@@ -39,8 +76,28 @@ void VoxelBuffer::SetValue(int x, int y, int z, float value)
   if (z < 0 || res_.z <= z)
     return;
 
-  const int64_t index = (z * res_.x * res_.y) + (y * res_.x) + x;
-  data_[index] = value;
+  const size_t tile_index =
+      ((size_t) (z >> TILE_BITS) * tile_res_.y + (y >> TILE_BITS)) * tile_res_.x +
+      (x >> TILE_BITS);
+  if (tiles_[tile_index] == NULL && value == 0) {
+    return;
+  }
+
+  if (tile_storage_ != VOX_FLOAT) {
+    decompress_tiles();
+  }
+
+  float *tile = reinterpret_cast<float *>(tiles_[tile_index]);
+  if (tile == NULL) {
+    tile = new float[TILE_VOXELS];
+    std::fill(tile, tile + TILE_VOXELS, 0.f);
+    tiles_[tile_index] = reinterpret_cast<char *>(tile);
+    allocated_tile_count_++;
+  }
+
+  const int index =
+      ((z & TILE_MASK) << (2 * TILE_BITS)) | ((y & TILE_MASK) << TILE_BITS) | (x & TILE_MASK);
+  tile[index] = value;
 }
 
 float VoxelBuffer::GetValue(int x, int y, int z) const
@@ -52,17 +109,155 @@ float VoxelBuffer::GetValue(int x, int y, int z) const
   if (z < 0 || res_.z <= z)
     return 0;
 
-  const int64_t index = (z * res_.x * res_.y) + (y * res_.x) + x;
-  return data_[index];
+  const size_t tile_index =
+      ((size_t) (z >> TILE_BITS) * tile_res_.y + (y >> TILE_BITS)) * tile_res_.x +
+      (x >> TILE_BITS);
+  const char *tile = tiles_[tile_index];
+
+  if (tile == NULL) {
+    return 0;
+  }
+
+  const int index =
+      ((z & TILE_MASK) << (2 * TILE_BITS)) | ((y & TILE_MASK) << TILE_BITS) | (x & TILE_MASK);
+  return decode_voxel(tile, tile_storage_, index);
+}
+
+const Resolution &VoxelBuffer::GetTileResolution() const
+{
+  return tile_res_;
+}
+
+bool VoxelBuffer::IsTileAllocated(int tile_x, int tile_y, int tile_z) const
+{
+  if (tile_x < 0 || tile_res_.x <= tile_x)
+    return false;
+  if (tile_y < 0 || tile_res_.y <= tile_y)
+    return false;
+  if (tile_z < 0 || tile_res_.z <= tile_z)
+    return false;
+
+  const size_t tile_index =
+      ((size_t) tile_z * tile_res_.y + tile_y) * tile_res_.x + tile_x;
+  return tiles_[tile_index] != NULL;
+}
+
+int VoxelBuffer::GetAllocatedTileCount() const
+{
+  return allocated_tile_count_;
+}
+
+size_t VoxelBuffer::GetMemoryUsage() const
+{
+  return tiles_.capacity() * sizeof(char *) +
+      (size_t) allocated_tile_count_ * tile_bytes(tile_storage_);
+}
+
+void VoxelBuffer::SetStorage(int storage)
+{
+  assert(storage == VOX_FLOAT || storage == VOX_HALF || storage == VOX_BYTE);
+  storage_ = storage;
+}
+
+int VoxelBuffer::GetStorage() const
+{
+  return storage_;
+}
+
+void VoxelBuffer::Compress()
+{
+  if (tile_storage_ == storage_) {
+    return;
+  }
+  if (tile_storage_ != VOX_FLOAT) {
+    decompress_tiles();
+  }
+  max_error_ = 0;
+  rms_error_ = 0;
+  if (storage_ == VOX_FLOAT) {
+    return;
+  }
+
+  double squared_error = 0;
+  size_t voxel_count = 0;
+
+  for (size_t i = 0; i < tiles_.size(); i++) {
+    const float *src = reinterpret_cast<const float *>(tiles_[i]);
+    if (src == NULL) {
+      continue;
+    }
+
+    char *dst = new char[tile_bytes(storage_)];
+    encode_tile(src, storage_, dst);
+
+    for (int j = 0; j < TILE_VOXELS; j++) {
+      const double error = Abs(decode_voxel(dst, storage_, j) - src[j]);
+      max_error_ = Max(max_error_, error);
+      squared_error += error * error;
+    }
+    voxel_count += TILE_VOXELS;
+
+    delete [] tiles_[i];
+    tiles_[i] = dst;
+  }
+  tile_storage_ = storage_;
+
+  if (voxel_count > 0) {
+    rms_error_ = sqrt(squared_error / voxel_count);
+  }
+}
+
+void VoxelBuffer::GetStorageError(double *max_error, double *rms_error) const
+{
+  *max_error = max_error_;
+  *rms_error = rms_error_;
+}
+
+void VoxelBuffer::clear_tiles()
+{
+  for (size_t i = 0; i < tiles_.size(); i++) {
+    delete [] tiles_[i];
+  }
+  tiles_.clear();
+  allocated_tile_count_ = 0;
+  tile_storage_ = VOX_FLOAT;
+  max_error_ = 0;
+  rms_error_ = 0;
+}
+
+void VoxelBuffer::decompress_tiles()
+{
+  for (size_t i = 0; i < tiles_.size(); i++) {
+    const char *src = tiles_[i];
+    if (src == NULL) {
+      continue;
+    }
+
+    float *dst = new float[TILE_VOXELS];
+    for (int j = 0; j < TILE_VOXELS; j++) {
+      dst[j] = decode_voxel(src, tile_storage_, j);
+    }
+
+    delete [] tiles_[i];
+    tiles_[i] = reinterpret_cast<char *>(dst);
+  }
+  tile_storage_ = VOX_FLOAT;
 }
 
 static float trilinear_buffer_value(const VoxelBuffer &buffer, const Vector &P);
 static float nearest_buffer_value(const VoxelBuffer &buffer, const Vector &P);
 
+// voxels on a side of a macro cell
+static const int MACRO_CELL_SIZE = 8;
+static void add_voxel_to_macro_cells(const VoxelBuffer &buffer,
+    const Resolution &macro_res, int x, int y, int z, float *macro_max);
+
 Volume::Volume() :
   buffer_(),
   bounds_(),
-  size_()
+  size_(),
+  macro_max_(),
+  macro_res_()
 {
   compute_filter_size();
 }
@@ -79,6 +274,7 @@ void Volume::Resize(int xres, int yres, int zres)
 
   buffer_.Resize(xres, yres, zres);
   compute_filter_size();
+  macro_max_.clear();
 }
 
 void Volume::SetBounds(const Box &bounds)
@@ -137,6 +333,7 @@ void Volume::SetValue(int x, int y, int z, float value)
     return;
   }
   buffer_.SetValue(x, y, z, value);
+  macro_max_.clear();
 }
 
 float Volume::GetValue(int x, int y, int z) const
@@ -170,6 +367,176 @@ bool Volume::GetSample(const Vector &point, VolumeSample *sample) const
   return true;
 }
 
+size_t Volume::GetMemoryUsage() const
+{
+  return buffer_.GetMemoryUsage();
+}
+
+void Volume::SetStorage(int storage)
+{
+  buffer_.SetStorage(storage);
+}
+
+int Volume::GetStorage() const
+{
+  return buffer_.GetStorage();
+}
+
+void Volume::Compress()
+{
+  buffer_.Compress();
+}
+
+void Volume::GetStorageError(double *max_error, double *rms_error) const
+{
+  buffer_.GetStorageError(max_error, rms_error);
+}
+
+void Volume::BuildMacroGrid()
+{
+  macro_max_.clear();
+  if (buffer_.IsEmpty()) {
+    return;
+  }
+
+  const Resolution &res = buffer_.GetResolution();
+  macro_res_ = Resolution(
+      (res.x + MACRO_CELL_SIZE - 1) / MACRO_CELL_SIZE,
+      (res.y + MACRO_CELL_SIZE - 1) / MACRO_CELL_SIZE,
+      (res.z + MACRO_CELL_SIZE - 1) / MACRO_CELL_SIZE);
+  std::vector<float> macro_max(
+      (size_t) macro_res_.x * macro_res_.y * macro_res_.z, 0);
+
+  // voxels out of allocated tiles are all zero
+  const int TILE_SIZE = VoxelBuffer::TILE_SIZE;
+  const Resolution &tile_res = buffer_.GetTileResolution();
+  for (int tile_z = 0; tile_z < tile_res.z; tile_z++) {
+    for (int tile_y = 0; tile_y < tile_res.y; tile_y++) {
+      for (int tile_x = 0; tile_x < tile_res.x; tile_x++) {
+        if (!buffer_.IsTileAllocated(tile_x, tile_y, tile_z)) {
+          continue;
+        }
+
+        const int xend = std::min((tile_x + 1) * TILE_SIZE, res.x);
+        const int yend = std::min((tile_y + 1) * TILE_SIZE, res.y);
+        const int zend = std::min((tile_z + 1) * TILE_SIZE, res.z);
+        for (int z = tile_z * TILE_SIZE; z < zend; z++) {
+          for (int y = tile_y * TILE_SIZE; y < yend; y++) {
+            for (int x = tile_x * TILE_SIZE; x < xend; x++) {
+              add_voxel_to_macro_cells(buffer_, macro_res_, x, y, z, &macro_max[0]);
+            }
+          }
+        }
+      }
+    }
+  }
+  macro_max_.swap(macro_max);
+}
+
+bool Volume::HasMacroGrid() const
+{
+  return !macro_max_.empty();
+}
+
+Real Volume::GetEmptySpan(const Vector &point, const Vector &dir,
+    Real *occupied) const
+{
+  *occupied = REAL_MAX;
+  if (buffer_.IsEmpty()) {
+    return REAL_MAX;
+  }
+  if (!HasMacroGrid()) {
+    return 0;
+  }
+
+  // in units of macro cells
+  const Resolution &res = buffer_.GetResolution();
+  const Real xscale = res.x / (size_.x * MACRO_CELL_SIZE);
+  const Real yscale = res.y / (size_.y * MACRO_CELL_SIZE);
+  const Real zscale = res.z / (size_.z * MACRO_CELL_SIZE);
+  const Real P[3] = {
+      (point.x - bounds_.min.x) * xscale,
+      (point.y - bounds_.min.y) * yscale,
+      (point.z - bounds_.min.z) * zscale};
+  const Real D[3] = {
+      dir.x * xscale,
+      dir.y * yscale,
+      dir.z * zscale};
+  const int NCELLS[3] = {macro_res_.x, macro_res_.y, macro_res_.z};
+  // the voxels end before the last cell does
+  const Real LIMIT[3] = {
+      res.x / (Real) MACRO_CELL_SIZE,
+      res.y / (Real) MACRO_CELL_SIZE,
+      res.z / (Real) MACRO_CELL_SIZE};
+
+  // where the ray is in the grid
+  Real t_enter = 0;
+  Real t_exit = REAL_MAX;
+  for (int i = 0; i < 3; i++) {
+    if (D[i] == 0) {
+      if (P[i] < 0 || P[i] > LIMIT[i]) {
+        return REAL_MAX;
+      }
+      continue;
+    }
+    const Real t0 = (0 - P[i]) / D[i];
+    const Real t1 = (LIMIT[i] - P[i]) / D[i];
+    t_enter = Max(t_enter, Min(t0, t1));
+    t_exit = Min(t_exit, Max(t0, t1));
+  }
+  if (t_enter > t_exit) {
+    return REAL_MAX;
+  }
+
+  // 3D-DDA over macro cells from where the ray is in the grid
+  int cell[3];
+  int step[3];
+  Real t_next[3];
+  Real t_step[3];
+  for (int i = 0; i < 3; i++) {
+    const Real x = P[i] + t_enter * D[i];
+    cell[i] = (int) Clamp(floor(x), 0, NCELLS[i] - 1);
+    if (D[i] > 0) {
+      step[i] = 1;
+      t_step[i] = 1 / D[i];
+      t_next[i] = t_enter + (cell[i] + 1 - x) * t_step[i];
+    } else if (D[i] < 0) {
+      step[i] = -1;
+      t_step[i] = -1 / D[i];
+      t_next[i] = t_enter + (x - cell[i]) * t_step[i];
+    } else {
+      step[i] = 0;
+      t_step[i] = REAL_MAX;
+      t_next[i] = REAL_MAX;
+    }
+  }
+
+  Real t = t_enter;
+  for (;;) {
+    const int axis = t_next[0] < t_next[1] ?
+        (t_next[0] < t_next[2] ? 0 : 2) :
+        (t_next[1] < t_next[2] ? 1 : 2);
+    const int index = (cell[2] * macro_res_.y + cell[1]) * macro_res_.x + cell[0];
+
+    if (macro_max_[index] > 0) {
+      if (t == 0) {
+        *occupied = Min(t_next[axis], t_exit);
+      }
+      return t;
+    }
+
+    t = t_next[axis];
+    if (t >= t_exit) {
+      return REAL_MAX;
+    }
+    cell[axis] += step[axis];
+    if (cell[axis] < 0 || cell[axis] >= NCELLS[axis]) {
+      return REAL_MAX;
+    }
+    t_next[axis] += t_step[axis];
+  }
+}
+
 void Volume::compute_filter_size()
 {
   if (buffer_.IsEmpty()) {
@@ -205,6 +572,167 @@ void VolGetIndexRange(const Volume *volume,
   volume->PointToIndex(P_max, xmax, ymax, zmax);
 }
 
+static size_t tile_bytes(int storage)
+{
+  switch (storage) {
+  case VOX_HALF:
+    return TILE_VOXELS * sizeof(uint16_t);
+  case VOX_BYTE:
+    return BYTE_TILE_HEADER + TILE_VOXELS * sizeof(uint8_t);
+  default:
+    return TILE_VOXELS * sizeof(float);
+  }
+}
+
+static void encode_tile(const float *src, int storage, char *dst)
+{
+  switch (storage) {
+  case VOX_HALF:
+    {
+      uint16_t *voxels = reinterpret_cast<uint16_t *>(dst);
+      for (int i = 0; i < TILE_VOXELS; i++) {
+        voxels[i] = float_to_half(src[i]);
+      }
+    }
+    break;
+  case VOX_BYTE:
+    {
+      const float min_value = *std::min_element(src, src + TILE_VOXELS);
+      const float max_value = *std::max_element(src, src + TILE_VOXELS);
+      const float scale = (max_value - min_value) / 255;
+      uint8_t *voxels = reinterpret_cast<uint8_t *>(dst + BYTE_TILE_HEADER);
+
+      memcpy(dst, &min_value, sizeof(float));
+      memcpy(dst + sizeof(float), &scale, sizeof(float));
+      for (int i = 0; i < TILE_VOXELS; i++) {
+        const float level = scale > 0 ? (src[i] - min_value) / scale : 0;
+        voxels[i] = (uint8_t) Clamp(floor(level + .5), 0, 255);
+      }
+    }
+    break;
+  default:
+    memcpy(dst, src, TILE_VOXELS * sizeof(float));
+    break;
+  }
+}
+
+static float decode_voxel(const char *tile, int storage, int index)
+{
+  switch (storage) {
+  case VOX_HALF:
+    return half_to_float(reinterpret_cast<const uint16_t *>(tile)[index]);
+  case VOX_BYTE:
+    {
+      const float *header = reinterpret_cast<const float *>(tile);
+      const uint8_t *voxels = reinterpret_cast<const uint8_t *>(tile + BYTE_TILE_HEADER);
+      return header[0] + voxels[index] * header[1];
+    }
+  default:
+    return reinterpret_cast<const float *>(tile)[index];
+  }
+}
+
+// rounds to the nearest even. out of range values go to infinity or zero
+static uint16_t float_to_half(float value)
+{
+  uint32_t bits = 0;
+  memcpy(&bits, &value, sizeof(bits));
+
+  const uint32_t sign = (bits >> 16) & 0x8000;
+  const int float_exponent = (bits >> 23) & 0xff;
+  const int exponent = float_exponent - 127 + 15;
+  uint32_t mantissa = bits & 0x7fffff;
+
+  if (float_exponent == 0xff) {
+    // infinity or nan
+    return sign | 0x7c00 | (mantissa != 0 ? 0x200 : 0);
+  }
+  if (exponent >= 31) {
+    return sign | 0x7c00;
+  }
+  if (exponent <= 0) {
+    // subnormal
+    if (exponent < -10) {
+      return sign;
+    }
+    mantissa |= 0x800000;
+    const int shift = 14 - exponent;
+    const uint32_t rest = mantissa & ((1u << shift) - 1);
+    const uint32_t halfway = 1u << (shift - 1);
+    uint32_t half = mantissa >> shift;
+    if (rest > halfway || (rest == halfway && (half & 1))) {
+      half++;
+    }
+    return sign | half;
+  }
+
+  // a carry out of the mantissa goes to the exponent
+  uint32_t half = (exponent << 10) | (mantissa >> 13);
+  const uint32_t rest = mantissa & 0x1fff;
+  if (rest > 0x1000 || (rest == 0x1000 && (half & 1))) {
+    half++;
+  }
+  return sign | half;
+}
+
+static float half_to_float(uint16_t half)
+{
+  const uint32_t sign = (uint32_t) (half & 0x8000) << 16;
+  const uint32_t exponent = (half >> 10) & 0x1f;
+  uint32_t mantissa = half & 0x3ff;
+  uint32_t bits = 0;
+
+  if (exponent == 0) {
+    if (mantissa == 0) {
+      bits = sign;
+    } else {
+      // subnormal. shift the mantissa up to the hidden bit
+      int shift = 0;
+      while ((mantissa & 0x400) == 0) {
+        mantissa <<= 1;
+        shift++;
+      }
+      bits = sign | ((127 - 14 - shift) << 23) | ((mantissa & 0x3ff) << 13);
+    }
+  } else if (exponent == 31) {
+    bits = sign | 0x7f800000 | (mantissa << 13);
+  } else {
+    bits = sign | ((exponent - 15 + 127) << 23) | (mantissa << 13);
+  }
+
+  float value = 0;
+  memcpy(&value, &bits, sizeof(value));
+  return value;
+}
+
+// trilinear samples in a voxel read the voxels next to it as well.
+// each voxel goes to the cells of its neighbors
+static void add_voxel_to_macro_cells(const VoxelBuffer &buffer,
+    const Resolution &macro_res, int x, int y, int z, float *macro_max)
+{
+  const float value = Abs(buffer.GetValue(x, y, z));
+  if (value == 0) {
+    return;
+  }
+
+  const Resolution &res = buffer.GetResolution();
+  const int xmin = std::max(x - 1, 0) / MACRO_CELL_SIZE;
+  const int ymin = std::max(y - 1, 0) / MACRO_CELL_SIZE;
+  const int zmin = std::max(z - 1, 0) / MACRO_CELL_SIZE;
+  const int xmax = std::min(x + 1, res.x - 1) / MACRO_CELL_SIZE;
+  const int ymax = std::min(y + 1, res.y - 1) / MACRO_CELL_SIZE;
+  const int zmax = std::min(z + 1, res.z - 1) / MACRO_CELL_SIZE;
+
+  for (int k = zmin; k <= zmax; k++) {
+    for (int j = ymin; j <= ymax; j++) {
+      for (int i = xmin; i <= xmax; i++) {
+        float &cell = macro_max[((size_t) k * macro_res.y + j) * macro_res.x + i];
+        cell = std::max(cell, value);
+      }
+    }
+  }
+}
+
 static float trilinear_buffer_value(const VoxelBuffer &buffer, const Vector &P)
 {
   const Vector P_sample(
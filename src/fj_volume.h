@@ -21,6 +21,14 @@ public:
   int x, y, z;
 };
 
+enum {
+  VOX_FLOAT = 0,
+  VOX_HALF,
+  VOX_BYTE
+};
+
+// voxels are stored in tiles of TILE_SIZE^3. a tile is allocated when
+// one of its voxels is set to nonzero. the others read 0 and take no memory
 class FJ_API VoxelBuffer {
 public:
   VoxelBuffer();
@@ -33,9 +41,40 @@ public:
   void SetValue(int x, int y, int z, float value);
   float GetValue(int x, int y, int z) const;
 
+  const Resolution &GetTileResolution() const;
+  bool IsTileAllocated(int tile_x, int tile_y, int tile_z) const;
+  int GetAllocatedTileCount() const;
+  // bytes used for the voxels and the tile table
+  size_t GetMemoryUsage() const;
+
+  // VOX_FLOAT, VOX_HALF or VOX_BYTE. voxels are set in floats and
+  // Compress converts the tiles to the storage. VOX_BYTE quantizes
+  // each tile to 256 levels between its min and max
+  void SetStorage(int storage);
+  int GetStorage() const;
+  // measures how far the stored voxels are from the floats over all
+  // voxels in allocated tiles. SetValue turns the tiles back to floats
+  void Compress();
+  void GetStorageError(double *max_error, double *rms_error) const;
+
+  enum { TILE_SIZE = 8 };
+
 private:
-  std::vector<float> data_;
+  VoxelBuffer(const VoxelBuffer &);
+  const VoxelBuffer &operator=(const VoxelBuffer &);
+
+  void clear_tiles();
+  void decompress_tiles();
+
+  std::vector<char *> tiles_;
   Resolution res_;
+  Resolution tile_res_;
+  int allocated_tile_count_;
+
+  int storage_;
+  int tile_storage_; // VOX_FLOAT until compressed
+  double max_error_;
+  double rms_error_;
 };
 
 class FJ_API VolumeSample {
@@ -67,6 +106,27 @@ public:
 
   bool GetSample(const Vector &point, VolumeSample *sample) const;
 
+  // bytes the voxels take. a dense buffer would take
+  // xres * yres * zres * sizeof(float)
+  size_t GetMemoryUsage() const;
+
+  // VOX_FLOAT, VOX_HALF or VOX_BYTE
+  void SetStorage(int storage);
+  int GetStorage() const;
+  // converts the voxels to the storage. call after filling voxels
+  void Compress();
+  void GetStorageError(double *max_error, double *rms_error) const;
+
+  // records the max density of each block of voxels so that raymarching
+  // can skip empty space. call after filling voxels. SetValue drops it
+  void BuildMacroGrid();
+  bool HasMacroGrid() const;
+  // how far the density stays zero from point along dir in units of dir.
+  // when it is not zero at point, returns 0 and occupied gets how far
+  // it can be nonzero before another look is worth it
+  Real GetEmptySpan(const Vector &point, const Vector &dir,
+      Real *occupied) const;
+
 public:
   void compute_filter_size();
 
@@ -75,6 +135,10 @@ public:
   Vector size_;
 
   Real filtersize_;
+
+  // max density of each macro cell and the voxels around it
+  std::vector<float> macro_max_;
+  Resolution macro_res_;
 };
 
 FJ_API void VolGetIndexRange(const Volume *volume,
@@ -6,6 +6,7 @@
 #include <string.h>
 #include <dlfcn.h>
 #include <sys/stat.h>
+#include <sys/time.h>
 
 void *OsDlopen(const char *filename)
 {
@@ -49,3 +50,24 @@ int OsDlclose(void *handle)
     return 0;
   }
 }
+
+double OsGetWallClock(void)
+{
+  struct timeval tv;
+
+  gettimeofday(&tv, NULL);
+  return tv.tv_sec + tv.tv_usec * 1e-6;
+}
+
+int OsGetFileTime(const char *filename, double *size, double *modified_time)
+{
+  struct stat file_stat;
+
+  if (stat(filename, &file_stat) != 0) {
+    return -1;
+  }
+
+  *size = static_cast<double>(file_stat.st_size);
+  *modified_time = static_cast<double>(file_stat.st_mtime);
+  return 0;
+}
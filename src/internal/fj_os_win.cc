@@ -60,3 +60,36 @@ int OsDlclose(void *handle)
     return 0;
   }
 }
+
+double OsGetWallClock(void)
+{
+  LARGE_INTEGER frequency;
+  LARGE_INTEGER counter;
+
+  QueryPerformanceFrequency(&frequency);
+  QueryPerformanceCounter(&counter);
+
+  return counter.QuadPart / static_cast<double>(frequency.QuadPart);
+}
+
+int OsGetFileTime(const char *filename, double *size, double *modified_time)
+{
+  WIN32_FILE_ATTRIBUTE_DATA attributes;
+
+  if (!GetFileAttributesEx(filename, GetFileExInfoStandard, &attributes)) {
+    return -1;
+  }
+
+  ULARGE_INTEGER file_size;
+  file_size.LowPart = attributes.nFileSizeLow;
+  file_size.HighPart = attributes.nFileSizeHigh;
+
+  // file times are in 100 nanoseconds
+  ULARGE_INTEGER write_time;
+  write_time.LowPart = attributes.ftLastWriteTime.dwLowDateTime;
+  write_time.HighPart = attributes.ftLastWriteTime.dwHighDateTime;
+
+  *size = static_cast<double>(file_size.QuadPart);
+  *modified_time = static_cast<double>(write_time.QuadPart / 10000000ULL);
+  return 0;
+}
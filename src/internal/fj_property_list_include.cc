@@ -138,6 +138,13 @@ static int set_Renderer_max_refract_depth(void *self, const PropertyValue *value
   return 0;
 }
 
+static int set_Renderer_roulette_threshold(void *self, const PropertyValue *value)
+{
+  Renderer *renderer = reinterpret_cast<Renderer *>(self);
+  renderer->SetRouletteThreshold(value->vector[0]);
+  return 0;
+}
+
 static int set_Renderer_raymarch_step(void *self, const PropertyValue *value)
 {
   Renderer *renderer = reinterpret_cast<Renderer *>(self);
@@ -166,6 +173,104 @@ static int set_Renderer_raymarch_refract_step(void *self, const PropertyValue *v
   return 0;
 }
 
+static int set_Renderer_lod_threshold(void *self, const PropertyValue *value)
+{
+  Renderer *renderer = reinterpret_cast<Renderer *>(self);
+  renderer->SetLODThreshold(value->vector[0]);
+  return 0;
+}
+
+static int set_Renderer_ray_packet_size(void *self, const PropertyValue *value)
+{
+  Renderer *renderer = reinterpret_cast<Renderer *>(self);
+  renderer->SetRayPacketSize((int) value->vector[0]);
+  return 0;
+}
+
+static int set_Renderer_sorted_shading(void *self, const PropertyValue *value)
+{
+  Renderer *renderer = reinterpret_cast<Renderer *>(self);
+  renderer->SetSortedShadingEnable((int) value->vector[0]);
+  return 0;
+}
+
+static int set_Renderer_shader_batch(void *self, const PropertyValue *value)
+{
+  Renderer *renderer = reinterpret_cast<Renderer *>(self);
+  renderer->SetShaderBatchEnable((int) value->vector[0]);
+  return 0;
+}
+
+static int set_Renderer_light_sample_budget(void *self, const PropertyValue *value)
+{
+  Renderer *renderer = reinterpret_cast<Renderer *>(self);
+  renderer->SetLightSampleBudget((int) value->vector[0]);
+  return 0;
+}
+
+static int set_Renderer_dome_sample_budget(void *self, const PropertyValue *value)
+{
+  Renderer *renderer = reinterpret_cast<Renderer *>(self);
+  renderer->SetDomeSampleBudget((int) value->vector[0]);
+  return 0;
+}
+
+static int set_Renderer_adaptive_threshold(void *self, const PropertyValue *value)
+{
+  Renderer *renderer = reinterpret_cast<Renderer *>(self);
+  renderer->SetAdaptiveThreshold(value->vector[0]);
+  return 0;
+}
+
+static int set_Renderer_adaptive_max_pixelsamples(void *self, const PropertyValue *value)
+{
+  Renderer *renderer = reinterpret_cast<Renderer *>(self);
+  renderer->SetAdaptiveMaxPixelSamples((int) value->vector[0], (int) value->vector[1]);
+  return 0;
+}
+
+static int set_Renderer_sample_count_output(void *self, const PropertyValue *value)
+{
+  Renderer *renderer = reinterpret_cast<Renderer *>(self);
+  renderer->SetSampleCountOutput((int) value->vector[0]);
+  return 0;
+}
+
+static int set_Renderer_progressive(void *self, const PropertyValue *value)
+{
+  Renderer *renderer = reinterpret_cast<Renderer *>(self);
+  renderer->SetProgressive((int) value->vector[0]);
+  return 0;
+}
+
+static int set_Renderer_sample_splatting(void *self, const PropertyValue *value)
+{
+  Renderer *renderer = reinterpret_cast<Renderer *>(self);
+  renderer->SetSampleSplatting((int) value->vector[0]);
+  return 0;
+}
+
+static int set_Renderer_filter_type(void *self, const PropertyValue *value)
+{
+  Renderer *renderer = reinterpret_cast<Renderer *>(self);
+  renderer->SetFilterType((int) value->vector[0]);
+  return 0;
+}
+
+static int set_Renderer_sampler_type(void *self, const PropertyValue *value)
+{
+  Renderer *renderer = reinterpret_cast<Renderer *>(self);
+  renderer->SetSamplerType((int) value->vector[0]);
+  return 0;
+}
+
+static int set_Renderer_sample_seed(void *self, const PropertyValue *value)
+{
+  Renderer *renderer = reinterpret_cast<Renderer *>(self);
+  renderer->SetSampleSeed((int) value->vector[0]);
+  return 0;
+}
+
 static int set_Renderer_sample_time_range(void *self, const PropertyValue *value)
 {
   Renderer *renderer = reinterpret_cast<Renderer *>(self);
@@ -312,6 +417,17 @@ static int set_Volume_bounds_max(void *self, const PropertyValue *value)
   return 0;
 }
 
+static int set_Volume_storage(void *self, const PropertyValue *value)
+{
+  const int storage = (int) value->vector[0];
+  if (storage != VOX_FLOAT && storage != VOX_HALF && storage != VOX_BYTE)
+    return -1;
+
+  Volume *volume = reinterpret_cast<Volume *>(self);
+  volume->SetStorage(storage);
+  return 0;
+}
+
 static int set_Light_intensity(void *self, const PropertyValue *value)
 {
   Light *light = reinterpret_cast<Light *>(self);
@@ -340,6 +456,33 @@ static int set_Light_double_sided(void *self, const PropertyValue *value)
   return 0;
 }
 
+static int set_Light_sample_cache(void *self, const PropertyValue *value)
+{
+  Light *light = reinterpret_cast<Light *>(self);
+  light->SetSampleCache((bool) value->vector[0]);
+  return 0;
+}
+
+static int set_Light_per_point_sampling(void *self, const PropertyValue *value)
+{
+  Light *light = reinterpret_cast<Light *>(self);
+  light->SetPerPointSampling((bool) value->vector[0]);
+  return 0;
+}
+
+static int set_Light_sampling_method(void *self, const PropertyValue *value)
+{
+  const int method = (int) value->vector[0];
+  if (method != DOME_SAMPLING_RANDOM &&
+      method != DOME_SAMPLING_STRATIFIED &&
+      method != DOME_SAMPLING_STRUCTURED)
+    return -1;
+
+  Light *light = reinterpret_cast<Light *>(self);
+  light->SetSamplingMethod(method);
+  return 0;
+}
+
 static int set_Light_environment_map(void *self, const PropertyValue *value)
 {
   Light *light = reinterpret_cast<Light *>(self);
@@ -418,10 +561,25 @@ static const Property Renderer_properties[] = {
   {PROP_SCALAR,  "cast_shadow",           {1, 0, 0, 0},      set_Renderer_cast_shadow},
   {PROP_SCALAR,  "max_reflect_depth",     {3, 0, 0, 0},      set_Renderer_max_reflect_depth},
   {PROP_SCALAR,  "max_refract_depth",     {3, 0, 0, 0},      set_Renderer_max_refract_depth},
+  {PROP_SCALAR,  "roulette_threshold",    {0, 0, 0, 0},      set_Renderer_roulette_threshold},
   {PROP_SCALAR,  "raymarch_step",         {.05, 0, 0, 0},    set_Renderer_raymarch_step},
   {PROP_SCALAR,  "raymarch_shadow_step",  {.1, 0, 0, 0},     set_Renderer_raymarch_shadow_step},
   {PROP_SCALAR,  "raymarch_reflect_step", {.1, 0, 0, 0},     set_Renderer_raymarch_reflect_step},
   {PROP_SCALAR,  "raymarch_refract_step", {.1, 0, 0, 0},     set_Renderer_raymarch_refract_step},
+  {PROP_SCALAR,  "lod_threshold",         {0, 0, 0, 0},      set_Renderer_lod_threshold},
+  {PROP_SCALAR,  "ray_packet_size",       {0, 0, 0, 0},      set_Renderer_ray_packet_size},
+  {PROP_SCALAR,  "sorted_shading",        {0, 0, 0, 0},      set_Renderer_sorted_shading},
+  {PROP_SCALAR,  "shader_batch",          {0, 0, 0, 0},      set_Renderer_shader_batch},
+  {PROP_SCALAR,  "light_sample_budget",   {0, 0, 0, 0},      set_Renderer_light_sample_budget},
+  {PROP_SCALAR,  "dome_sample_budget",    {0, 0, 0, 0},      set_Renderer_dome_sample_budget},
+  {PROP_SCALAR,  "adaptive_threshold",    {0, 0, 0, 0},      set_Renderer_adaptive_threshold},
+  {PROP_SCALAR,  "sample_count_output",   {0, 0, 0, 0},      set_Renderer_sample_count_output},
+  {PROP_SCALAR,  "progressive",           {0, 0, 0, 0},      set_Renderer_progressive},
+  {PROP_SCALAR,  "sample_splatting",      {1, 0, 0, 0},      set_Renderer_sample_splatting},
+  {PROP_SCALAR,  "filter_type",           {FLT_GAUSSIAN},    set_Renderer_filter_type},
+  {PROP_SCALAR,  "sampler_type",          {SMP_JITTERED},    set_Renderer_sampler_type},
+  {PROP_SCALAR,  "sample_seed",           {0, 0, 0, 0},      set_Renderer_sample_seed},
+  {PROP_VECTOR2, "adaptive_max_pixelsamples", {8, 8, 0, 0},  set_Renderer_adaptive_max_pixelsamples},
   {PROP_VECTOR2, "sample_time_range",     {0, 1, 0, 0},      set_Renderer_sample_time_range},
   {PROP_VECTOR2, "resolution",            {320, 240, 0, 0},  set_Renderer_resolution},
   {PROP_VECTOR2, "pixelsamples",          {3, 3, 0, 0},      set_Renderer_pixelsamples},
@@ -448,6 +606,7 @@ static const Property Volume_properties[] = {
   {PROP_VECTOR3, "resolution", {0, 0, 0, 0}, set_Volume_resolution},
   {PROP_VECTOR3, "bounds_min", {0, 0, 0, 0}, set_Volume_bounds_min},
   {PROP_VECTOR3, "bounds_max", {0, 0, 0, 0}, set_Volume_bounds_max},
+  {PROP_SCALAR,  "storage",    {VOX_FLOAT},  set_Volume_storage},
   END_OF_PROPERTY
 };
 
@@ -461,6 +620,9 @@ static const Property Light_properties[] = {
   {PROP_VECTOR3, "color",           {1, 1, 1, 0},  set_Light_color},
   {PROP_SCALAR,  "sample_count",    {16, 0, 0, 0}, set_Light_sample_count},
   {PROP_SCALAR,  "double_sided",    {0, 0, 0, 0},  set_Light_double_sided},
+  {PROP_SCALAR,  "sample_cache",    {0, 0, 0, 0},  set_Light_sample_cache},
+  {PROP_SCALAR,  "per_point_sampling", {0, 0, 0, 0}, set_Light_per_point_sampling},
+  {PROP_SCALAR,  "sampling_method", {DOME_SAMPLING_STRATIFIED}, set_Light_sampling_method},
   {PROP_TEXTURE, "environment_map", {0, 0, 0, 0},  set_Light_environment_map},
   END_OF_PROPERTY
 };
@@ -107,6 +107,18 @@ int main()
     TEST(TestDoubleEq(hit_tmin, -FLT_MAX));
     TEST(TestDoubleEq(hit_tmax, FLT_MAX));
   }
+  {
+    Box box(0, 0, 0, 1, 1, 1);
+
+    TEST_INT(BoxMortonCode(box, Vector(0, 0, 0)), 0);
+    TEST_INT(BoxMortonCode(box, Vector(0, 0, 1)), 0x09249249);
+    TEST_INT(BoxMortonCode(box, Vector(1, 1, 1)), 0x3fffffff);
+    // the highest bit splits x in half
+    TEST_INT(BoxMortonCode(box, Vector(.49, 1, 1)) >> 29, 0);
+    TEST_INT(BoxMortonCode(box, Vector(.51, 0, 0)) >> 29, 1);
+    // outside points are clamped
+    TEST_INT(BoxMortonCode(box, Vector(2, -1, 2)), 0x2db6db6d);
+  }
   printf("%s: %d/%d/%d: (FAIL/PASS/TOTAL)\n", __FILE__,
       TestGetFailCount(), TestGetPassCount(), TestGetTotalCount());
 
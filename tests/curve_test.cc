@@ -0,0 +1,211 @@
+// Copyright (c) 2011-2014 Hiroshi Tsubokawa
+// See LICENSE and README
+
+#include "unit_test.h"
+#include "fj_intersection.h"
+#include "fj_numeric.h"
+#include "fj_vector.h"
+#include "fj_curve.h"
+#include "fj_random.h"
+#include "fj_ray.h"
+#include <cstdio>
+
+using namespace fj;
+
+// a synthetic hair patch. each hair is a bezier that goes along y axis
+// and bulges toward +z so that z(v) = .6 * v * (1 - v) where y = v
+static const int HAIR_COUNT = 8;
+static const Real HAIR_SPACING = .1;
+static const Real HAIR_WIDTH = .04;
+
+static void build_hair_patch(Curve *curve)
+{
+  curve->SetVertexCount(4 * HAIR_COUNT);
+  curve->SetCurveCount(HAIR_COUNT);
+  curve->AddVertexPosition();
+  curve->AddVertexWidth();
+  curve->AddCurveIndices();
+
+  for (int i = 0; i < HAIR_COUNT; i++) {
+    const Real x = i * HAIR_SPACING;
+
+    curve->SetVertexPosition(4*i + 0, Vector(x, 0.,    0.));
+    curve->SetVertexPosition(4*i + 1, Vector(x, 1./3, .2));
+    curve->SetVertexPosition(4*i + 2, Vector(x, 2./3, .2));
+    curve->SetVertexPosition(4*i + 3, Vector(x, 1.,    0.));
+
+    for (int j = 0; j < 4; j++) {
+      curve->SetVertexWidth(4*i + j, HAIR_WIDTH);
+    }
+    curve->SetCurveIndices(i, 4*i);
+  }
+
+  curve->ComputeBounds();
+  curve->ComputeSplitDepth();
+}
+
+static Ray camera_ray(Real x, Real y)
+{
+  Ray ray;
+  ray.orig = Vector(x, y, 10);
+  ray.dir = Vector(0, 0, -1);
+  ray.tmin = .001;
+  ray.tmax = 1000;
+  return ray;
+}
+
+// random curves in the unit cube. the colors are 0 at v = 0 and 1 at
+// v = 1 so that Cd.r of a hit tells its v
+static void build_random_curves(Curve *curve, XorShift *rng, int count)
+{
+  curve->SetVertexCount(4 * count);
+  curve->SetCurveCount(count);
+  curve->AddVertexPosition();
+  curve->AddVertexColor();
+  curve->AddVertexWidth();
+  curve->AddCurveIndices();
+
+  for (int i = 0; i < count; i++) {
+    for (int j = 0; j < 4; j++) {
+      Vector P;
+      XorSolidCubeRand(rng, &P);
+      curve->SetVertexPosition(4*i + j, P);
+      curve->SetVertexWidth(4*i + j, .02 + .1 * XorNextFloat01(rng));
+      curve->SetVertexColor(4*i + j, Color(j < 2 ? 0 : 1, 0, 0));
+    }
+    curve->SetCurveIndices(i, 4*i);
+  }
+
+  curve->ComputeBounds();
+  curve->ComputeSplitDepth();
+}
+
+static int near_enough(Real a, Real b, Real tolerance)
+{
+  return Abs(a - b) <= tolerance;
+}
+
+int main()
+{
+  Curve curve;
+  build_hair_patch(&curve);
+
+  {
+    // rays through the center line of each hair
+    const Real y_list[] = {.1, .25, .5, .75, .9};
+    const int NY = sizeof(y_list) / sizeof(y_list[0]);
+    int hit_count = 0;
+    int t_match_count = 0;
+
+    for (int i = 0; i < HAIR_COUNT; i++) {
+      for (int j = 0; j < NY; j++) {
+        const Real x = i * HAIR_SPACING;
+        const Real y = y_list[j];
+        const Ray ray = camera_ray(x, y);
+        const Real t_expected = 10 - .6 * y * (1 - y);
+        Intersection isect;
+
+        if (curve.RayIntersect(i, 0, ray, &isect)) {
+          hit_count++;
+          if (near_enough(isect.t_hit, t_expected, 1e-3)) {
+            t_match_count++;
+          }
+        }
+      }
+    }
+    TEST_INT(hit_count, HAIR_COUNT * NY);
+    TEST_INT(t_match_count, HAIR_COUNT * NY);
+  }
+  {
+    // rays between hairs should miss them all
+    int hit_count = 0;
+
+    for (int i = 0; i < HAIR_COUNT - 1; i++) {
+      const Real x = (i + .5) * HAIR_SPACING;
+      const Ray ray = camera_ray(x, .5);
+
+      for (int k = 0; k < HAIR_COUNT; k++) {
+        Intersection isect;
+        if (curve.RayIntersect(k, 0, ray, &isect)) {
+          hit_count++;
+        }
+      }
+    }
+    TEST_INT(hit_count, 0);
+  }
+  {
+    // rays inside the width of a hair but off its center line
+    const Real offset = .4 * HAIR_WIDTH;
+    int hit_count = 0;
+
+    for (int i = 0; i < HAIR_COUNT; i++) {
+      const Real x = i * HAIR_SPACING;
+      Intersection isect0, isect1;
+
+      hit_count += curve.RayIntersect(i, 0, camera_ray(x - offset, .3), &isect0);
+      hit_count += curve.RayIntersect(i, 0, camera_ray(x + offset, .7), &isect1);
+    }
+    TEST_INT(hit_count, 2 * HAIR_COUNT);
+  }
+  {
+    // a closer hit already known through ray.tmax culls the hair
+    Ray ray = camera_ray(0, .5);
+    Intersection isect;
+
+    ray.tmax = 9;
+    TEST(curve.RayIntersect(0, 0, ray, &isect) == 0);
+
+    ray.tmax = 1000;
+    TEST(curve.RayIntersect(0, 0, ray, &isect) == 1);
+    TEST(near_enough(isect.t_hit, 10 - .15, 1e-3));
+  }
+
+  {
+    // the loop finds the same hits as the recursive kernel
+    const int NCURVES = 200;
+    const int NRAYS = 2000;
+    XorShift rng(2468);
+    Curve random_curve;
+    build_random_curves(&random_curve, &rng, NCURVES);
+
+    int hit_count = 0;
+    int mismatch_count = 0;
+
+    for (int i = 0; i < NRAYS; i++) {
+      Vector target;
+      Ray ray;
+      XorHollowSphereRand(&rng, &ray.orig);
+      XorSolidCubeRand(&rng, &target);
+      ray.orig *= 3;
+      ray.dir = target - ray.orig;
+      ray.tmin = .001;
+      ray.tmax = 1000;
+
+      for (int k = 0; k < NCURVES; k++) {
+        Intersection isect_loop, isect_recursive;
+
+        random_curve.SetRecursiveConvergence(false);
+        const bool hit_loop = random_curve.RayIntersect(k, 0, ray, &isect_loop);
+        random_curve.SetRecursiveConvergence(true);
+        const bool hit_recursive = random_curve.RayIntersect(k, 0, ray, &isect_recursive);
+
+        if (hit_loop != hit_recursive) {
+          mismatch_count++;
+        } else if (hit_loop) {
+          hit_count++;
+          if (!near_enough(isect_loop.t_hit, isect_recursive.t_hit, 1e-12) ||
+              !near_enough(isect_loop.Cd.r, isect_recursive.Cd.r, 1e-6)) {
+            mismatch_count++;
+          }
+        }
+      }
+    }
+    TEST(hit_count > 1000);
+    TEST_INT(mismatch_count, 0);
+  }
+
+  printf("%s: %d/%d/%d: (FAIL/PASS/TOTAL)\n", __FILE__,
+      TestGetFailCount(), TestGetPassCount(), TestGetTotalCount());
+
+  return 0;
+}
@@ -0,0 +1,61 @@
+// Copyright (c) 2011-2014 Hiroshi Tsubokawa
+// See LICENSE and README
+
+#include "unit_test.h"
+#include "fj_filter.h"
+#include "fj_numeric.h"
+#include <cstdio>
+#include <cmath>
+
+using namespace fj;
+
+int main()
+{
+  {
+    Filter filter;
+    filter.SetFilterType(FLT_BOX, 2, 2);
+
+    TEST(Abs(filter.Evaluate(0, 0) - 1) < 1e-6);
+    TEST(Abs(filter.Evaluate(.9, -.9) - 1) < 1e-6);
+    // beyond the range of the table
+    TEST(filter.Evaluate(2.5, 0) == 0);
+  }
+  {
+    Filter filter;
+    filter.SetFilterType(FLT_GAUSSIAN, 2, 4);
+
+    // tables agree with the gaussian between the entries
+    bool close = true;
+    for (int i = 0; i < 100; i++) {
+      const Real x = 1.9 * i / 100;
+      const Real xx = 2 * x / 2;
+      close = close && Abs(filter.EvaluateX(x) - exp(-2 * xx * xx)) < 1e-4;
+    }
+    TEST(close);
+    TEST(Abs(filter.EvaluateX(-.5) - filter.EvaluateX(.5)) < 1e-9);
+    TEST(Abs(filter.Evaluate(.5, 1) - exp(-.5) * exp(-.5)) < 1e-4);
+  }
+  {
+    Filter filter;
+    filter.SetFilterType(FLT_MITCHELL, 2, 2);
+
+    // 16/18 at the center and 0 at the radius
+    TEST(Abs(filter.EvaluateX(0) - 8./9) < 1e-6);
+    TEST(Abs(filter.EvaluateX(1)) < 1e-6);
+    // negative lobe
+    TEST(filter.EvaluateX(.75) < 0);
+  }
+  {
+    Filter filter;
+    filter.SetFilterType(FLT_BLACKMAN_HARRIS, 2, 2);
+
+    TEST(Abs(filter.EvaluateX(0) - 1) < 1e-4);
+    TEST(filter.EvaluateX(1) < 1e-4);
+    TEST(filter.EvaluateX(1.5) == 0);
+  }
+
+  printf("%s: %d/%d/%d: (FAIL/PASS/TOTAL)\n", __FILE__,
+      TestGetFailCount(), TestGetPassCount(), TestGetTotalCount());
+
+  return 0;
+}
@@ -0,0 +1,147 @@
+// Copyright (c) 2011-2014 Hiroshi Tsubokawa
+// See LICENSE and README
+
+#include "unit_test.h"
+#include "fj_importance_sampling.h"
+#include "fj_random.h"
+#include "fj_os.h"
+#include <cstdio>
+#include <vector>
+
+using namespace fj;
+
+static const char *CACHE_FILENAME = "importance_sampling_test.dome";
+
+// a ring around an island, two pixels touching only at their corners
+// and a U across many rows on the background
+static const int MAP_XRES = 12;
+static const int MAP_YRES = 10;
+static const char *STRATA_MAP[MAP_YRES] = {
+  "000000000000",
+  "011111000000",
+  "010001003000",
+  "010201000300",
+  "010001000000",
+  "011111004040",
+  "000000004040",
+  "000000004040",
+  "000000004440",
+  "000000000000"
+};
+static const int MAP_COMPONENT_COUNT = 7;
+
+static void make_dome_samples(int count, std::vector<DomeSample> *samples)
+{
+  XorShift rng(2468);
+  samples->resize(count);
+
+  for (int i = 0; i < count; i++) {
+    DomeSample &sample = (*samples)[i];
+    sample.color = Color(XorNextFloat01(&rng), XorNextFloat01(&rng), XorNextFloat01(&rng));
+    sample.uv = TexCoord(XorNextFloat01(&rng), XorNextFloat01(&rng));
+    XorHollowSphereRand(&rng, &sample.dir);
+  }
+}
+
+static bool is_same_sample(const DomeSample &a, const DomeSample &b)
+{
+  return
+      a.color.r == b.color.r && a.color.g == b.color.g && a.color.b == b.color.b &&
+      a.uv.u == b.uv.u && a.uv.v == b.uv.v &&
+      a.dir.x == b.dir.x && a.dir.y == b.dir.y && a.dir.z == b.dir.z;
+}
+
+int main()
+{
+  {
+    const int NPIXELS = MAP_XRES * MAP_YRES;
+    std::vector<char> strata_id(NPIXELS);
+    for (int i = 0; i < NPIXELS; i++) {
+      strata_id[i] = STRATA_MAP[i / MAP_XRES][i % MAP_XRES] - '0';
+    }
+
+    std::vector<int> label1(NPIXELS);
+    std::vector<int> label4(NPIXELS);
+    const int count1 = LabelConnectedStrata(MAP_XRES, MAP_YRES,
+        &strata_id[0], &label1[0], 1);
+    const int count4 = LabelConnectedStrata(MAP_XRES, MAP_YRES,
+        &strata_id[0], &label4[0], 4);
+
+    TEST_INT(count1, MAP_COMPONENT_COUNT);
+    TEST_INT(count4, MAP_COMPONENT_COUNT);
+    TEST(label1 == label4);
+
+    // labels are numbered in scan order
+    TEST_INT(label1[0], 0);
+    TEST_INT(label1[1 * MAP_XRES + 1], 1);
+    // the inside of the ring is not the background
+    TEST_INT(label1[2 * MAP_XRES + 2], 2);
+    TEST_INT(label1[2 * MAP_XRES + 8], 3);
+    TEST_INT(label1[3 * MAP_XRES + 3], 4);
+    // corners do not connect
+    TEST(label1[3 * MAP_XRES + 9] != label1[2 * MAP_XRES + 8]);
+    // the U is one component over all bands of rows
+    TEST_INT(label1[5 * MAP_XRES + 8], label1[5 * MAP_XRES + 10]);
+    TEST_INT(label1[5 * MAP_XRES + 9], label1[0]);
+  }
+  {
+    const int NSAMPLES = 64;
+    std::vector<DomeSample> samples;
+    make_dome_samples(NSAMPLES, &samples);
+
+    DomeSampleCacheKey key;
+    key.method = DOME_SAMPLING_STRATIFIED;
+    key.sample_count = NSAMPLES;
+    key.sample_xres = 32;
+    key.sample_yres = 16;
+    key.texture_size = 1234;
+    key.texture_time = 1400000000;
+
+    TEST_INT(WriteDomeSampleCache(CACHE_FILENAME, key, &samples[0], NSAMPLES), 0);
+
+    // keys take the size and time of the environment map file
+    double size = 0, modified_time = 0;
+    TEST_INT(OsGetFileTime(CACHE_FILENAME, &size, &modified_time), 0);
+    TEST(size > NSAMPLES * 8 * sizeof(double));
+    TEST(modified_time > 0);
+    TEST_INT(OsGetFileTime("importance_sampling_test.missing", &size, &modified_time), -1);
+
+    // round trip
+    std::vector<DomeSample> cached(NSAMPLES);
+    TEST_INT(ReadDomeSampleCache(CACHE_FILENAME, key, &cached[0], NSAMPLES), 0);
+    bool all_same = true;
+    for (int i = 0; i < NSAMPLES; i++) {
+      all_same = all_same && is_same_sample(samples[i], cached[i]);
+    }
+    TEST(all_same);
+
+    // any change of the key rejects the cache
+    DomeSampleCacheKey other = key;
+    other.sample_count = NSAMPLES / 2;
+    TEST_INT(ReadDomeSampleCache(CACHE_FILENAME, other, &cached[0], NSAMPLES / 2), -1);
+
+    other = key;
+    other.method = DOME_SAMPLING_STRUCTURED;
+    TEST_INT(ReadDomeSampleCache(CACHE_FILENAME, other, &cached[0], NSAMPLES), -1);
+
+    other = key;
+    other.sample_xres = 64;
+    TEST_INT(ReadDomeSampleCache(CACHE_FILENAME, other, &cached[0], NSAMPLES), -1);
+
+    other = key;
+    other.texture_size = 1235;
+    TEST_INT(ReadDomeSampleCache(CACHE_FILENAME, other, &cached[0], NSAMPLES), -1);
+
+    other = key;
+    other.texture_time = 1400000001;
+    TEST_INT(ReadDomeSampleCache(CACHE_FILENAME, other, &cached[0], NSAMPLES), -1);
+
+    TEST_INT(ReadDomeSampleCache("importance_sampling_test.missing",
+        key, &cached[0], NSAMPLES), -1);
+  }
+
+  printf("%s: %d/%d/%d: (FAIL/PASS/TOTAL)\n", __FILE__,
+      TestGetFailCount(), TestGetPassCount(), TestGetTotalCount());
+
+  return 0;
+}
@@ -0,0 +1,103 @@
+// Copyright (c) 2011-2014 Hiroshi Tsubokawa
+// See LICENSE and README
+
+#include "unit_test.h"
+#include "fj_light_tree.h"
+#include "fj_numeric.h"
+#include "fj_light.h"
+#include <cstdio>
+
+using namespace fj;
+
+int main()
+{
+  Light point0, point1, point2;
+  Light grid_up, grid_down;
+  Light dome;
+  const Light *lights[] = {&point0, &point1, &dome, &point2, &grid_up, &grid_down};
+  const int NLIGHTS = sizeof(lights) / sizeof(lights[0]);
+
+  point0.SetTranslate(-5, 0, 0, 0);
+  point1.SetTranslate( 5, 0, 0, 0);
+  point2.SetTranslate( 0, 0, 5, 0);
+  point2.SetIntensity(2);
+
+  grid_up.SetLightType(LGT_GRID);
+  grid_up.SetSampleCount(4);
+  grid_up.SetTranslate(0, 0, -5, 0);
+
+  grid_down.SetLightType(LGT_GRID);
+  grid_down.SetSampleCount(4);
+  grid_down.SetTranslate(0, 0, 0, 0);
+  grid_down.SetRotate(180, 0, 0, 0);
+
+  dome.SetLightType(LGT_DOME);
+
+  {
+    LightTree tree;
+    tree.Build(lights, NLIGHTS);
+    tree.SetSampleBudget(2);
+
+    // dome lights are left out
+    TEST_INT(tree.GetLightCount(), 5);
+    TEST_INT(tree.GetNodeCount(), 9);
+    TEST_INT(tree.GetSampleCount(), 11);
+    TEST_INT(tree.GetSampleBudget(), 2);
+
+    TEST(tree.IsBuiltFor(lights, NLIGHTS));
+    TEST(!tree.IsBuiltFor(lights, NLIGHTS - 1));
+  }
+  {
+    LightTree tree;
+    tree.Build(lights, NLIGHTS);
+
+    // picks follow their probabilities and lights that face away
+    // from the point are never picked
+    const Vector P(0, 5, 0);
+    const int NPICKS = 10000;
+    int count[NLIGHTS] = {0};
+    Real pdf[NLIGHTS] = {0};
+    bool in_range = true;
+
+    for (int i = 0; i < NPICKS && in_range; i++) {
+      Real p = 0;
+      const int index = tree.PickLight(P, (i + .5) / NPICKS, &p);
+      in_range = index >= 0 && index < NLIGHTS;
+      if (in_range) {
+        count[index]++;
+        pdf[index] = p;
+      }
+    }
+    TEST(in_range);
+
+    TEST_INT(count[2], 0);
+    TEST_INT(count[5], 0);
+    TEST(count[0] > 0);
+    TEST(count[1] > 0);
+    TEST(count[3] > 0);
+    TEST(count[4] > 0);
+
+    Real pdf_sum = 0;
+    for (int i = 0; i < NLIGHTS; i++) {
+      TEST(Abs(count[i] / (Real) NPICKS - pdf[i]) < .001);
+      pdf_sum += pdf[i];
+    }
+    TEST(Abs(pdf_sum - 1) < 1e-9);
+  }
+  {
+    // nothing lights up the point below the downward light only
+    const Light *down_only[] = {&grid_down};
+    LightTree tree;
+    tree.Build(down_only, 1);
+
+    Real pdf = 1;
+    TEST_INT(tree.PickLight(Vector(0, 5, 0), .5, &pdf), 0);
+    // a single light is picked without looking at the importance
+    TEST(Abs(pdf - 1) < 1e-9);
+  }
+
+  printf("%s: %d/%d/%d: (FAIL/PASS/TOTAL)\n", __FILE__,
+      TestGetFailCount(), TestGetPassCount(), TestGetTotalCount());
+
+  return 0;
+}
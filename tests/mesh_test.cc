@@ -0,0 +1,155 @@
+// Copyright (c) 2011-2014 Hiroshi Tsubokawa
+// See LICENSE and README
+
+#include "unit_test.h"
+#include "fj_multi_thread.h"
+#include "fj_triangle.h"
+#include "fj_numeric.h"
+#include "fj_vector.h"
+#include "fj_mesh.h"
+#include <vector>
+#include <cstdio>
+#include <cmath>
+
+using namespace fj;
+
+// a bumpy height field grid large enough to be split into several chunks
+static const int GRID_RES = 100;
+
+static void build_grid(Mesh *mesh)
+{
+  const int NVERTS = GRID_RES * GRID_RES;
+  const int NFACES = 2 * (GRID_RES - 1) * (GRID_RES - 1);
+
+  mesh->SetVertexCount(NVERTS);
+  mesh->SetFaceCount(NFACES);
+  mesh->AddVertexPosition();
+  mesh->AddFaceIndices();
+
+  for (int j = 0; j < GRID_RES; j++) {
+    for (int i = 0; i < GRID_RES; i++) {
+      const Real x = i * .1;
+      const Real z = j * .1;
+      const Real y = .3 * sin(3 * x) * cos(2 * z);
+      mesh->SetVertexPosition(j * GRID_RES + i, Vector(x, y, z));
+    }
+  }
+
+  int face_id = 0;
+  for (int j = 0; j < GRID_RES - 1; j++) {
+    for (int i = 0; i < GRID_RES - 1; i++) {
+      const Index v00 = j * GRID_RES + i;
+      const Index v10 = v00 + 1;
+      const Index v01 = v00 + GRID_RES;
+      const Index v11 = v01 + 1;
+
+      Index3 tri;
+      tri.i0 = v00; tri.i1 = v01; tri.i2 = v10;
+      mesh->SetFaceIndices(face_id++, tri);
+      tri.i0 = v10; tri.i1 = v01; tri.i2 = v11;
+      mesh->SetFaceIndices(face_id++, tri);
+    }
+  }
+}
+
+// the serial scatter that Mesh::ComputeNormals used to do
+static void compute_reference_normals(const Mesh &mesh, std::vector<Vector> *N)
+{
+  N->assign(mesh.GetVertexCount(), Vector(0, 0, 0));
+
+  for (int i = 0; i < mesh.GetFaceCount(); i++) {
+    const Index3 face = mesh.GetFaceIndices(i);
+    const Vector Ng = TriComputeFaceNormal(
+        mesh.GetVertexPosition(face.i0),
+        mesh.GetVertexPosition(face.i1),
+        mesh.GetVertexPosition(face.i2));
+
+    (*N)[face.i0] += Ng;
+    (*N)[face.i1] += Ng;
+    (*N)[face.i2] += Ng;
+  }
+
+  for (int i = 0; i < mesh.GetVertexCount(); i++) {
+    Normalize(&(*N)[i]);
+  }
+}
+
+static int count_mismatches(const Mesh &mesh, const std::vector<Vector> &N)
+{
+  int count = 0;
+
+  for (int i = 0; i < mesh.GetVertexCount(); i++) {
+    const Vector a = mesh.GetVertexNormal(i);
+    if (a.x != N[i].x || a.y != N[i].y || a.z != N[i].z) {
+      count++;
+    }
+  }
+  return count;
+}
+
+int main()
+{
+  {
+    // uniform weighting reproduces the serial result exactly
+    // regardless of thread count
+    Mesh mesh;
+    build_grid(&mesh);
+
+    std::vector<Vector> N;
+    compute_reference_normals(mesh, &N);
+
+    const int max_thread_count = MtGetMaxThreadCount();
+
+    MtSetMaxThreadCount(1);
+    mesh.ComputeNormals();
+    TEST_INT(count_mismatches(mesh, N), 0);
+
+    MtSetMaxThreadCount(Max(max_thread_count, 4));
+    mesh.ComputeNormals();
+    TEST_INT(count_mismatches(mesh, N), 0);
+
+    MtSetMaxThreadCount(max_thread_count);
+  }
+  {
+    // a vertex shared by a big and a small face in the xz and xy planes
+    //
+    // big face   (area 2, corner angle 90 degrees): N = (0, 1, 0)
+    // small face (area .5, corner angle 45 degrees): N = (0, 0, 1)
+    Mesh mesh;
+    mesh.SetVertexCount(5);
+    mesh.SetFaceCount(2);
+    mesh.AddVertexPosition();
+    mesh.AddFaceIndices();
+
+    mesh.SetVertexPosition(0, Vector(0, 0, 0));
+    mesh.SetVertexPosition(1, Vector(0, 0, 2));
+    mesh.SetVertexPosition(2, Vector(2, 0, 0));
+    mesh.SetVertexPosition(3, Vector(1, 0, 0));
+    mesh.SetVertexPosition(4, Vector(1, 1, 0));
+
+    Index3 tri;
+    tri.i0 = 0; tri.i1 = 1; tri.i2 = 2;
+    mesh.SetFaceIndices(0, tri);
+    tri.i0 = 0; tri.i1 = 3; tri.i2 = 4;
+    mesh.SetFaceIndices(1, tri);
+
+    Vector N;
+
+    mesh.ComputeNormals(NML_WEIGHT_UNIFORM);
+    N = mesh.GetVertexNormal(0);
+    TEST_DOUBLE(N.y, N.z);
+
+    mesh.ComputeNormals(NML_WEIGHT_AREA);
+    N = mesh.GetVertexNormal(0);
+    TEST_DOUBLE(N.y, 4 * N.z);
+
+    mesh.ComputeNormals(NML_WEIGHT_ANGLE);
+    N = mesh.GetVertexNormal(0);
+    TEST_DOUBLE(N.y, 2 * N.z);
+  }
+
+  printf("%s: %d/%d/%d: (FAIL/PASS/TOTAL)\n", __FILE__,
+      TestGetFailCount(), TestGetPassCount(), TestGetTotalCount());
+
+  return 0;
+}
@@ -0,0 +1,337 @@
+// Copyright (c) 2011-2014 Hiroshi Tsubokawa
+// See LICENSE and README
+
+#include "unit_test.h"
+#include "fj_intersection.h"
+#include "fj_point_cloud.h"
+#include "fj_numeric.h"
+#include "fj_random.h"
+#include "fj_vector.h"
+#include "fj_ray.h"
+#include <algorithm>
+#include <vector>
+#include <cstdio>
+#include <cmath>
+
+using namespace fj;
+
+// a point as the application gives it in double precision
+class SourcePoint {
+public:
+  SourcePoint() : P(), velocity(), radius(0) {}
+  ~SourcePoint() {}
+
+  Vector P;
+  Vector velocity;
+  Real radius;
+};
+
+class FloatPoint {
+public:
+  float value[7];
+
+  bool operator<(const FloatPoint &other) const
+  {
+    return std::lexicographical_compare(value, value + 7,
+        other.value, other.value + 7);
+  }
+  bool operator==(const FloatPoint &other) const
+  {
+    return std::equal(value, value + 7, other.value);
+  }
+};
+
+static FloatPoint to_float_point(const Vector &P, const Vector &velocity, Real radius)
+{
+  FloatPoint point;
+  point.value[0] = static_cast<float>(P.x);
+  point.value[1] = static_cast<float>(P.y);
+  point.value[2] = static_cast<float>(P.z);
+  point.value[3] = static_cast<float>(velocity.x);
+  point.value[4] = static_cast<float>(velocity.y);
+  point.value[5] = static_cast<float>(velocity.z);
+  point.value[6] = static_cast<float>(radius);
+  return point;
+}
+
+static void make_source_points(XorShift *rng, int count, std::vector<SourcePoint> *points)
+{
+  points->resize(count);
+
+  for (int i = 0; i < count; i++) {
+    SourcePoint &point = (*points)[i];
+    XorSolidCubeRand(rng, &point.P);
+    XorSolidSphereRand(rng, &point.velocity);
+    point.velocity *= .05;
+    point.radius = .01 + .02 * XorNextFloat01(rng);
+  }
+}
+
+static void build_point_cloud(const std::vector<SourcePoint> &points, PointCloud *ptc)
+{
+  const int NPOINTS = static_cast<int>(points.size());
+
+  ptc->SetPointCount(NPOINTS);
+  ptc->AddPointPosition();
+  ptc->AddPointVelocity();
+  ptc->AddPointRadius();
+
+  for (int i = 0; i < NPOINTS; i++) {
+    ptc->SetPointPosition(i, points[i].P);
+    ptc->SetPointVelocity(i, points[i].velocity);
+    ptc->SetPointRadius(i, points[i].radius);
+  }
+
+  ptc->PackPoints();
+  ptc->ComputeBounds();
+}
+
+// the nearest hit over all spheres in double precision as the point
+// cloud intersected them before points were stored in floats
+static bool intersect_source_points(const std::vector<SourcePoint> &points,
+    Real time, const Ray &ray, Real *t_hit, Vector *hit_center)
+{
+  bool hit = false;
+  *t_hit = REAL_MAX;
+
+  for (size_t i = 0; i < points.size(); i++) {
+    const Vector center = points[i].P + time * points[i].velocity;
+    const Vector orig_local = ray.orig - center;
+    const Real a = Dot(ray.dir, ray.dir);
+    const Real b = Dot(ray.dir, orig_local);
+    const Real c = Dot(orig_local, orig_local) - points[i].radius * points[i].radius;
+    const Real discriminant = b * b - a * c;
+
+    if (discriminant < 0) {
+      continue;
+    }
+    const Real t = (-b - sqrt(discriminant)) / a;
+    if (t < ray.tmin || t > ray.tmax || t >= *t_hit) {
+      continue;
+    }
+    *t_hit = t;
+    *hit_center = center;
+    hit = true;
+  }
+
+  return hit;
+}
+
+static bool intersect_point_cloud(const PointCloud &ptc,
+    Real time, const Ray &ray, Intersection *isect)
+{
+  bool hit = false;
+  isect->t_hit = REAL_MAX;
+
+  for (int i = 0; i < static_cast<int>(ptc.GetPrimitiveCount()); i++) {
+    Intersection tmp;
+    if (ptc.RayIntersect(i, time, ray, &tmp) && tmp.t_hit < isect->t_hit) {
+      *isect = tmp;
+      hit = true;
+    }
+  }
+
+  return hit;
+}
+
+// the nearest hit over the packed points in double precision
+static bool intersect_packed_points(const PointCloud &ptc,
+    Real time, const Ray &ray, Real *t_hit, int *hit_id)
+{
+  bool hit = false;
+  *t_hit = REAL_MAX;
+
+  for (int i = 0; i < ptc.GetPointCount(); i++) {
+    const Vector center = ptc.GetPointPosition(i) + time * ptc.GetPointVelocity(i);
+    const Real radius = ptc.GetPointRadius(i);
+    const Vector orig_local = ray.orig - center;
+    const Real a = Dot(ray.dir, ray.dir);
+    const Real b = Dot(ray.dir, orig_local);
+    const Real c = Dot(orig_local, orig_local) - radius * radius;
+    const Real discriminant = b * b - a * c;
+
+    if (discriminant < 0) {
+      continue;
+    }
+    const Real t = (-b - sqrt(discriminant)) / a;
+    if (t < ray.tmin || t > ray.tmax || t >= *t_hit) {
+      continue;
+    }
+    *t_hit = t;
+    *hit_id = i;
+    hit = true;
+  }
+
+  return hit;
+}
+
+static Ray random_ray(XorShift *rng)
+{
+  Vector target;
+  Ray ray;
+
+  XorHollowSphereRand(rng, &ray.orig);
+  XorSolidCubeRand(rng, &target);
+  ray.orig *= 3;
+  ray.dir = target - ray.orig;
+
+  return ray;
+}
+
+int main()
+{
+  const int NPOINTS = 3000;
+  XorShift rng(13579);
+  std::vector<SourcePoint> source;
+  make_source_points(&rng, NPOINTS, &source);
+
+  PointCloud ptc;
+  build_point_cloud(source, &ptc);
+
+  {
+    // packing reorders points but keeps their values
+    std::vector<FloatPoint> expected(NPOINTS);
+    std::vector<FloatPoint> packed(NPOINTS);
+
+    for (int i = 0; i < NPOINTS; i++) {
+      expected[i] = to_float_point(source[i].P, source[i].velocity, source[i].radius);
+      packed[i] = to_float_point(ptc.GetPointPosition(i),
+          ptc.GetPointVelocity(i), ptc.GetPointRadius(i));
+    }
+    std::sort(expected.begin(), expected.end());
+    std::sort(packed.begin(), packed.end());
+
+    TEST_INT(ptc.GetPointCount(), NPOINTS);
+    TEST(expected == packed);
+
+    // neighbors in the packed order are close to each other
+    Real packed_distance = 0;
+    Real source_distance = 0;
+    for (int i = 1; i < NPOINTS; i++) {
+      packed_distance += Length(ptc.GetPointPosition(i) - ptc.GetPointPosition(i - 1));
+      source_distance += Length(source[i].P - source[i - 1].P);
+    }
+    TEST(packed_distance < .5 * source_distance);
+  }
+  {
+    // float storage finds the same hits as doubles within float precision
+    const Real time_list[] = {0, .5, 1};
+    int hit_count = 0;
+    int hit_mismatch = 0;
+    int t_mismatch = 0;
+    int point_mismatch = 0;
+
+    for (int i = 0; i < 1000; i++) {
+      const Real time = time_list[i % 3];
+      const Ray ray = random_ray(&rng);
+      Real t_expected = 0;
+      Vector center_expected;
+      Intersection isect;
+
+      const bool hit_expected = intersect_source_points(source, time, ray,
+          &t_expected, &center_expected);
+      const bool hit = intersect_point_cloud(ptc, time, ray, &isect);
+
+      if (hit != hit_expected) {
+        hit_mismatch++;
+        continue;
+      }
+      if (!hit) {
+        continue;
+      }
+      hit_count++;
+
+      if (Abs(isect.t_hit - t_expected) > 1e-5 * t_expected) {
+        t_mismatch++;
+      }
+      const int id = isect.prim_id;
+      const Vector center = ptc.GetPointPosition(id) + time * ptc.GetPointVelocity(id);
+      if (Length(center - center_expected) > 1e-5) {
+        point_mismatch++;
+      }
+    }
+    TEST(hit_count > 100);
+    TEST_INT(hit_mismatch, 0);
+    TEST_INT(t_mismatch, 0);
+    TEST_INT(point_mismatch, 0);
+  }
+
+  {
+    // without lod the hierarchy finds the nearest point of all
+    int hit_count = 0;
+    int mismatch = 0;
+
+    for (int i = 0; i < 1000; i++) {
+      const Real time = .5 * (i % 3);
+      const Ray ray = random_ray(&rng);
+      Real t_expected = 0;
+      int id_expected = -1;
+      Intersection isect;
+
+      const bool hit_expected = intersect_packed_points(ptc, time, ray,
+          &t_expected, &id_expected);
+      const bool hit = intersect_point_cloud(ptc, time, ray, &isect);
+
+      if (hit != hit_expected) {
+        mismatch++;
+        continue;
+      }
+      if (!hit) {
+        continue;
+      }
+      hit_count++;
+
+      if (isect.prim_id != id_expected || Abs(isect.t_hit - t_expected) > 1e-12) {
+        mismatch++;
+      }
+    }
+    TEST(hit_count > 100);
+    TEST_INT(mismatch, 0);
+  }
+  {
+    // wide footprints stop at proxies of whole nodes and
+    // report the first point of the node
+    const int TOP_NODE_POINTS = 4 * 4 * 4 * 4;
+    int hit_count = 0;
+    int top_proxy_count = 0;
+    int proxy_count = 0;
+    int bad_proxy_count = 0;
+
+    for (int i = 0; i < 1000; i++) {
+      Ray ray = random_ray(&rng);
+      Intersection isect;
+
+      ray.lod_footprint = 10;
+      if (intersect_point_cloud(ptc, 0, ray, &isect)) {
+        hit_count++;
+        if (isect.prim_id % TOP_NODE_POINTS == 0) {
+          top_proxy_count++;
+        }
+      }
+
+      // hits off the sphere of their point are proxies of packets or nodes
+      ray.lod_footprint = .1;
+      if (intersect_point_cloud(ptc, 0, ray, &isect)) {
+        const Vector center = ptc.GetPointPosition(isect.prim_id);
+        const Real radius = ptc.GetPointRadius(isect.prim_id);
+        const Real distance = Length(RayPointAt(ray, isect.t_hit) - center);
+
+        if (Abs(distance - radius) > 1e-9) {
+          proxy_count++;
+          if (isect.prim_id % 4 != 0) {
+            bad_proxy_count++;
+          }
+        }
+      }
+    }
+    TEST(hit_count > 100);
+    TEST_INT(top_proxy_count, hit_count);
+    TEST(proxy_count > 0);
+    TEST_INT(bad_proxy_count, 0);
+  }
+
+  printf("%s: %d/%d/%d: (FAIL/PASS/TOTAL)\n", __FILE__,
+      TestGetFailCount(), TestGetPassCount(), TestGetTotalCount());
+
+  return 0;
+}
@@ -0,0 +1,88 @@
+// Copyright (c) 2011-2014 Hiroshi Tsubokawa
+// See LICENSE and README
+
+#include "unit_test.h"
+#include "fj_random.h"
+#include <cstdio>
+
+using namespace fj;
+
+// counts the elementary intervals of 2^xbits by 2^ybits cells that
+// do not have exactly one of the 2^(xbits + ybits) points
+static int count_bad_intervals(const double *x, const double *y, int xbits, int ybits)
+{
+  const int XCELLS = 1 << xbits;
+  const int YCELLS = 1 << ybits;
+  int count[256] = {0};
+  int bad = 0;
+
+  for (int i = 0; i < XCELLS * YCELLS; i++) {
+    const int cx = (int) (x[i] * XCELLS);
+    const int cy = (int) (y[i] * YCELLS);
+    count[cy * XCELLS + cx]++;
+  }
+  for (int i = 0; i < XCELLS * YCELLS; i++) {
+    if (count[i] != 1) {
+      bad++;
+    }
+  }
+  return bad;
+}
+
+int main()
+{
+  {
+    // every scramble keeps the 16 points in all elementary intervals
+    XorShift rng(12345);
+    int bad = 0;
+    bool in_range = true;
+
+    for (int trial = 0; trial < 100; trial++) {
+      const uint32_t seed_x = XorNextInteger(&rng);
+      const uint32_t seed_y = XorNextInteger(&rng);
+      double x[16], y[16];
+
+      for (int i = 0; i < 16; i++) {
+        ScrambledSobol2D(i, seed_x, seed_y, &x[i], &y[i]);
+        in_range = in_range && x[i] >= 0 && x[i] < 1 && y[i] >= 0 && y[i] < 1;
+      }
+      if (!in_range) {
+        break;
+      }
+      for (int xbits = 0; xbits <= 4; xbits++) {
+        bad += count_bad_intervals(x, y, xbits, 4 - xbits);
+      }
+    }
+    TEST(in_range);
+    TEST_INT(bad, 0);
+  }
+  {
+    // different seeds give different patterns
+    double x0 = 0, y0 = 0, x1 = 0, y1 = 0;
+    ScrambledSobol2D(3, 1, 2, &x0, &y0);
+    ScrambledSobol2D(3, 3, 4, &x1, &y1);
+    TEST(x0 != x1);
+    TEST(y0 != y1);
+  }
+  {
+    // every index lands on a different position for any count
+    bool is_permutation = true;
+    bool differs = false;
+
+    for (uint32_t count = 1; count <= 20; count++) {
+      int hit[20] = {0};
+      for (uint32_t i = 0; i < count; i++) {
+        const uint32_t pos = PermuteIndex(i, count, 7 * count);
+        is_permutation = is_permutation && pos < count && hit[pos]++ == 0;
+        differs = differs || pos != PermuteIndex(i, count, 7 * count + 1);
+      }
+    }
+    TEST(is_permutation);
+    TEST(differs);
+  }
+
+  printf("%s: %d/%d/%d: (FAIL/PASS/TOTAL)\n", __FILE__,
+      TestGetFailCount(), TestGetPassCount(), TestGetTotalCount());
+
+  return 0;
+}
@@ -0,0 +1,551 @@
+// Copyright (c) 2011-2014 Hiroshi Tsubokawa
+// See LICENSE and README
+
+#include "unit_test.h"
+#include "fj_object_instance.h"
+#include "fj_bvh_accelerator.h"
+#include "fj_object_group.h"
+#include "fj_framebuffer.h"
+#include "fj_renderer.h"
+#include "fj_sampler.h"
+#include "fj_shading.h"
+#include "fj_numeric.h"
+#include "fj_camera.h"
+#include "fj_shader.h"
+#include "fj_light.h"
+#include "fj_mesh.h"
+#include <cstdlib>
+#include <cstdio>
+#include <new>
+
+using namespace fj;
+
+// every heap allocation in the process goes through here. counting is only
+// turned on while a tile is being rendered.
+static bool count_alloc = false;
+static int alloc_count = 0;
+
+void *operator new(std::size_t size) throw(std::bad_alloc)
+{
+  if (count_alloc) {
+    alloc_count++;
+  }
+  void *ptr = std::malloc(size == 0 ? 1 : size);
+  if (ptr == NULL) {
+    throw std::bad_alloc();
+  }
+  return ptr;
+}
+
+void *operator new[](std::size_t size) throw(std::bad_alloc)
+{
+  return operator new(size);
+}
+
+void operator delete(void *ptr) throw()
+{
+  std::free(ptr);
+}
+
+void operator delete[](void *ptr) throw()
+{
+  std::free(ptr);
+}
+
+class TileAllocation {
+public:
+  TileAllocation() : tile_count(0), first_tile(0), other_tiles(0), sample_count(0) {}
+  ~TileAllocation() {}
+
+  int tile_count;
+  int first_tile;
+  int other_tiles;
+  int sample_count;
+};
+
+static Interrupt count_tile_start(void *data, const TileInfo *info)
+{
+  alloc_count = 0;
+  count_alloc = true;
+  return CALLBACK_CONTINUE;
+}
+
+static Interrupt count_sample_done(void *data)
+{
+  TileAllocation *tile_alloc = (TileAllocation *) data;
+  tile_alloc->sample_count++;
+  return CALLBACK_CONTINUE;
+}
+
+static Interrupt count_tile_done(void *data, const TileInfo *info)
+{
+  TileAllocation *tile_alloc = (TileAllocation *) data;
+
+  count_alloc = false;
+  if (tile_alloc->tile_count == 0) {
+    tile_alloc->first_tile += alloc_count;
+  } else {
+    tile_alloc->other_tiles += alloc_count;
+  }
+  tile_alloc->tile_count++;
+
+  return CALLBACK_CONTINUE;
+}
+
+static Interrupt quiet_frame(void *data, const FrameInfo *info)
+{
+  return CALLBACK_CONTINUE;
+}
+
+// a shader that exercises light samples, shadow rays and reflection rays
+static void test_evaluate(const void *self, const TraceContext *cxt,
+    const SurfaceInput *in, SurfaceOutput *out)
+{
+  const int nsamples = SlGetLightSampleCount(cxt, in);
+  LightSample *samples = SlNewLightSamples(cxt, in);
+
+  out->Cs = Color();
+  out->Os = 1;
+
+  for (int i = 0; i < nsamples; i++) {
+    LightOutput Lout;
+    SlIlluminance(cxt, &samples[i], &in->P, &in->N, PI / 2., in, &Lout);
+    out->Cs.r += Lout.Cl.r;
+    out->Cs.g += Lout.Cl.g;
+    out->Cs.b += Lout.Cl.b;
+  }
+
+  SlFreeLightSamples(cxt, samples);
+
+  {
+    TraceContext refl_cxt = SlReflectContext(cxt, in->shaded_object);
+    Vector R;
+    Color4 C_refl;
+    double t_hit = REAL_MAX;
+
+    SlScaleThroughput(&refl_cxt, .5);
+    SlReflect(&in->I, &in->N, &R);
+    Normalize(&R);
+    SlTrace(&refl_cxt, &in->P, &R, .001, 1000, &C_refl, &t_hit);
+    out->Cs.r += .5 * C_refl.r;
+    out->Cs.g += .5 * C_refl.g;
+    out->Cs.b += .5 * C_refl.b;
+  }
+}
+
+static int batch_evaluate_count = 0;
+
+static void test_evaluate_batch(const void *self, const TraceContext *cxts,
+    const SurfaceInput *ins, SurfaceOutput *outs, int count)
+{
+  batch_evaluate_count++;
+  for (int i = 0; i < count; i++) {
+    test_evaluate(self, &cxts[i], &ins[i], &outs[i]);
+  }
+}
+
+// a quad facing +z
+static void build_quad(Mesh *mesh, Real size, Real z)
+{
+  mesh->SetVertexCount(4);
+  mesh->SetFaceCount(2);
+  mesh->AddVertexPosition();
+  mesh->AddFaceIndices();
+
+  mesh->SetVertexPosition(0, Vector(-size, -size, z));
+  mesh->SetVertexPosition(1, Vector( size, -size, z));
+  mesh->SetVertexPosition(2, Vector( size,  size, z));
+  mesh->SetVertexPosition(3, Vector(-size,  size, z));
+
+  Index3 tri;
+  tri.i0 = 0; tri.i1 = 1; tri.i2 = 2;
+  mesh->SetFaceIndices(0, tri);
+  tri.i0 = 0; tri.i1 = 2; tri.i2 = 3;
+  mesh->SetFaceIndices(1, tri);
+
+  mesh->ComputeNormals();
+  mesh->ComputeBounds();
+}
+
+// renderer settings a test changes. the defaults are the ones of Renderer
+class RenderOptions {
+public:
+  RenderOptions() :
+      thread_count(1),
+      tile_size(8),
+      ray_packet_size(0),
+      sorted_shading(0),
+      shader_batch(0),
+      adaptive_threshold(0),
+      progressive(0),
+      sample_splatting(1),
+      sampler_type(SMP_JITTERED),
+      roulette_threshold(0),
+      tile_alloc(NULL)
+  {
+  }
+  ~RenderOptions() {}
+
+  int thread_count;
+  int tile_size;
+  int ray_packet_size;
+  int sorted_shading;
+  int shader_batch;
+  float adaptive_threshold;
+  int progressive;
+  int sample_splatting;
+  int sampler_type;
+  float roulette_threshold;
+  TileAllocation *tile_alloc;
+};
+
+// two quads lit by a point light and a grid light
+class TestScene {
+public:
+  TestScene()
+  {
+    table.MyEvaluate = test_evaluate;
+    table.MyEvaluateBatch = NULL;
+    shader.vptr_ = &table;
+    batch_table.MyEvaluate = test_evaluate;
+    batch_table.MyEvaluateBatch = test_evaluate_batch;
+    batch_shader.vptr_ = &batch_table;
+
+    build_quad(&wall, 5, 0);
+    build_quad(&panel, 1, 1);
+    wall_acc.SetPrimitiveSet(&wall);
+    panel_acc.SetPrimitiveSet(&panel);
+
+    point.SetLightType(LGT_POINT);
+    point.SetTranslate(0, 0, 4, 0);
+    grid.SetLightType(LGT_GRID);
+    grid.SetTranslate(1, 1, 3, 0);
+    grid.SetSampleCount(4);
+    lights[0] = &point;
+    lights[1] = &grid;
+
+    objects[0] = &wall_obj;
+    objects[1] = &panel_obj;
+    wall_obj.SetSurface(&wall_acc);
+    panel_obj.SetSurface(&panel_acc);
+
+    for (int i = 0; i < 2; i++) {
+      ObjectInstance *obj = objects[i];
+      obj->SetShader(i == 0 ? &shader : &batch_shader, 0);
+      obj->SetLightList((const Light **) lights, 2);
+      obj->SetReflectTarget(&all_objects);
+      obj->SetRefractTarget(&all_objects);
+      obj->SetShadowTarget(&all_objects);
+      self_groups[i].AddObject(obj);
+      obj->SetSelfHitTarget(&self_groups[i]);
+      all_objects.AddObject(obj);
+    }
+
+    wall_acc.ComputeBounds();
+    panel_acc.ComputeBounds();
+    for (int i = 0; i < 2; i++) {
+      objects[i]->ComputeBounds();
+      self_groups[i].ComputeBounds();
+    }
+    all_objects.ComputeBounds();
+
+    wall_acc.Build();
+    panel_acc.Build();
+    for (int i = 0; i < 2; i++) {
+      ((Accelerator *) self_groups[i].GetSurfaceAccelerator())->Build();
+    }
+    ((Accelerator *) all_objects.GetSurfaceAccelerator())->Build();
+
+    camera.SetTranslate(0, 0, 6, 0);
+  }
+  ~TestScene() {}
+
+  int Render(FrameBuffer *fb, const RenderOptions &options)
+  {
+    Renderer renderer;
+    renderer.SetResolution(32, 32);
+    renderer.SetTileSize(options.tile_size, options.tile_size);
+    renderer.SetPixelSamples(2, 2);
+    renderer.SetCamera(&camera);
+    renderer.SetFrameBuffers(fb);
+    renderer.SetTargetObjects(&all_objects);
+    renderer.SetTargetLights(lights, 2);
+    renderer.SetUseMaxThread(0);
+    renderer.SetThreadCount(options.thread_count);
+    renderer.SetRayPacketSize(options.ray_packet_size);
+    renderer.SetSortedShadingEnable(options.sorted_shading);
+    renderer.SetShaderBatchEnable(options.shader_batch);
+    renderer.SetAdaptiveThreshold(options.adaptive_threshold);
+    renderer.SetProgressive(options.progressive);
+    renderer.SetSampleSplatting(options.sample_splatting);
+    renderer.SetSamplerType(options.sampler_type);
+    renderer.SetRouletteThreshold(options.roulette_threshold);
+    renderer.SetFrameReportCallback(NULL, quiet_frame, NULL, quiet_frame);
+    if (options.tile_alloc != NULL) {
+      renderer.SetTileReportCallback(options.tile_alloc,
+          count_tile_start, count_sample_done, count_tile_done);
+    } else {
+      renderer.SetTileReportCallback(NULL, NULL, NULL, NULL);
+    }
+
+    const int err = renderer.RenderScene();
+    ray_counts = renderer.GetRayCounts();
+    return err;
+  }
+
+  RayCounts ray_counts;
+
+private:
+  ShaderFunctionTable table, batch_table;
+  Shader shader, batch_shader;
+  Mesh wall, panel;
+  BVHAccelerator wall_acc, panel_acc;
+  Light point, grid;
+  Light *lights[2];
+  ObjectInstance wall_obj, panel_obj;
+  ObjectInstance *objects[2];
+  ObjectGroup all_objects;
+  ObjectGroup self_groups[2];
+  Camera camera;
+};
+
+static int count_pixel_mismatches(const FrameBuffer &a, const FrameBuffer &b)
+{
+  int count = 0;
+
+  for (int y = 0; y < a.GetHeight(); y++) {
+    for (int x = 0; x < a.GetWidth(); x++) {
+      const Color4 A = a.GetColor(x, y);
+      const Color4 B = b.GetColor(x, y);
+      if (A.r != B.r || A.g != B.g || A.b != B.b || A.a != B.a) {
+        count++;
+      }
+    }
+  }
+  return count;
+}
+
+static float max_pixel_difference(const FrameBuffer &a, const FrameBuffer &b)
+{
+  float max_diff = 0;
+
+  for (int y = 0; y < a.GetHeight(); y++) {
+    for (int x = 0; x < a.GetWidth(); x++) {
+      const Color4 A = a.GetColor(x, y);
+      const Color4 B = b.GetColor(x, y);
+      max_diff = Max(max_diff, Abs(A.r - B.r));
+      max_diff = Max(max_diff, Abs(A.g - B.g));
+      max_diff = Max(max_diff, Abs(A.b - B.b));
+      max_diff = Max(max_diff, Abs(A.a - B.a));
+    }
+  }
+  return max_diff;
+}
+
+int main()
+{
+  TestScene scene;
+
+  {
+    // after the first tile warmed up the per-thread arena, rendering
+    // the rest of the tiles does not touch the heap
+    FrameBuffer fb;
+    TileAllocation tile_alloc;
+    RenderOptions options;
+    options.tile_alloc = &tile_alloc;
+
+    TEST_INT(scene.Render(&fb, options), 0);
+    TEST_INT(tile_alloc.tile_count, 16);
+    TEST(tile_alloc.first_tile > 0);
+    TEST_INT(tile_alloc.other_tiles, 0);
+
+    // the image is not empty
+    const Color4 C = fb.GetColor(16, 16);
+    TEST(C.r > 0);
+  }
+  {
+    // light samples are the same whichever thread renders the tile
+    FrameBuffer fb1, fb4;
+    RenderOptions threads;
+    threads.thread_count = 4;
+
+    TEST_INT(scene.Render(&fb1, RenderOptions()), 0);
+    TEST_INT(scene.Render(&fb4, threads), 0);
+    TEST_INT(count_pixel_mismatches(fb1, fb4), 0);
+  }
+  {
+    // shading samples are the same whichever tile takes them
+    FrameBuffer fb8, fb5, fb32, fb8_margin, fb5_margin;
+    RenderOptions tile5, tile32, tile8_margin, tile5_margin;
+    tile5.tile_size = 5;
+    tile32.tile_size = 32;
+    tile8_margin.sample_splatting = 0;
+    tile5_margin.tile_size = 5;
+    tile5_margin.sample_splatting = 0;
+
+    TEST_INT(scene.Render(&fb8, RenderOptions()), 0);
+    TEST_INT(scene.Render(&fb5, tile5), 0);
+    TEST_INT(scene.Render(&fb32, tile32), 0);
+    TEST_INT(scene.Render(&fb8_margin, tile8_margin), 0);
+    TEST_INT(scene.Render(&fb5_margin, tile5_margin), 0);
+    TEST_INT(count_pixel_mismatches(fb8_margin, fb5_margin), 0);
+    // splatting only adds samples of the tiles in another order
+    TEST(max_pixel_difference(fb8, fb5) < 1e-5);
+    TEST(max_pixel_difference(fb8, fb32) < 1e-5);
+  }
+  {
+    // tracing camera rays in packets gives the same image as one by one
+    FrameBuffer fb_single, fb_packet, fb_partial;
+    RenderOptions packet, partial;
+    packet.ray_packet_size = 8;
+    partial.ray_packet_size = 3;
+
+    TEST_INT(scene.Render(&fb_single, RenderOptions()), 0);
+    TEST_INT(scene.Render(&fb_packet, packet), 0);
+    TEST_INT(scene.Render(&fb_partial, partial), 0);
+    TEST_INT(count_pixel_mismatches(fb_single, fb_packet), 0);
+    TEST_INT(count_pixel_mismatches(fb_single, fb_partial), 0);
+  }
+  {
+    // shading in the sorted order gives the same image
+    FrameBuffer fb_single, fb_sorted, fb_sorted_packet;
+    RenderOptions sorted, sorted_packet;
+    sorted.sorted_shading = 1;
+    sorted_packet.sorted_shading = 1;
+    sorted_packet.thread_count = 2;
+    sorted_packet.ray_packet_size = 4;
+
+    TEST_INT(scene.Render(&fb_single, RenderOptions()), 0);
+    TEST_INT(scene.Render(&fb_sorted, sorted), 0);
+    TEST_INT(scene.Render(&fb_sorted_packet, sorted_packet), 0);
+    TEST_INT(count_pixel_mismatches(fb_single, fb_sorted), 0);
+    TEST_INT(count_pixel_mismatches(fb_single, fb_sorted_packet), 0);
+  }
+  {
+    // evaluating shaders in batches gives the same image
+    FrameBuffer fb_single, fb_batch;
+    RenderOptions batch;
+    batch.shader_batch = 1;
+    batch.thread_count = 2;
+    batch.ray_packet_size = 4;
+
+    TEST_INT(scene.Render(&fb_single, RenderOptions()), 0);
+    TEST_INT(batch_evaluate_count, 0);
+
+    TEST_INT(scene.Render(&fb_batch, batch), 0);
+    TEST(batch_evaluate_count > 0);
+    TEST_INT(count_pixel_mismatches(fb_single, fb_batch), 0);
+  }
+  {
+    // samples added to noisy pixels are the same in every mode
+    FrameBuffer fb_fixed, fb_single, fb_packet, fb_sorted;
+    RenderOptions single, packet, sorted;
+    single.adaptive_threshold = .001;
+    packet.adaptive_threshold = .001;
+    packet.thread_count = 4;
+    packet.ray_packet_size = 8;
+    sorted.adaptive_threshold = .001;
+    sorted.thread_count = 2;
+    sorted.ray_packet_size = 4;
+    sorted.sorted_shading = 1;
+
+    TEST_INT(scene.Render(&fb_fixed, RenderOptions()), 0);
+    TEST_INT(scene.Render(&fb_single, single), 0);
+    TEST_INT(scene.Render(&fb_packet, packet), 0);
+    TEST_INT(scene.Render(&fb_sorted, sorted), 0);
+    TEST(count_pixel_mismatches(fb_fixed, fb_single) > 0);
+    TEST_INT(count_pixel_mismatches(fb_single, fb_packet), 0);
+    TEST_INT(count_pixel_mismatches(fb_single, fb_sorted), 0);
+  }
+  {
+    // passes trace the same samples as tiles. only the order of
+    // the sums in the filter differs
+    FrameBuffer fb_tile, fb_single, fb_sorted;
+    RenderOptions single, sorted;
+    single.progressive = 1;
+    sorted.progressive = 1;
+    sorted.thread_count = 2;
+    sorted.ray_packet_size = 4;
+    sorted.sorted_shading = 1;
+    sorted.shader_batch = 1;
+
+    TEST_INT(scene.Render(&fb_tile, RenderOptions()), 0);
+    TEST_INT(scene.Render(&fb_single, single), 0);
+    TEST_INT(scene.Render(&fb_sorted, sorted), 0);
+    TEST(max_pixel_difference(fb_tile, fb_single) < 1e-5);
+    TEST(max_pixel_difference(fb_tile, fb_sorted) < 1e-5);
+  }
+  {
+    // splatting traces each camera sample once. tiles with margins trace
+    // samples near borders again
+    FrameBuffer fb_splat, fb_margin;
+    TileAllocation splat_alloc, margin_alloc;
+    RenderOptions splat, margin;
+    splat.tile_alloc = &splat_alloc;
+    margin.tile_alloc = &margin_alloc;
+    margin.sample_splatting = 0;
+
+    TEST_INT(scene.Render(&fb_splat, splat), 0);
+    TEST_INT(scene.Render(&fb_margin, margin), 0);
+    TEST_INT(splat_alloc.sample_count, 32 * 32 * 2 * 2);
+    TEST(margin_alloc.sample_count > splat_alloc.sample_count);
+
+    // the same image but for the noise
+    TEST(max_pixel_difference(fb_splat, fb_margin) < .1);
+  }
+  {
+    // sobol samples are the same whichever tile, pass or packet
+    // takes them
+    FrameBuffer fb_jittered, fb_single, fb_packet, fb_pass, fb_margin;
+    RenderOptions single, packet, pass, margin;
+    single.sampler_type = SMP_SOBOL;
+    packet.sampler_type = SMP_SOBOL;
+    packet.thread_count = 2;
+    packet.ray_packet_size = 4;
+    packet.sorted_shading = 1;
+    pass.sampler_type = SMP_SOBOL;
+    pass.thread_count = 2;
+    pass.progressive = 1;
+    margin.sampler_type = SMP_SOBOL;
+    margin.sample_splatting = 0;
+
+    TEST_INT(scene.Render(&fb_jittered, RenderOptions()), 0);
+    TEST_INT(scene.Render(&fb_single, single), 0);
+    TEST_INT(scene.Render(&fb_packet, packet), 0);
+    TEST_INT(scene.Render(&fb_pass, pass), 0);
+    TEST_INT(scene.Render(&fb_margin, margin), 0);
+    TEST(count_pixel_mismatches(fb_jittered, fb_single) > 0);
+    TEST_INT(count_pixel_mismatches(fb_single, fb_packet), 0);
+    TEST(max_pixel_difference(fb_single, fb_pass) < 1e-5);
+    TEST(max_pixel_difference(fb_single, fb_margin) < .1);
+  }
+  {
+    // packets trace the same rays. roulette stops some of
+    // the reflection rays
+    FrameBuffer fb_single, fb_packet, fb_roulette;
+    RenderOptions packet, roulette;
+    packet.thread_count = 2;
+    packet.ray_packet_size = 4;
+    packet.sorted_shading = 1;
+    roulette.roulette_threshold = 1;
+
+    TEST_INT(scene.Render(&fb_single, RenderOptions()), 0);
+    const RayCounts single = scene.ray_counts;
+    TEST_INT(scene.Render(&fb_packet, packet), 0);
+    const RayCounts packet_counts = scene.ray_counts;
+    TEST_INT(scene.Render(&fb_roulette, roulette), 0);
+    const RayCounts roulette_counts = scene.ray_counts;
+
+    TEST_INT(single.traced[CXT_CAMERA_RAY], 32 * 32 * 2 * 2);
+    TEST_INT(packet_counts.GetTotal(), single.GetTotal());
+    TEST_INT(single.terminated, 0);
+    TEST(roulette_counts.terminated > 0);
+    TEST(roulette_counts.traced[CXT_REFLECT_RAY] < single.traced[CXT_REFLECT_RAY]);
+    TEST_INT(roulette_counts.traced[CXT_CAMERA_RAY], single.traced[CXT_CAMERA_RAY]);
+  }
+
+  printf("%s: %d/%d/%d: (FAIL/PASS/TOTAL)\n", __FILE__,
+      TestGetFailCount(), TestGetPassCount(), TestGetTotalCount());
+
+  return 0;
+}
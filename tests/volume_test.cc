@@ -0,0 +1,228 @@
+// Copyright (c) 2011-2014 Hiroshi Tsubokawa
+// See LICENSE and README
+
+#include "unit_test.h"
+#include "fj_volume.h"
+#include "fj_numeric.h"
+#include "fj_random.h"
+#include "fj_vector.h"
+#include "fj_box.h"
+#include <cstdio>
+#include <vector>
+
+using namespace fj;
+
+// a voxel is 1 x 1 x 1 in the volume
+static void setup_volume(Volume *volume, int res)
+{
+  volume->Resize(res, res, res);
+  volume->SetBounds(Box(0, 0, 0, res, res, res));
+}
+
+int main()
+{
+  {
+    VoxelBuffer buffer;
+    buffer.Resize(20, 17, 9);
+
+    TEST_INT(buffer.GetTileResolution().x, 3);
+    TEST_INT(buffer.GetTileResolution().y, 3);
+    TEST_INT(buffer.GetTileResolution().z, 2);
+    TEST_INT(buffer.GetAllocatedTileCount(), 0);
+
+    // zeros need no tiles
+    buffer.SetValue(3, 3, 3, 0);
+    TEST_INT(buffer.GetAllocatedTileCount(), 0);
+
+    buffer.SetValue(7, 8, 0, .5);
+    buffer.SetValue(8, 8, 0, .25);
+    buffer.SetValue(19, 16, 8, 2);
+    buffer.SetValue(20, 16, 8, 3);
+    TEST_INT(buffer.GetAllocatedTileCount(), 3);
+    TEST(!buffer.IsTileAllocated(0, 0, 0));
+    TEST(buffer.IsTileAllocated(0, 1, 0));
+    TEST(buffer.IsTileAllocated(1, 1, 0));
+    TEST(buffer.IsTileAllocated(2, 2, 1));
+    TEST(!buffer.IsTileAllocated(3, 2, 1));
+
+    TEST_FLOAT(buffer.GetValue(7, 8, 0), .5);
+    TEST_FLOAT(buffer.GetValue(8, 8, 0), .25);
+    TEST_FLOAT(buffer.GetValue(6, 8, 0), 0.f);
+    TEST_FLOAT(buffer.GetValue(19, 16, 8), 2.f);
+    TEST_FLOAT(buffer.GetValue(20, 16, 8), 0.f);
+    TEST_FLOAT(buffer.GetValue(3, 3, 3), 0.f);
+
+    TEST(buffer.GetMemoryUsage() >= 3 * 512 * sizeof(float));
+    TEST(buffer.GetMemoryUsage() < 4 * 512 * sizeof(float));
+
+    buffer.Resize(4, 4, 4);
+    TEST_INT(buffer.GetAllocatedTileCount(), 0);
+    TEST_FLOAT(buffer.GetValue(1, 1, 1), 0.f);
+  }
+  {
+    // halves keep 11 bits of the mantissa
+    const float values[] = {.5, .25, 1./3, 2, 1e-5, 1e-7, 65504, -3.1f};
+    const int NVALUES = sizeof(values) / sizeof(values[0]);
+    VoxelBuffer buffer;
+    buffer.Resize(16, 1, 1);
+    buffer.SetStorage(VOX_HALF);
+
+    for (int i = 0; i < NVALUES; i++) {
+      buffer.SetValue(i, 0, 0, values[i]);
+    }
+    const size_t float_memory = buffer.GetMemoryUsage();
+    buffer.Compress();
+    TEST(buffer.GetMemoryUsage() < float_memory);
+
+    TEST_FLOAT(buffer.GetValue(0, 0, 0), .5);
+    TEST_FLOAT(buffer.GetValue(1, 0, 0), .25);
+    TEST_FLOAT(buffer.GetValue(3, 0, 0), 2.f);
+    TEST_FLOAT(buffer.GetValue(6, 0, 0), 65504.f);
+    TEST_FLOAT(buffer.GetValue(8, 0, 0), 0.f);
+
+    bool close = true;
+    for (int i = 0; i < NVALUES; i++) {
+      const float error = Abs(buffer.GetValue(i, 0, 0) - values[i]);
+      // subnormal halves are 2^-24 apart
+      if (error > Abs(values[i]) / 2048 && error > 1.f / (1 << 25)) {
+        close = false;
+      }
+    }
+    TEST(close);
+
+    double max_error = 0, rms_error = 0;
+    buffer.GetStorageError(&max_error, &rms_error);
+    TEST(max_error > 0);
+    TEST(max_error < 3.1 / 2048);
+    TEST(rms_error > 0);
+    TEST(rms_error <= max_error);
+
+    // setting a voxel goes back to floats
+    buffer.SetValue(5, 0, 0, 1./3);
+    TEST(buffer.GetMemoryUsage() == float_memory);
+    TEST_FLOAT(buffer.GetValue(5, 0, 0), 1.f/3);
+    TEST_FLOAT(buffer.GetValue(0, 0, 0), .5);
+  }
+  {
+    // bytes are within half a level of the range of each tile
+    VoxelBuffer buffer;
+    XorShift rng(5678);
+    const int RES = 16;
+    std::vector<float> values(RES * RES * RES, 0);
+    buffer.Resize(RES, RES, RES);
+    buffer.SetStorage(VOX_BYTE);
+
+    for (int i = 0; i < RES * RES * RES; i++) {
+      // tile z 0 is in [0, 1) and tile z 1 is in [0, 100)
+      const int z = i / (RES * RES);
+      values[i] = XorNextFloat01(&rng) * (z < 8 ? 1 : 100);
+      if (i % 7 == 0) {
+        values[i] = 0;
+      }
+      buffer.SetValue(i % RES, (i / RES) % RES, z, values[i]);
+    }
+    const size_t float_memory = buffer.GetMemoryUsage();
+    buffer.Compress();
+    TEST(buffer.GetMemoryUsage() < float_memory / 3);
+
+    double max_error_near = 0;
+    double max_error_far = 0;
+    bool zeros_kept = true;
+    for (int i = 0; i < RES * RES * RES; i++) {
+      const int z = i / (RES * RES);
+      const float value = buffer.GetValue(i % RES, (i / RES) % RES, z);
+      const double error = Abs(value - values[i]);
+      if (z < 8) {
+        max_error_near = Max(max_error_near, error);
+      } else {
+        max_error_far = Max(max_error_far, error);
+      }
+      if (values[i] == 0 && value != 0) {
+        zeros_kept = false;
+      }
+    }
+    TEST(max_error_near <= .5 / 255 + 1e-6);
+    TEST(max_error_far <= 50. / 255 + 1e-4);
+    TEST(zeros_kept);
+
+    double max_error = 0, rms_error = 0;
+    buffer.GetStorageError(&max_error, &rms_error);
+    TEST_DOUBLE(max_error, max_error_far);
+  }
+  {
+    Volume volume;
+    Real occupied = 0;
+    setup_volume(&volume, 32);
+    volume.SetValue(20, 4, 4, 1);
+
+    // no grid, no skipping
+    TEST(!volume.HasMacroGrid());
+    TEST(volume.GetEmptySpan(Vector(.5, 4.5, 4.5), Vector(1, 0, 0), &occupied) == 0);
+
+    volume.BuildMacroGrid();
+    TEST(volume.HasMacroGrid());
+
+    // voxel 19 to 21 are in the cell from 16 to 24
+    TEST_DOUBLE(volume.GetEmptySpan(Vector(.5, 4.5, 4.5), Vector(1, 0, 0), &occupied),
+        15.5);
+    TEST_DOUBLE(volume.GetEmptySpan(Vector(.5, 4.5, 4.5), Vector(2, 0, 0), &occupied),
+        7.75);
+    TEST(volume.GetEmptySpan(Vector(.5, 4.5, 4.5), Vector(0, 1, 0), &occupied) ==
+        REAL_MAX);
+    TEST(volume.GetEmptySpan(Vector(-8, 4.5, 4.5), Vector(-1, 0, 0), &occupied) ==
+        REAL_MAX);
+
+    TEST(volume.GetEmptySpan(Vector(20.5, 4.5, 4.5), Vector(1, 0, 0), &occupied) == 0);
+    TEST_DOUBLE(occupied, 3.5);
+
+    // filling voxels drops the grid
+    volume.SetValue(0, 0, 0, 1);
+    TEST(!volume.HasMacroGrid());
+  }
+  {
+    // samples in the empty span are all zero
+    Volume volume;
+    XorShift rng(1234);
+    const int RES = 40;
+    setup_volume(&volume, RES);
+
+    for (int i = 0; i < 10; i++) {
+      const int x = (int) (XorNextFloat01(&rng) * RES);
+      const int y = (int) (XorNextFloat01(&rng) * RES);
+      const int z = (int) (XorNextFloat01(&rng) * RES);
+      volume.SetValue(x, y, z, 1);
+    }
+    volume.BuildMacroGrid();
+
+    int nonzero_in_span = 0;
+    int skipped = 0;
+    for (int i = 0; i < 1000; i++) {
+      Vector P;
+      Vector dir;
+      XorSolidCubeRand(&rng, &P);
+      XorHollowSphereRand(&rng, &dir);
+      P = RES * (.5 * P + Vector(.5, .5, .5));
+
+      Real occupied = 0;
+      const Real span = volume.GetEmptySpan(P, dir, &occupied);
+      const Real t_end = Min(span, 2 * RES);
+
+      for (Real t = 0; t < t_end; t += .1) {
+        VolumeSample sample;
+        if (volume.GetSample(P + t * dir, &sample) && sample.density != 0) {
+          nonzero_in_span++;
+        }
+      }
+      if (span > 0) {
+        skipped++;
+      }
+    }
+    TEST_INT(nonzero_in_span, 0);
+    TEST(skipped > 0);
+  }
+
+  printf("%s: %d/%d/%d: (FAIL/PASS/TOTAL)\n", __FILE__,
+      TestGetFailCount(), TestGetPassCount(), TestGetTotalCount());
+
+  return 0;
+}
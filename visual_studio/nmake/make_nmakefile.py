@@ -213,6 +213,27 @@ target_list = [
 	'additional_ldflags': '',
 	'additional_libs':    'libscene.lib',
 },
+{
+	'name':               'curve_test.exe',
+	'source_list':        [top_dir + '/tests/curve_test.cc'],
+	'additional_cflags':  '',
+	'additional_ldflags': '',
+	'additional_libs':    'libscene.lib ' + top_dir + '/tests/unit_test.obj',
+},
+{
+	'name':               'filter_test.exe',
+	'source_list':        [top_dir + '/tests/filter_test.cc'],
+	'additional_cflags':  '',
+	'additional_ldflags': '',
+	'additional_libs':    'libscene.lib ' + top_dir + '/tests/unit_test.obj',
+},
+{
+	'name':               'importance_sampling_test.exe',
+	'source_list':        [top_dir + '/tests/importance_sampling_test.cc'],
+	'additional_cflags':  '',
+	'additional_ldflags': '',
+	'additional_libs':    'libscene.lib ' + top_dir + '/tests/unit_test.obj',
+},
 {
 	'name':               'io_test.exe',
 	'source_list':        [top_dir + '/tests/io_test.cc'],
@@ -220,6 +241,20 @@ target_list = [
 	'additional_ldflags': '',
 	'additional_libs':    'libscene.lib ' + top_dir + '/tests/unit_test.obj',
 },
+{
+	'name':               'light_tree_test.exe',
+	'source_list':        [top_dir + '/tests/light_tree_test.cc'],
+	'additional_cflags':  '',
+	'additional_ldflags': '',
+	'additional_libs':    'libscene.lib ' + top_dir + '/tests/unit_test.obj',
+},
+{
+	'name':               'mesh_test.exe',
+	'source_list':        [top_dir + '/tests/mesh_test.cc'],
+	'additional_cflags':  '',
+	'additional_ldflags': '',
+	'additional_libs':    'libscene.lib ' + top_dir + '/tests/unit_test.obj',
+},
 {
 	'name':               'numeric_test.exe',
 	'source_list':        [top_dir + '/tests/numeric_test.cc'],
@@ -227,6 +262,27 @@ target_list = [
 	'additional_ldflags': '',
 	'additional_libs':    'libscene.lib ' + top_dir + '/tests/unit_test.obj',
 },
+{
+	'name':               'point_cloud_test.exe',
+	'source_list':        [top_dir + '/tests/point_cloud_test.cc'],
+	'additional_cflags':  '',
+	'additional_ldflags': '',
+	'additional_libs':    'libscene.lib ' + top_dir + '/tests/unit_test.obj',
+},
+{
+	'name':               'random_test.exe',
+	'source_list':        [top_dir + '/tests/random_test.cc'],
+	'additional_cflags':  '',
+	'additional_ldflags': '',
+	'additional_libs':    'libscene.lib ' + top_dir + '/tests/unit_test.obj',
+},
+{
+	'name':               'renderer_test.exe',
+	'source_list':        [top_dir + '/tests/renderer_test.cc'],
+	'additional_cflags':  '',
+	'additional_ldflags': '',
+	'additional_libs':    'libscene.lib ' + top_dir + '/tests/unit_test.obj',
+},
 {
 	'name':               'vector_test.exe',
 	'source_list':        [top_dir + '/tests/vector_test.cc'],
@@ -234,6 +290,13 @@ target_list = [
 	'additional_ldflags': '',
 	'additional_libs':    'libscene.lib ' + top_dir + '/tests/unit_test.obj',
 },
+{
+	'name':               'volume_test.exe',
+	'source_list':        [top_dir + '/tests/volume_test.cc'],
+	'additional_cflags':  '',
+	'additional_ldflags': '',
+	'additional_libs':    'libscene.lib ' + top_dir + '/tests/unit_test.obj',
+},
 ]
 
 def fprint(f, header):